@@ -0,0 +1,129 @@
+/**
+  atorch.cpp - decoder for the Atorch S1B report frame (see atorch.h)
+*/
+//
+#include <string.h>
+#include "atorch.h"
+
+//////////////
+
+static inline uint32_t be16(const uint8_t *p) {
+  return ((uint32_t)p[0] << 8) | (uint32_t)p[1];
+}
+
+static inline uint32_t be24(const uint8_t *p) {
+  return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | (uint32_t)p[2];
+}
+
+static inline uint32_t be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+//////////////
+
+bool atorchDecode(const uint8_t *frame, size_t length, Sample &sample) {
+  if (length < ATORCH_FRAME_LEN) return false;
+  //
+  sample.volts10   = be24(frame + 4);    // bytes 04-06
+  sample.milliamps = be24(frame + 7);    // bytes 07-09
+  sample.watts10   = be24(frame + 10);   // bytes 10-12
+  sample.kwh100    = be32(frame + 13);   // bytes 13-16
+  sample.hz10      = be16(frame + 20);   // bytes 20-21
+  sample.pf1000    = be16(frame + 22);   // bytes 22-23
+  return true;
+}
+
+//////////////
+
+uint8_t atorchChecksum(const uint8_t *frame) {
+  uint8_t sum = 0;
+  for (size_t i = 2; i < ATORCH_FRAME_LEN - 1; i++) sum += frame[i];
+  return sum ^ 0x44;
+}
+
+//////////////
+
+void atorchCommand(uint8_t *frame, uint8_t device, uint8_t command, uint32_t value) {
+  frame[0] = ATORCH_MAGIC_0;
+  frame[1] = ATORCH_MAGIC_1;
+  frame[2] = ATORCH_MSG_COMMAND;
+  frame[3] = device;
+  frame[4] = command;
+  for (int i = 0; i < 4; i++) frame[5 + i] = (uint8_t)(value >> (24 - 8*i));
+  uint8_t sum = 0;
+  for (size_t i = 2; i < ATORCH_COMMAND_LEN - 1; i++) sum += frame[i];
+  frame[ATORCH_COMMAND_LEN - 1] = sum ^ 0x44;
+}
+
+//////////////
+
+void AtorchAssembler::feed(const uint8_t *data, size_t length, uint32_t nowMs, FrameHandler onFrame, void *context) {
+  // The notifications of one frame arrive back to back, so a fragment that has
+  // waited much longer than that belongs to a frame whose tail was lost
+  if (pos > 0 && nowMs - lastByteMs > ATORCH_FRAGMENT_MS) {
+    nShort++;
+    pos = 0;
+  }
+  if (length > 0) lastByteMs = nowMs;
+  //
+  for (size_t i = 0; i < length; i++) {
+    uint8_t b = data[i];
+    if (pos == 0) {
+      if (b != ATORCH_MAGIC_0) {
+        if (!skipping) nResync++;
+        skipping = true;
+        nSkipped++;
+        continue;
+      }
+    } else if (pos == 1) {
+      if (b != ATORCH_MAGIC_1) {
+        // FF not followed by 55: not a header (but this byte may start one)
+        if (!skipping) nResync++;
+        skipping = true;
+        nSkipped++;
+        pos = 0;
+        if (b != ATORCH_MAGIC_0) {
+          nSkipped++;
+          continue;
+        }
+      }
+    }
+    skipping = false;
+    buf[pos++] = b;
+    if (pos == ATORCH_FRAME_LEN) frameComplete(onFrame, context);
+  }
+}
+
+//////////////
+
+void AtorchAssembler::frameComplete(FrameHandler onFrame, void *context) {
+  if (buf[2] != ATORCH_MSG_REPORT || buf[3] != ATORCH_DEV_AC_METER) {
+    nUnsupported++;
+    resync(2);
+    return;
+  }
+  if (buf[ATORCH_FRAME_LEN - 1] != atorchChecksum(buf)) {
+    nBadChecksum++;
+    if (ATORCH_REJECT_BAD_CHECKSUM) {
+      // The header may have been a stray FF 55 inside a frame; the real one could be further on
+      resync(2);
+      return;
+    }
+  } else {
+    nGood++;
+  }
+  pos = 0;
+  onFrame(buf, context);
+}
+
+//////////////
+
+void AtorchAssembler::resync(size_t from) {
+  // Keep the bytes after buf[from] from the next FF 55 (or trailing FF) on
+  size_t i = from;
+  while (i < pos && !(buf[i] == ATORCH_MAGIC_0 && (i + 1 == pos || buf[i + 1] == ATORCH_MAGIC_1))) i++;
+  nResync++;
+  nSkipped += i;
+  memmove(buf, buf + i, pos - i);
+  pos -= i;
+}
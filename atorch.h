@@ -0,0 +1,89 @@
+/**
+  atorch.h - decoder for the 36-byte report sent by the Atorch S1B socket
+
+  The frame layout is described at the top of main.cpp. The decoder works on a
+  plain byte buffer, makes no heap allocations and does no I/O, so it is cheap
+  enough to call from the BLE callback.
+
+  BLE notifications are not guaranteed to carry exactly one frame (small MTU,
+  other Atorch models), so they are first passed through an AtorchAssembler,
+  which finds the FF 55 header, joins fragments and checks every frame
+  before it is handed on.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include <stddef.h>
+#include "sample.h"
+//
+#define ATORCH_FRAME_LEN     36    // length of a report frame [bytes]
+#define ATORCH_MAGIC_0       0xFF  // bytes 00-01, magic header
+#define ATORCH_MAGIC_1       0x55
+#define ATORCH_MSG_REPORT    0x01  // byte 02, message type
+#define ATORCH_DEV_AC_METER  0x01  // byte 03, device type
+#define ATORCH_FRAGMENT_MS   500   // a partial frame not completed within this time is dropped [ms]
+//
+// Commands to the socket: FF 55, message type 11, device type, command, a 4-byte big-endian
+// value, and a checksum over bytes 02-08 (like that of a report).
+#define ATORCH_MSG_COMMAND   0x11
+#define ATORCH_COMMAND_LEN   10
+enum AtorchCommand {
+  ATORCH_CMD_RESET_ENERGY = 0x01,   // the socket's energy counter
+  ATORCH_CMD_RESET_ALL    = 0x05,   // ... and its other counters
+  ATORCH_CMD_BACKLIGHT    = 0x21,   // backlight time [s]
+  ATORCH_CMD_PRICE        = 0x22,   // electricity price [c/kWh]
+  ATORCH_CMD_SETUP        = 0x31,   // the socket's buttons
+  ATORCH_CMD_ENTER        = 0x32,
+  ATORCH_CMD_PLUS         = 0x33,
+  ATORCH_CMD_MINUS        = 0x34,
+};
+//
+// Frames with a wrong checksum are counted in any case, and passed on unless
+// built with -DATORCH_REJECT_BAD_CHECKSUM=1. The checksum algorithm has not
+// been confirmed on frames from a real S1B: the sample frame at the top of
+// main.cpp does not match it (0x20 computed, 0xC1 sent), so rejecting could
+// drop every frame. Check the bad checksum count in the statistics before
+// turning it on.
+#ifndef ATORCH_REJECT_BAD_CHECKSUM
+#define ATORCH_REJECT_BAD_CHECKSUM 0
+#endif
+
+// Decode the measurement fields of a report frame into sample (ms and seq are left alone).
+// Returns false, leaving sample unchanged, if the frame is too short.
+bool atorchDecode(const uint8_t *frame, size_t length, Sample &sample);
+
+// Checksum of a report frame, as expected in byte 35: the sum of bytes 02-34, XOR 0x44
+uint8_t atorchChecksum(const uint8_t *frame);
+
+// Build a command frame (ATORCH_COMMAND_LEN bytes) for a socket of the given device type
+void atorchCommand(uint8_t *frame, uint8_t device, uint8_t command, uint32_t value);
+
+//////////////
+
+class AtorchAssembler {
+public:
+  // Called for every complete frame of a known type (ATORCH_FRAME_LEN bytes)
+  typedef void (*FrameHandler)(const uint8_t *frame, void *context);
+  //
+  // Feed the bytes of one notification. nowMs is used to expire stale fragments.
+  void feed(const uint8_t *data, size_t length, uint32_t nowMs, FrameHandler onFrame, void *context);
+  void reset() { pos = 0; }
+  //
+  uint32_t goodFrames() const { return nGood; }
+  uint32_t badChecksumFrames() const { return nBadChecksum; }
+  uint32_t unsupportedFrames() const { return nUnsupported; }  // wrong message or device type
+  uint32_t shortFrames() const { return nShort; }              // fragments that were never completed
+  uint32_t resyncs() const { return nResync; }                 // times bytes were skipped to find FF 55
+  uint32_t skippedBytes() const { return nSkipped; }
+
+private:
+  void frameComplete(FrameHandler onFrame, void *context);
+  void resync(size_t from);  // drop buf[0..from) and look for the next header in the rest
+  //
+  uint8_t buf[ATORCH_FRAME_LEN];
+  size_t pos = 0;            // bytes of the current frame received so far
+  uint32_t lastByteMs = 0;
+  bool skipping = false;     // currently discarding bytes outside a frame
+  uint32_t nGood = 0, nBadChecksum = 0, nUnsupported = 0, nShort = 0, nResync = 0, nSkipped = 0;
+};
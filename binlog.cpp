@@ -0,0 +1,167 @@
+/**
+  binlog.cpp - compact binary log format (see binlog.h)
+*/
+//
+#include <string.h>
+#include "binlog.h"
+
+static void put16(uint8_t *p, uint32_t v) { p[0] = v; p[1] = v >> 8; }
+static void put24(uint8_t *p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+static void put64(uint8_t *p, uint64_t v) { put32(p, (uint32_t)v); put32(p + 4, (uint32_t)(v >> 32)); }
+
+// Values wider than their field are clamped rather than wrapped
+static uint32_t clamp(uint32_t v, uint32_t max) { return v > max ? max : v; }
+
+// Zig-zag varint of a signed value
+static uint8_t *putVarint(uint8_t *p, int64_t v) {
+  uint64_t u = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  while (u >= 0x80) {
+    *p++ = (uint8_t)(u | 0x80);
+    u >>= 7;
+  }
+  *p++ = (uint8_t)u;
+  return p;
+}
+
+// A delta entry keeps to BINLOG_DELTA_MAX bytes if the interval and energy changes fit in this
+#define DELTA_LIMIT 0x7FFFFFFFLL
+
+//////////////
+
+uint32_t binlogCrc(const uint8_t *data, size_t len) {
+  // CRC-32 (IEEE 802.3, as zlib.crc32()), 4 bits at a time with a 16-entry table
+  //
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return crc ^ 0xFFFFFFFF;
+}
+
+//////////////
+
+void BinlogEncoder::header(uint8_t *block, const uint8_t address[6]) {
+  memset(block, 0, BINLOG_BLOCK_SIZE);
+  memcpy(block, "CYDL", 4);
+  put16(block + 4, BINLOG_VERSION);
+  put16(block + 6, BINLOG_BLOCK_SIZE);
+  put16(block + 8, BINLOG_BLOCK_HEADER);
+  put16(block + 10, BINLOG_RECORD_SIZE);
+  memcpy(block + 12, address, 6);
+  put32(block + BINLOG_BLOCK_SIZE - 4, binlogCrc(block, BINLOG_BLOCK_SIZE - 4));
+}
+
+//////////////
+
+bool BinlogEncoder::add(const Record &record) {
+  const Sample &s = record.sample;
+  if (sealed) {
+    sealed = false;
+    n = 0;
+  }
+  if (n == 0) {
+    // The first record sets the base of the block
+    memset(block, 0, BINLOG_BLOCK_SIZE);
+    baseUs = s.us - s.us % 1000;   // whole ms, so that base + offset gives the same second as the CSV log
+    baseMWs = record.mWs;
+    seq++;
+    blockEncoding = encoding;
+    put16(block, encoding == BINLOG_DELTA ? BINLOG_DELTA_MAGIC : BINLOG_BLOCK_MAGIC);
+    put32(block + 4, seq);
+    put64(block + 8, (uint64_t)baseUs);
+    put64(block + 16, baseMWs);
+    put32(block + 24, s.kwh100);
+  }
+  bool added = (blockEncoding == BINLOG_DELTA) ? addDelta(record) : addFixed(record);
+  if (added) {
+    n++;
+    totalRecords++;
+  }
+  return added;
+}
+
+//////////////
+
+bool BinlogEncoder::addFixed(const Record &record) {
+  const Sample &s = record.sample;
+  if (n >= BINLOG_RECORDS) return false;
+  int64_t offsetMs = (s.us - baseUs) / 1000;
+  uint64_t deltaMWs = record.mWs - baseMWs;
+  if (offsetMs < 0 || offsetMs > BINLOG_MAX_OFFSET_MS || deltaMWs > 0xFFFFFFFFULL) return false;
+  //
+  uint8_t *p = block + BINLOG_BLOCK_HEADER + n * BINLOG_RECORD_SIZE;
+  put16(p, (uint32_t)offsetMs);
+  put16(p + 2, clamp(s.volts10, 0xFFFF));
+  put24(p + 4, clamp(s.milliamps, 0xFFFFFF));
+  put24(p + 7, clamp(s.watts10, 0xFFFFFF));
+  put16(p + 10, s.hz10);
+  put16(p + 12, s.pf1000);
+  put32(p + 14, (uint32_t)deltaMWs);
+  return true;
+}
+
+//////////////
+
+bool BinlogEncoder::addDelta(const Record &record) {
+  // Bounded work for every record: 7 varints, written directly into the block
+  //
+  const Sample &s = record.sample;
+  uint32_t v[5] = { clamp(s.volts10, 0xFFFF), clamp(s.milliamps, 0xFFFFFF), clamp(s.watts10, 0xFFFFFF), s.hz10, s.pf1000 };
+  if (n == 0) {
+    uint8_t *p = block + BINLOG_BLOCK_HEADER;
+    put16(p, v[0]);
+    put24(p + 2, v[1]);
+    put24(p + 5, v[2]);
+    put16(p + 8, v[3]);
+    put16(p + 10, v[4]);
+    used = BINLOG_BLOCK_HEADER + BINLOG_KEYFRAME;
+    lastMs = 0;
+    lastDtMs = 1000;
+    lastMWs = record.mWs;
+    lastDMWs = 0;
+    memcpy(last, v, sizeof(last));
+    return true;
+  }
+  if (used + BINLOG_DELTA_MAX > BINLOG_BLOCK_SIZE - 4) return false;
+  int64_t ms = (s.us - baseUs) / 1000;
+  int64_t ddt = (ms - lastMs) - (int64_t)lastDtMs;
+  int64_t ddMWs = (int64_t)(record.mWs - lastMWs) - (int64_t)lastDMWs;
+  if (ms < lastMs || ms > 0xFFFFFFFFLL || ddt > DELTA_LIMIT || ddt < -DELTA_LIMIT ||
+      ddMWs > DELTA_LIMIT || ddMWs < -DELTA_LIMIT) return false;
+  //
+  uint8_t *p = block + used;
+  p = putVarint(p, ddt);
+  for (int i = 0; i < 5; i++) p = putVarint(p, (int64_t)v[i] - (int64_t)last[i]);
+  p = putVarint(p, ddMWs);
+  used = p - block;
+  lastDtMs = (uint32_t)(ms - lastMs);
+  lastMs = (uint32_t)ms;
+  lastDMWs = record.mWs - lastMWs;
+  lastMWs = record.mWs;
+  memcpy(last, v, sizeof(last));
+  return true;
+}
+
+//////////////
+
+const uint8_t *BinlogEncoder::seal() {
+  put16(block + 2, n);
+  put32(block + BINLOG_BLOCK_SIZE - 4, binlogCrc(block, BINLOG_BLOCK_SIZE - 4));
+  sealed = true;
+  return block;
+}
+
+//////////////
+
+uint32_t BinlogEncoder::bytesPerKiloRecord() const {
+  uint32_t records = totalRecords - count();
+  if (records == 0) return 0;
+  return (uint32_t)((uint64_t)blocks() * BINLOG_BLOCK_SIZE * 1000 / records);
+}
@@ -0,0 +1,111 @@
+/**
+  binlog.h - compact binary log format
+
+  An alternative to the CSV log: the scaled integers the socket sends, packed
+  into fixed-size records (BINLOG_FIXED, about 20 bytes per sample instead of
+  about 55), or as deltas from the previous sample (BINLOG_DELTA, about 7-9
+  bytes per sample for a steady load).
+  The file is a sequence of BINLOG_BLOCK_SIZE blocks (one SD sector each):
+
+    block 0      file header: "CYDL", format version, sizes, socket address
+    block 1...   data blocks: a block header and the records
+
+  Every block ends with the CRC-32 (IEEE 802.3) of the rest of the block, so a
+  block torn by a power cut is detected and skipped by the reader. All values
+  are little-endian.
+
+  Data block header (BINLOG_BLOCK_HEADER bytes):
+    0  u16  BINLOG_BLOCK_MAGIC
+    2  u16  number of records in the block
+    4  u32  block number (1, 2, ...)
+    8  u64  time of the first record [us since boot, truncated to ms]
+   16  u64  energy total before the first record [mWs]
+   24  u32  socket energy counter at the first record [kWh*100]
+
+  BINLOG_FIXED block (magic BINLOG_BLOCK_MAGIC), up to BINLOG_RECORDS records of
+  BINLOG_RECORD_SIZE bytes each:
+    0  u16  time since the first record of the block [ms, truncated]
+    2  u16  voltage [V*10]
+    4  u24  current [mA]
+    7  u24  power [W*10]
+   10  u16  frequency [Hz*10]
+   12  u16  power factor*1000
+   14  u32  energy total, relative to the block header [mWs]
+
+  BINLOG_DELTA block (magic BINLOG_DELTA_MAGIC). The first record of the block
+  is a keyframe, so every block decodes on its own:
+   28  u16  voltage, u24 current, u24 power, u16 frequency, u16 power factor
+   40  one entry for each further record, 7 zig-zag varints (LEB128, 7 bits
+       a byte, low first; zig-zag maps 0, -1, 1, -2... to 0, 1, 2, 3...):
+         the change of the interval to the previous record [ms]
+         the change of voltage, current, power, frequency, power factor
+         the change of the energy increment to the previous record [mWs]
+       The interval before the first delta entry is predicted as 1000 ms,
+       the energy increment as 0. An entry takes BINLOG_DELTA_MAX bytes at most.
+
+  tools/binlog2csv.py converts a file back to the CSV columns.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include <stddef.h>
+#include "sample.h"
+//
+#define BINLOG_VERSION       1
+#define BINLOG_BLOCK_SIZE    512      // = LOG_BLOCK_SIZE
+#define BINLOG_BLOCK_HEADER  28
+#define BINLOG_RECORD_SIZE   18
+#define BINLOG_RECORDS       ((BINLOG_BLOCK_SIZE - BINLOG_BLOCK_HEADER - 4) / BINLOG_RECORD_SIZE)  // 26 per block
+#define BINLOG_BLOCK_MAGIC   0xB10C
+#define BINLOG_MAX_OFFSET_MS 65535    // longest time a fixed block can span [ms]
+#define BINLOG_DELTA_MAGIC   0xB10D
+#define BINLOG_KEYFRAME      12       // size of the keyframe of a delta block
+#define BINLOG_DELTA_MAX     27       // longest delta entry [bytes]
+//
+#define BINLOG_FIXED  0     // encodings
+#define BINLOG_DELTA  1
+
+uint32_t binlogCrc(const uint8_t *data, size_t len);
+
+class BinlogEncoder {
+public:
+  // Fill block (BINLOG_BLOCK_SIZE bytes) with the file header
+  static void header(uint8_t *block, const uint8_t address[6]);
+  //
+  void setEncoding(uint8_t e) { encoding = e; }   // BINLOG_FIXED or BINLOG_DELTA, from the next block on
+  //
+  // Add a record to the current block. Returns false when it does not fit
+  // (block full, or too long after the first record): seal() and add it again.
+  bool add(const Record &record);
+  // Finish the current block and return it; the next add() starts a new block
+  const uint8_t *seal();
+  //
+  uint16_t count() const { return sealed ? 0 : n; }   // records in the current block
+  uint16_t sealedCount() const { return n; }           // records in the block seal() returned
+  bool empty() const { return count() == 0; }
+  //
+  // Statistics of the sealed blocks
+  uint32_t blocks() const { return seq - (sealed ? 0 : (n ? 1 : 0)); }
+  uint32_t records() const { return totalRecords; }
+  uint32_t bytesPerKiloRecord() const;   // space used in the blocks [bytes per 1000 records]
+
+private:
+  bool addFixed(const Record &record);
+  bool addDelta(const Record &record);
+  //
+  uint8_t encoding = BINLOG_FIXED;
+  uint8_t blockEncoding = BINLOG_FIXED;   // of the current block
+  uint8_t block[BINLOG_BLOCK_SIZE];
+  uint16_t n = 0;
+  bool sealed = false;
+  uint32_t seq = 0;       // number of the current block
+  int64_t baseUs = 0;
+  uint64_t baseMWs = 0;
+  uint32_t totalRecords = 0;
+  // delta encoding: the end of the entries, and the last record written
+  size_t used = 0;
+  uint32_t lastMs = 0, lastDtMs = 0;
+  uint32_t last[5];     // volts10, milliamps, watts10, hz10, pf1000, as written
+  uint64_t lastMWs = 0, lastDMWs = 0;
+};
@@ -0,0 +1,75 @@
+/**
+  capture.cpp - text format of captured frames, and a synthetic frame source (see capture.h)
+*/
+//
+#include <string.h>
+#include "capture.h"
+#include "format.h"
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+//////////////
+
+size_t formatCapture(char *out, const uint8_t *frame, int64_t us, uint8_t device) {
+  char *p = out;
+  for (int i = 0; i < ATORCH_FRAME_LEN; i++) {
+    *p++ = hexDigits[frame[i] >> 4];
+    *p++ = hexDigits[frame[i] & 0x0F];
+  }
+  *p++ = ',';
+  p = fmtFixed64(p, (uint64_t)us, 0);  *p++ = ',';
+  p = fmtFixed(p, device, 0);
+  p = fmtStr(p, "\r\n");
+  return p - out;
+}
+
+//////////////
+
+bool parseCapture(const char *line, uint8_t *frame, int64_t &us, uint8_t &device) {
+  const char *p = line;
+  for (int i = 0; i < ATORCH_FRAME_LEN; i++, p += 2) {
+    int hi = hexValue(p[0]), lo = hi < 0 ? -1 : hexValue(p[1]);
+    if (lo < 0) return false;
+    frame[i] = (uint8_t)(hi << 4 | lo);
+  }
+  if (*p++ != ',') return false;
+  uint64_t t = 0;
+  if (*p < '0' || *p > '9') return false;
+  while (*p >= '0' && *p <= '9') t = t * 10 + (*p++ - '0');
+  if (*p++ != ',') return false;
+  uint32_t d = 0;
+  if (*p < '0' || *p > '9') return false;
+  while (*p >= '0' && *p <= '9') d = d * 10 + (*p++ - '0');
+  us = (int64_t)t;
+  device = (uint8_t)d;
+  return true;
+}
+
+//////////////
+
+static void put24(uint8_t *p, uint32_t v) { p[0] = v >> 16; p[1] = v >> 8; p[2] = v; }
+
+void syntheticFrame(uint32_t n, uint8_t *frame) {
+  static const uint8_t sample[ATORCH_FRAME_LEN] = {   // the sample frame of main.cpp
+    0xFF, 0x55, 0x01, 0x01, 0x00, 0x09, 0xBC, 0x00, 0x00, 0x99, 0x00, 0x01, 0x24, 0x00, 0x00, 0x00,
+    0x11, 0x00, 0x00, 0x64, 0x01, 0xF4, 0x02, 0xFD, 0x00, 0x23, 0x00, 0x00, 0x0A, 0x0D, 0x3C, 0x00,
+    0x00, 0x00, 0x00, 0xC1
+  };
+  memcpy(frame, sample, ATORCH_FRAME_LEN);
+  uint32_t t = n % 60;
+  uint32_t watts10 = 292 + n % 7, milliamps = 153 + n % 5;     // standby, with a little noise
+  if (t < 20) {
+    watts10 = t == 0 ? 24000 : 12000 + 37 * (n % 11);          // [W*10], inrush at switch-on
+    milliamps = watts10 * 100 / 240;                            // [mA] at 240 V
+  }
+  put24(frame + 7, milliamps);
+  put24(frame + 10, watts10);
+  frame[35] = atorchChecksum(frame);
+}
@@ -0,0 +1,26 @@
+/**
+  capture.h - text format of captured frames, and a synthetic frame source
+
+  A capture file holds one verified report frame per line:
+
+    <72 hex digits of the frame>,<esp_timer time [us]>,<device table index>\r\n
+
+  so it can be read back by the replay mode, by tools/core_bench.cpp (which
+  only looks at the hex digits), or by eye.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include <stddef.h>
+#include "atorch.h"
+//
+#define CAPTURE_LINE_LEN  (2 * ATORCH_FRAME_LEN + 32)   // buffer size that holds any capture line
+
+// One capture line; out must hold CAPTURE_LINE_LEN bytes. Returns the length of the line.
+size_t formatCapture(char *out, const uint8_t *frame, int64_t us, uint8_t device);
+// Parse a capture line; false if it is not one (the arguments are then undefined)
+bool parseCapture(const char *line, uint8_t *frame, int64_t &us, uint8_t &device);
+// Frame n of a synthetic load: the sample frame of main.cpp, with the current and
+// power following a 60 s duty cycle (on for 20 s, with an inrush at switch-on), correctly signed
+void syntheticFrame(uint32_t n, uint8_t *frame);
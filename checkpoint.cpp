@@ -0,0 +1,117 @@
+/**
+  checkpoint.cpp - the energy totals, kept across resets (see checkpoint.h)
+*/
+//
+#include "checkpoint.h"
+#include "esp_timer.h"
+//
+#define CHECKPOINT_MAGIC  0x4B574831   // "KWH1"
+
+// In RTC slow memory, not initialized at boot. check is the complement of the total mixed with the
+// address, written after it, so a slot torn by a reset (or read while being written) does not verify.
+struct RtcSlot {
+  uint32_t magic;
+  uint8_t address[6];
+  uint64_t mWs;
+  uint64_t check;
+};
+static RTC_NOINIT_ATTR RtcSlot rtcSlots[CHECKPOINT_SLOTS];
+
+// In NVS, one key per slot
+struct NvsSlot {
+  uint8_t address[6];
+  uint64_t mWs;
+};
+
+static uint64_t addressKey(const uint8_t *a) {
+  uint64_t key = 0;
+  for (int i = 0; i < 6; i++) key = key << 8 | a[i];
+  return key;
+}
+
+//////////////
+
+static bool readRtc(int slot, const uint8_t *address, uint64_t &mWs) {
+  volatile RtcSlot &r = rtcSlots[slot];
+  uint64_t total = r.mWs;
+  if (r.magic != CHECKPOINT_MAGIC || r.check != ~(total ^ addressKey((const uint8_t *)r.address))) return false;
+  if (address && memcmp((const uint8_t *)r.address, address, 6) != 0) return false;
+  mWs = total;
+  return true;
+}
+
+//////////////
+
+uint64_t EnergyCheckpoint::restore(int slot, const uint8_t *address) {
+  uint64_t mWs = 0;
+  char key[4] = "e0";
+  key[1] = '0' + slot;
+  NvsSlot saved;
+  prefs.begin(CHECKPOINT_NAMESPACE, true);
+  bool inNvs = prefs.getBytes(key, &saved, sizeof(saved)) == sizeof(saved) && memcmp(saved.address, address, 6) == 0;
+  prefs.end();
+  //
+  if (readRtc(slot, address, mWs)) {
+    restoredFrom[slot] = CHECKPOINT_RTC;
+  } else if (inNvs) {
+    mWs = saved.mWs;
+    restoredFrom[slot] = CHECKPOINT_NVS;
+  } else {
+    restoredFrom[slot] = CHECKPOINT_NONE;
+  }
+  savedMWs[slot] = inNvs ? saved.mWs : 0;
+  savedMs[slot] = millis();
+  return mWs;
+}
+
+//////////////
+
+void EnergyCheckpoint::update(int slot, const uint8_t *address, uint64_t mWs) {
+  volatile RtcSlot &r = rtcSlots[slot];
+  if (r.magic != CHECKPOINT_MAGIC || memcmp((const uint8_t *)r.address, address, 6) != 0) {
+    r.magic = 0;
+    memcpy((uint8_t *)r.address, address, 6);
+    r.magic = CHECKPOINT_MAGIC;
+  }
+  r.mWs = mWs;
+  r.check = ~(mWs ^ addressKey(address));
+}
+
+//////////////
+
+void EnergyCheckpoint::poll() {
+  // Read back the RTC copies (the ingest task writes them) and save the ones that are due
+  //
+  uint32_t now = millis();
+  for (int i = 0; i < CHECKPOINT_SLOTS; i++) {
+    uint64_t mWs;
+    if (!readRtc(i, nullptr, mWs) || mWs == savedMWs[i]) continue;
+    uint32_t elapsed = now - savedMs[i];
+    if (elapsed < CHECKPOINT_MIN_MS) continue;
+    if (mWs - savedMWs[i] < CHECKPOINT_MWS && elapsed < CHECKPOINT_IDLE_MS) continue;
+    //
+    NvsSlot saved;
+    memcpy(saved.address, (const uint8_t *)rtcSlots[i].address, 6);
+    saved.mWs = mWs;
+    char key[4] = "e0";
+    key[1] = '0' + i;
+    int64_t startUs = esp_timer_get_time();
+    prefs.begin(CHECKPOINT_NAMESPACE, false);
+    prefs.putBytes(key, &saved, sizeof(saved));
+    prefs.end();
+    uint32_t us = (uint32_t)(esp_timer_get_time() - startUs);
+    if (us > maxWriteUs) maxWriteUs = us;
+    writes++;
+    savedMWs[i] = mWs;
+    savedMs[i] = now;
+  }
+}
+
+//////////////
+
+void EnergyCheckpoint::printStats(Print &out) const {
+  static const char *names[] = {"none", "RTC", "NVS"};
+  out.printf("Energy checkpoints: %lu NVS writes (max %lu us), restored from", (unsigned long)writes, (unsigned long)maxWriteUs);
+  for (int i = 0; i < CHECKPOINT_SLOTS; i++) out.printf(" %s", names[restoredFrom[i]]);
+  out.println();
+}
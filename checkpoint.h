@@ -0,0 +1,47 @@
+/**
+  checkpoint.h - the energy totals, kept across resets
+
+  The total of every socket is copied to RTC slow memory with each sample
+  (a few stores, no flash access). That copy survives software resets,
+  panics, watchdog resets and most brown-outs, but not a power cut, so the
+  total is also saved to NVS: once it has grown by CHECKPOINT_MWS, or after
+  CHECKPOINT_IDLE_MS with any change, and never more often than every
+  CHECKPOINT_MIN_MS per socket (at most 288 flash writes a day each). A power
+  cut loses the energy since the last NVS write.
+
+  restore() takes the RTC copy if it is intact and belongs to the same socket
+  (address), else the NVS copy, else 0.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include <Preferences.h>
+//
+#define CHECKPOINT_SLOTS      4           // sockets (>= MAX_SOCKETS)
+#define CHECKPOINT_NAMESPACE  "energy"    // NVS namespace
+#define CHECKPOINT_MWS        3600000ULL  // save to NVS once the total has grown by 1 Wh [mWs]
+#define CHECKPOINT_MIN_MS     300000      // ... but not more often than every 5 minutes [ms]
+#define CHECKPOINT_IDLE_MS    1800000     // ... and after 30 minutes with any change [ms]
+
+enum CheckpointSource { CHECKPOINT_NONE, CHECKPOINT_RTC, CHECKPOINT_NVS };
+
+class EnergyCheckpoint {
+public:
+  // setup(), before the first sample: the total to continue from [mWs]
+  uint64_t restore(int slot, const uint8_t *address);
+  CheckpointSource source(int slot) const { return restoredFrom[slot]; }
+  //
+  void update(int slot, const uint8_t *address, uint64_t mWs);   // ingest task, every sample
+  void poll();                                                    // loop(): the NVS writes that are due
+  //
+  uint32_t nvsWrites() const { return writes; }
+  void printStats(Print &out) const;
+
+private:
+  Preferences prefs;
+  CheckpointSource restoredFrom[CHECKPOINT_SLOTS] = {};
+  uint64_t savedMWs[CHECKPOINT_SLOTS] = {};   // in NVS
+  uint32_t savedMs[CHECKPOINT_SLOTS] = {};    // millis() of the NVS write
+  uint32_t writes = 0, maxWriteUs = 0;
+};
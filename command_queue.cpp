@@ -0,0 +1,82 @@
+/**
+  command_queue.cpp - the commands waiting to be written to one socket (see command_queue.h)
+*/
+//
+#include "command_queue.h"
+#include "esp_timer.h"
+#include "perf.h"
+
+//////////////
+
+bool AtorchCommandQueue::post(uint8_t command, uint32_t value, uint32_t nowMs) {
+  posted++;
+  for (uint8_t i = 0; i < count; i++) {
+    if (slots[i].command == command) {
+      slots[i].value = value;   // keeps its place, and the time it was first posted
+      coalesced++;
+      return true;
+    }
+  }
+  if (count == COMMAND_SLOTS) {
+    full++;
+    return false;
+  }
+  slots[count].command = command;
+  slots[count].value = value;
+  slots[count].postedMs = nowMs;
+  count++;
+  return true;
+}
+
+//////////////
+
+void AtorchCommandQueue::remove(uint8_t slot) {
+  for (uint8_t i = slot; i + 1 < count; i++) slots[i] = slots[i + 1];
+  count--;
+}
+
+//////////////
+
+uint32_t AtorchCommandQueue::poll(BLERemoteCharacteristic *characteristic, bool connected, uint8_t device, uint32_t nowMs) {
+  while (count > 0 && nowMs - slots[0].postedMs >= COMMAND_TTL_MS) {
+    expired++;
+    remove(0);
+  }
+  if (count == 0) return COMMAND_IDLE_MS;
+  if (!connected || characteristic == nullptr) return COMMAND_TTL_MS - (nowMs - slots[0].postedMs);   // to expire it
+  if (written && nowMs - lastWriteMs < COMMAND_GAP_MS) return COMMAND_GAP_MS - (nowMs - lastWriteMs);
+  //
+  bool noResponse = characteristic->canWriteNoResponse();
+  if (!noResponse && !characteristic->canWrite()) {
+    unwritable += count;
+    count = 0;
+    return COMMAND_IDLE_MS;
+  }
+  uint8_t frame[ATORCH_COMMAND_LEN];
+  atorchCommand(frame, device, slots[0].command, slots[0].value);
+  int64_t startUs = esp_timer_get_time();
+  {
+    PERF_SCOPE(PERF_BLE_WRITE);
+    characteristic->writeValue(frame, sizeof(frame), !noResponse);
+  }
+  uint32_t us = (uint32_t)(esp_timer_get_time() - startUs);
+  sent++;
+  totalWriteUs += us;
+  if (us > maxWriteUs) maxWriteUs = us;
+  uint32_t waitedMs = nowMs - slots[0].postedMs;
+  if (waitedMs > maxWaitMs) maxWaitMs = waitedMs;
+  remove(0);
+  lastWriteMs = nowMs;
+  written = true;
+  return count ? COMMAND_GAP_MS : COMMAND_IDLE_MS;
+}
+
+//////////////
+
+void AtorchCommandQueue::printStats(Print &out) const {
+  out.printf("Commands: %lu posted (%lu coalesced), %lu sent, write avg %lu us, max %lu us, waited max %lu ms; "
+             "failed: %lu queue full, %lu expired, %lu not writable\r\n",
+             (unsigned long)posted, (unsigned long)coalesced, (unsigned long)sent,
+             (unsigned long)(sent ? totalWriteUs / sent : 0), (unsigned long)maxWriteUs, (unsigned long)maxWaitMs,
+             (unsigned long)full, (unsigned long)expired, (unsigned long)unwritable);
+}
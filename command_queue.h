@@ -0,0 +1,59 @@
+/**
+  command_queue.h - the commands waiting to be written to one socket
+
+  post() only queues a command (see AtorchCommand in atorch.h); loop() writes
+  them later with poll(), one at a time and at most one every COMMAND_GAP_MS,
+  so that the writes never crowd out the notifications of the socket. A
+  command posted while another of the same kind is still waiting replaces
+  it: the socket only gets the latest value. A command that could not be
+  written within COMMAND_TTL_MS (the socket was not connected) is dropped.
+
+  The frames go out as writes without response when the characteristic
+  allows it, which return as soon as Bluedroid has queued them; otherwise
+  with response, and then loop() waits for the socket's acknowledgement.
+  The time of every write is measured. Bluedroid does not report the outcome
+  of a write to the Arduino API, so the failures counted are the commands
+  that could not be sent: the queue was full, they expired, or the
+  characteristic cannot be written.
+
+  Used by loop() only.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "BLEDevice.h"
+#include "atorch.h"
+//
+#define COMMAND_SLOTS   4       // commands of different kinds waiting
+#define COMMAND_GAP_MS  250     // at most one write to the socket this often [ms]
+#define COMMAND_TTL_MS  30000   // a command not written within this time is dropped [ms]
+#define COMMAND_IDLE_MS 0xFFFFFFFF   // poll(): nothing waiting
+
+class AtorchCommandQueue {
+public:
+  bool post(uint8_t command, uint32_t value, uint32_t nowMs);   // false if the queue is full
+  // Write the oldest command if the socket is connected and the gap is over.
+  // Returns the time until poll() has work again [ms], or COMMAND_IDLE_MS.
+  uint32_t poll(BLERemoteCharacteristic *characteristic, bool connected, uint8_t device, uint32_t nowMs);
+  bool empty() const { return count == 0; }
+  //
+  void printStats(Print &out) const;
+
+private:
+  struct Pending {
+    uint8_t command;
+    uint32_t value;
+    uint32_t postedMs;
+  };
+  void remove(uint8_t slot);
+  //
+  Pending slots[COMMAND_SLOTS];   // in the order they were first posted
+  uint8_t count = 0;
+  uint32_t lastWriteMs = 0;
+  bool written = false;           // lastWriteMs is valid
+  //
+  uint32_t posted = 0, coalesced = 0, sent = 0, full = 0, expired = 0, unwritable = 0;
+  uint32_t maxWriteUs = 0, maxWaitMs = 0;
+  uint64_t totalWriteUs = 0;
+};
@@ -0,0 +1,173 @@
+/**
+  config.cpp - the settings of one site, read from the SD card at boot (see config.h)
+*/
+//
+#include "config.h"
+#include "esp_timer.h"
+//
+static const char *const channelNames[] = { "V", "A", "W", "PF", "kWh", "Hz" };   // in the order of the CSV_* bits
+#define CHANNEL_COUNT (sizeof(channelNames) / sizeof(channelNames[0]))
+
+//////////////
+
+static const char *trim(const char *s, const char *&end) {
+  while (s < end && isspace((unsigned char)*s)) s++;
+  while (end > s && isspace((unsigned char)end[-1])) end--;
+  return s;
+}
+
+//////////////
+
+static bool number(const char *s, const char *end, uint32_t lo, uint32_t hi, uint32_t &value) {
+  // A whole number from lo to hi, and nothing else
+  uint32_t v;
+  if (end - s > 9 || memchr(s, '.', end - s)) return false;
+  if (parseFixed(s, end, 0, v) != end || v < lo || v > hi) return false;
+  value = v;
+  return true;
+}
+
+//////////////
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+//////////////
+
+bool Config::set(const char *key, const char *value, const char *end) {
+  uint32_t v;
+  size_t len = end - value;
+  if (strcmp(key, "log_path") == 0) {
+    if (len < 2 || len >= CONFIG_PATH_LEN || *value != '/' || memchr(value, ' ', len) || memchr(value + 1, '/', len - 1)) return false;
+    memcpy(logPath, value, len);
+    logPath[len] = '\0';
+  } else if (strcmp(key, "sd_hz") == 0) {
+    if (!number(value, end, 400000, 40000000, v)) return false;
+    sdHz = v;
+  } else if (strcmp(key, "flush_bytes") == 0) {
+    if (!number(value, end, LOG_BLOCK_SIZE, LOG_FLUSH_BYTES, v)) return false;
+    flushBytes = v;
+  } else if (strcmp(key, "flush_ms") == 0) {
+    if (!number(value, end, 1000, 600000, v)) return false;
+    flushMs = v;
+  } else if (strcmp(key, "decimation") == 0) {
+    if (!number(value, end, 1, 3600, v)) return false;
+    decimation = v;
+  } else if (strcmp(key, "channels") == 0) {
+    // Names separated by commas
+    uint8_t mask = 0;
+    for (const char *p = value; p < end; ) {
+      const char *comma = (const char *)memchr(p, ',', end - p), *to = comma ? comma : end;
+      const char *name = trim(p, to);
+      size_t i = 0;
+      while (i < CHANNEL_COUNT && !(strlen(channelNames[i]) == (size_t)(to - name) && strncasecmp(name, channelNames[i], to - name) == 0)) i++;
+      if (i == CHANNEL_COUNT) return false;
+      mask |= 1 << i;
+      p = comma ? comma + 1 : end;
+    }
+    if (mask == 0) return false;
+    channels = mask;
+  } else if (strcmp(key, "segment_s") == 0) {
+    if (!number(value, end, 60, 31 * 86400, v)) return false;
+    segmentS = v;
+  } else if (strcmp(key, "segment_bytes") == 0) {
+    if (!number(value, end, 65536, 1UL << 30, v)) return false;
+    segmentBytes = v;
+  } else if (strcmp(key, "scan_interval_ms") == 0) {
+    if (!number(value, end, 10, 10240, v)) return false;
+    scanIntervalMs = v;
+  } else if (strcmp(key, "scan_window_ms") == 0) {
+    if (!number(value, end, 10, 10240, v)) return false;
+    scanWindowMs = v;
+  } else if (strcmp(key, "socket") == 0) {
+    if (len == 3 && strncasecmp(value, "any", 3) == 0) {
+      anySocket = true;
+      return true;
+    }
+    uint8_t address[6];
+    if (len != 17) return false;
+    for (int i = 0; i < 6; i++) {
+      int hi = hexDigit(value[3*i]), lo = hexDigit(value[3*i + 1]);
+      if (hi < 0 || lo < 0 || (i < 5 && value[3*i + 2] != ':')) return false;
+      address[i] = hi << 4 | lo;
+    }
+    memcpy(socket, address, 6);
+    anySocket = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+//////////////
+
+bool Config::load(fs::FS &fs, const char *path, Print &out) {
+  File file = fs.open(path, FILE_READ);
+  if (!file) {
+    out.printf("Config: no %s, using the defaults\r\n", path);
+    return false;
+  }
+  int64_t startUs = esp_timer_get_time();
+  char line[CONFIG_LINE_LEN], key[24];
+  uint32_t lineNo = 0, settings = 0, errors = 0;
+  while (file.available()) {
+    size_t n = file.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[n] = '\0';
+    lineNo++;
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+    const char *end = line + strlen(line), *s = trim(line, end);
+    if (s == end) continue;
+    const char *equals = (const char *)memchr(s, '=', end - s), *keyEnd = equals;
+    bool valid = false;
+    if (equals) {
+      s = trim(s, keyEnd);
+      const char *value = trim(equals + 1, end);
+      if (keyEnd - s > 0 && (size_t)(keyEnd - s) < sizeof(key)) {
+        memcpy(key, s, keyEnd - s);
+        key[keyEnd - s] = '\0';
+        valid = set(key, value, end);
+      }
+    }
+    if (valid) {
+      settings++;
+    } else {
+      errors++;
+      out.printf("Config: line %lu not valid, ignored\r\n", (unsigned long)lineNo);
+    }
+  }
+  file.close();
+  if (scanWindowMs > scanIntervalMs) {
+    out.println("Config: scan_window_ms is longer than scan_interval_ms, using the default scan");
+    scanIntervalMs = CONFIG_SCAN_INTERVAL_MS;
+    scanWindowMs = CONFIG_SCAN_WINDOW_MS;
+    errors++;
+  }
+  out.printf("Config: %s, %lu settings, %lu errors, read in %lu us\r\n", path, (unsigned long)settings,
+             (unsigned long)errors, (unsigned long)(esp_timer_get_time() - startUs));
+  return true;
+}
+
+//////////////
+
+void Config::print(Print &out) const {
+  out.printf("Config: log_path %s, sd_hz %lu, flush %lu bytes or %lu ms, decimation %u, channels",
+             logPath, (unsigned long)sdHz, (unsigned long)flushBytes, (unsigned long)flushMs, (unsigned)decimation);
+  const char *separator = " ";
+  for (size_t i = 0; i < CHANNEL_COUNT; i++) {
+    if (!(channels & (1 << i))) continue;
+    out.printf("%s%s", separator, channelNames[i]);
+    separator = ",";
+  }
+  out.printf(", segment %lu s or %lu bytes, scan %u/%u ms, socket ", (unsigned long)segmentS,
+             (unsigned long)segmentBytes, (unsigned)scanIntervalMs, (unsigned)scanWindowMs);
+  if (anySocket) {
+    out.println("any");
+  } else {
+    out.printf("%02X:%02X:%02X:%02X:%02X:%02X\r\n", socket[0], socket[1], socket[2], socket[3], socket[4], socket[5]);
+  }
+}
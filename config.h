@@ -0,0 +1,62 @@
+/**
+  config.h - the settings of one site, read from the SD card at boot
+
+  CONFIG_FILE holds "key = value" lines; '#' starts a comment. setup() reads
+  it once into a Config, checking every value: a key it does not know or a
+  value out of range is reported and leaves the default (that of the build)
+  in place, and without the file every setting is the default. The file is
+  never read again, and the rest of the program sees the settings only as a
+  const Config, so they cost nothing per sample.
+
+    log_path         = /PowerMeterLog   prefix of the log files (up to CONFIG_PATH_LEN - 1 characters)
+    sd_hz            = 4000000          SPI clock of the card [Hz]
+    flush_bytes      = 4096             write the logs when this much is pending (512 to LOG_FLUSH_BYTES)
+    flush_ms         = 30000            ... or when the oldest record has waited this long [ms]
+    decimation       = 1                log every Nth frame (the energy and the rollups use them all)
+    channels         = V,A,W,PF,kWh,Hz  the columns of the CSV log with values; the others stay empty
+    segment_s        = 86400            start a new segment of the logs this often [s]
+    segment_bytes    = 8388608          ... or when a file reaches this size [bytes]
+    scan_interval_ms = 1349             BLE scan interval and window [ms]
+    scan_window_ms   = 449
+    socket           = any              or the address of the only socket to connect to, "A4:C1:38:12:34:56"
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "FS.h"
+#include "format.h"
+#include "sd_logger.h"
+//
+#define CONFIG_FILE       "/config.txt"
+#define CONFIG_LINE_LEN   96      // longest line
+#define CONFIG_PATH_LEN   25      // log_path, with room for the suffixes within LOG_PATH_LEN
+// The defaults
+#ifndef LOG_SEGMENT_S
+#define LOG_SEGMENT_S     86400   // a new segment of the logs every day (at midnight UTC once the clock is set) [s]
+#endif
+#ifndef LOG_SEGMENT_BYTES
+#define LOG_SEGMENT_BYTES (8UL << 20)   // ... or when a file reaches this size [bytes]
+#endif
+#define CONFIG_SD_HZ      4000000       // also the clock the card is mounted with to read CONFIG_FILE
+#define CONFIG_SCAN_INTERVAL_MS 1349
+#define CONFIG_SCAN_WINDOW_MS   449
+
+struct Config {
+  char logPath[CONFIG_PATH_LEN] = "/PowerMeterLog";
+  uint32_t sdHz = CONFIG_SD_HZ;
+  uint32_t flushBytes = LOG_FLUSH_BYTES, flushMs = LOG_FLUSH_MS;
+  uint16_t decimation = 1;
+  uint8_t channels = CSV_ALL;
+  uint32_t segmentS = LOG_SEGMENT_S, segmentBytes = LOG_SEGMENT_BYTES;
+  uint16_t scanIntervalMs = CONFIG_SCAN_INTERVAL_MS, scanWindowMs = CONFIG_SCAN_WINDOW_MS;
+  bool anySocket = true;
+  uint8_t socket[6] = {};
+  //
+  // Read the file over the defaults, reporting every line it rejects, and how long it took; false if there is no file
+  bool load(fs::FS &fs, const char *path, Print &out);
+  void print(Print &out) const;   // the settings in effect
+
+private:
+  bool set(const char *key, const char *value, const char *end);   // false if the key or value is not valid
+};
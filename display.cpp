@@ -0,0 +1,102 @@
+/**
+  display.cpp - energy dashboard on the CYD's TFT (see display.h)
+*/
+//
+#include "display.h"
+//
+// Label and row of every field, in DashField order
+static const struct {
+  const char *label;
+  int16_t y;
+} layout[FIELD_COUNT] = {
+  { "Run Time:",   50 },
+  { "Voltage:",    76 },
+  { "Current:",   102 },
+  { "Power:",     128 },
+  { "PF:",        154 },
+  { "Energy:",    180 },
+  { "Frequency:", 206 },
+};
+
+//////////////
+
+void Dashboard::begin(uint16_t fg, uint16_t bg) {
+  fgColor = fg;
+  bgColor = bg;
+  tft.setTextColor(fgColor, bgColor);
+  int16_t h = tft.fontHeight(DASH_FONT);
+  for (int i = 0; i < FIELD_COUNT; i++) {
+    tft.drawString(layout[i].label, 0, layout[i].y, DASH_FONT);
+    //
+    Field &f = fields[i];
+    f.x = DASH_VALUE_X;
+    f.y = layout[i].y;
+    f.w = tft.width() - DASH_VALUE_X;
+    f.h = h;
+    f.text[0] = '\0';
+    f.dirty = false;
+  }
+  // "Frequency:" is too wide for the label column, so its value follows the label
+  Field &f = fields[FIELD_FREQUENCY];
+  f.x = tft.textWidth("Frequency: ", DASH_FONT);
+  f.w = tft.width() - f.x;
+}
+
+//////////////
+
+void Dashboard::setField(DashField field, const char *text) {
+  Field &f = fields[field];
+  if (strncmp(f.text, text, DASH_FIELD_LEN) == 0) {
+    skipped++;
+    return;
+  }
+  strncpy(f.text, text, DASH_FIELD_LEN - 1);
+  f.text[DASH_FIELD_LEN - 1] = '\0';
+  f.dirty = true;
+}
+
+//////////////
+
+void Dashboard::invalidate() {
+  for (int i = 0; i < FIELD_COUNT; i++) fields[i].dirty = true;
+}
+
+//////////////
+
+void Dashboard::render() {
+  uint32_t start = micros();
+  bool any = false;
+  //
+  for (int i = 0; i < FIELD_COUNT; i++) {
+    Field &f = fields[i];
+    if (!f.dirty) continue;
+    if (!any) {
+      tft.startWrite();   // keep the SPI bus for all the fields of this frame
+      tft.setTextColor(fgColor, bgColor);
+      any = true;
+    }
+    // Draw inside the field's box only; the padding blanks what is left of a longer old value
+    tft.setViewport(f.x, f.y, f.w, f.h);
+    tft.setTextPadding(f.w);
+    tft.drawString(f.text, 0, 0, DASH_FONT);
+    tft.resetViewport();
+    f.dirty = false;
+    drawn++;
+  }
+  if (!any) return;
+  tft.setTextPadding(0);
+  tft.endWrite();
+  //
+  lastUs = micros() - start;
+  if (lastUs > maxUs) maxUs = lastUs;
+  totalUs += lastUs;
+  frames++;
+}
+
+//////////////
+
+void Dashboard::printStats(Print &out) const {
+  out.printf("Display: %lu frames, render last %lu us, avg %lu us, max %lu us, %lu fields drawn, %lu unchanged\r\n",
+             (unsigned long)frames, (unsigned long)lastUs, (unsigned long)avgRenderUs(), (unsigned long)maxUs,
+             (unsigned long)drawn, (unsigned long)skipped);
+}
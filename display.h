@@ -0,0 +1,58 @@
+/**
+  display.h - energy dashboard on the CYD's TFT
+
+  The labels are drawn once by begin(). Each value field remembers the text it
+  shows; setField() only marks a field dirty when its text changes, and render()
+  repaints the dirty fields alone, each clipped to its own box.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+//
+#define DASH_FONT        4     // font of the labels and values
+#define DASH_VALUE_X     120   // left edge of the value column
+#define DASH_FIELD_LEN   24    // longest value text, including the terminating zero
+
+enum DashField {
+  FIELD_RUNTIME,
+  FIELD_VOLTAGE,
+  FIELD_CURRENT,
+  FIELD_POWER,
+  FIELD_PF,
+  FIELD_ENERGY,
+  FIELD_FREQUENCY,
+  FIELD_COUNT
+};
+
+class Dashboard {
+public:
+  explicit Dashboard(TFT_eSPI &display) : tft(display) {}
+  //
+  void begin(uint16_t fg, uint16_t bg);            // draw the static labels
+  void setField(DashField field, const char *text);
+  void render();                                   // repaint the fields whose text changed
+  void invalidate();                               // repaint every field on the next render()
+  //
+  // SPI time spent in render() [us]
+  uint32_t lastRenderUs() const { return lastUs; }
+  uint32_t maxRenderUs() const { return maxUs; }
+  uint32_t avgRenderUs() const { return frames ? (uint32_t)(totalUs / frames) : 0; }
+  uint32_t fieldsDrawn() const { return drawn; }
+  uint32_t fieldsSkipped() const { return skipped; }
+  void printStats(Print &out) const;
+
+private:
+  struct Field {
+    int16_t x, y, w, h;         // box of the value text
+    char text[DASH_FIELD_LEN];  // text currently shown (or to be shown, if dirty)
+    bool dirty;
+  };
+  TFT_eSPI &tft;
+  Field fields[FIELD_COUNT];
+  uint16_t fgColor = TFT_GREENYELLOW, bgColor = TFT_BLACK;
+  uint32_t lastUs = 0, maxUs = 0;
+  uint64_t totalUs = 0;
+  uint32_t frames = 0, drawn = 0, skipped = 0;
+};
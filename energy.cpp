@@ -0,0 +1,53 @@
+/**
+  energy.cpp - fixed-point energy integration (see energy.h)
+*/
+//
+#include "energy.h"
+
+//////////////
+
+void EnergyIntegrator::reset() {
+  *this = EnergyIntegrator();
+}
+
+//////////////
+
+void EnergyIntegrator::integrate(uint32_t watts10, uint64_t dtUs) {
+  // [W*10] * [us] / 10000 = [mWs]; the remainder is carried, so nothing is lost to rounding
+  uint64_t e = (uint64_t)watts10 * dtUs + remainder;
+  mWs += e / 10000;
+  remainder = (uint32_t)(e % 10000);
+}
+
+//////////////
+
+void EnergyIntegrator::add(const Sample &sample) {
+  if (!started) {
+    started = true;
+    lastUs = sample.us;
+    lastWatts10 = sample.watts10;
+    lastSocket = sample.kwh100;
+    return;
+  }
+  //
+  // The power reported by a frame holds until the next frame arrives
+  uint64_t dt = (sample.us > lastUs) ? (uint64_t)(sample.us - lastUs) : 0;
+  if (dt <= ENERGY_GAP_US) {
+    integrate(lastWatts10, dt);
+  } else {
+    nGaps++;
+    totalGapUs += dt;
+    if (ENERGY_GAP_POLICY == GAP_INTERPOLATE) {
+      integrate(lastWatts10 + sample.watts10, dt / 2);   // trapezoid
+    } else {
+      integrate(lastWatts10, ENERGY_FRAME_US);
+      lostUs += dt - ENERGY_FRAME_US;
+    }
+  }
+  lastUs = sample.us;
+  lastWatts10 = sample.watts10;
+  //
+  // The socket's counter restarts from 0 when the socket is reset
+  if (sample.kwh100 >= lastSocket) socketTotal += sample.kwh100 - lastSocket;
+  lastSocket = sample.kwh100;
+}
@@ -0,0 +1,56 @@
+/**
+  energy.h - fixed-point energy integration
+
+  The energy total is integrated from the power reported in every frame,
+  over the interval actually measured between frames (Sample::us), in
+  int64 milliwatt-seconds. Nothing is assumed about the frame rate, and a
+  missed frame does not lose the energy of its interval.
+
+  Longer silences (the BLE link was down, frames were rejected) are counted as
+  gaps and handled by ENERGY_GAP_POLICY. The socket's own energy counter
+  (bytes 13-16) is tracked alongside as a cross-check.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include "sample.h"
+//
+#define ENERGY_FRAME_US  1000000  // nominal interval between reports [us]
+#define ENERGY_GAP_US    2500000  // a longer interval is a gap [us]
+//
+#define GAP_CAP          0  // count only one nominal interval of a gap, at the last power reported
+#define GAP_INTERPOLATE  1  // integrate over the whole gap, ramping linearly between the powers on both sides
+#ifndef ENERGY_GAP_POLICY
+#define ENERGY_GAP_POLICY GAP_INTERPOLATE
+#endif
+
+class EnergyIntegrator {
+public:
+  void reset();
+  void restore(uint64_t total) { mWs = total; }   // continue from a total saved before a reset [mWs]
+  void add(const Sample &sample);
+  //
+  uint64_t milliwattSeconds() const { return mWs; }
+  uint64_t kwh1e5() const { return mWs / 36000; }   // [kWh*100000], as printed
+  uint32_t gaps() const { return nGaps; }
+  uint64_t gapUs() const { return totalGapUs; }     // time covered by gaps
+  uint64_t missingUs() const { return lostUs; }      // gap time not integrated (GAP_CAP only)
+  //
+  // Energy counted by the socket since the first sample [kWh*100], and our total minus the socket's [Wh]
+  uint32_t socketKwh100() const { return socketTotal; }
+  int32_t driftWh() const { return (int32_t)((int64_t)(mWs / 3600000) - (int64_t)socketTotal * 10); }
+
+private:
+  void integrate(uint32_t watts10, uint64_t dtUs);  // add watts10 [W*10] held for dtUs [us]
+  //
+  bool started = false;
+  int64_t lastUs = 0;
+  uint32_t lastWatts10 = 0;
+  uint64_t mWs = 0;          // energy total [mWs]
+  uint32_t remainder = 0;    // what was left of the last division [W*10*us, < 10000]
+  uint32_t lastSocket = 0;   // last socket counter reading [kWh*100]
+  uint32_t socketTotal = 0;  // socket counter increase since the first sample [kWh*100]
+  uint32_t nGaps = 0;
+  uint64_t totalGapUs = 0, lostUs = 0;
+};
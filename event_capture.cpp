@@ -0,0 +1,104 @@
+/**
+  event_capture.cpp - every frame around a power anomaly, in an event file (see event_capture.h)
+*/
+//
+#include "event_capture.h"
+#include "format.h"
+
+//////////////
+
+bool EventRecorder::begin(uint32_t frames) {
+  ring = (EventFrame *)(psramFound() ? ps_malloc(frames * sizeof(EventFrame)) : malloc(frames * sizeof(EventFrame)));
+  capacity = ring ? frames : 0;
+  head = used = 0;
+  return ring != nullptr;
+}
+
+//////////////
+
+void EventRecorder::write(const EventFrame &frame) {
+  formatCapture(line, frame.frame, frame.us, frame.device);
+  if (logger.log(line)) written++;
+}
+
+//////////////
+
+bool EventRecorder::start(fs::FS &fs, const char *path, const EventFrame &trigger, const char *tag) {
+  if (!logger.begin(fs, path)) return false;
+  events++;
+  written = 0;
+  postLeft = 0;
+  //
+  // A comment line, which the replay skips
+  Sample sample;
+  atorchDecode(trigger.frame, ATORCH_FRAME_LEN, sample);
+  char *p = fmtStr(line, "# event ");
+  p = fmtFixed(p, events, 0);
+  p = fmtStr(p, trigger.trigger == EVENT_STEP ? ": current step on socket " : ": power deviation on socket ");
+  p = fmtStr(p, tag);
+  p = fmtStr(p, " at ");
+  p = fmtHms(p, (uint32_t)(trigger.us / 1000000));
+  p = fmtStr(p, ", ");
+  p = fmtFixed(p, sample.watts10, 1);
+  p = fmtStr(p, " W from a mean of ");
+  p = fmtFixed(p, trigger.meanW10, 1);
+  p = fmtStr(p, " W\r\n");
+  logger.log(line);
+  //
+  // The frames before the trigger, oldest first
+  for (; used > 0; used--) {
+    write(ring[head]);
+    head = (head + 1) % capacity;
+  }
+  Serial.printf("Event %lu: writing %lu frames before it to %s\r\n", (unsigned long)events, (unsigned long)written, path);
+  return true;
+}
+
+//////////////
+
+void EventRecorder::add(const EventFrame &frame) {
+  if (!logger.isOpen()) {
+    if (frame.trigger) missed++;   // start() was not called, or failed (no card)
+    if (capacity == 0) return;
+    if (used == capacity) {
+      head = (head + 1) % capacity;   // drop the oldest
+      used--;
+    }
+    ring[(head + used) % capacity] = frame;
+    used++;
+    return;
+  }
+  write(frame);
+  if (frame.trigger) postLeft = EVENT_POST_FRAMES;
+  if (postLeft > 0) postLeft--;
+  if (postLeft == 0 || written >= EVENT_MAX_FRAMES) {
+    logger.end();
+    framesWritten += written;
+    if (written > longest) longest = written;
+  }
+}
+
+//////////////
+
+void EventRecorder::poll() {
+  if (logger.isOpen()) logger.poll();
+}
+
+//////////////
+
+void EventRecorder::abort() {
+  if (!logger.isOpen()) return;
+  logger.suspend();
+  framesWritten += written;
+  aborted++;
+}
+
+//////////////
+
+void EventRecorder::printStats(Print &out) const {
+  out.printf("Events: %lu (%lu aborted, %lu missed without a card), %lu frames written, longest %lu; "
+             "ring %lu/%lu frames (%lu bytes)\r\n",
+             (unsigned long)events, (unsigned long)aborted, (unsigned long)missed, (unsigned long)framesWritten,
+             (unsigned long)longest, (unsigned long)used, (unsigned long)capacity,
+             (unsigned long)(capacity * sizeof(EventFrame)));
+}
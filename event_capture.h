@@ -0,0 +1,67 @@
+/**
+  event_capture.h - every frame around a power anomaly, in an event file
+
+  The logs keep one sample a second at most, and the rollups far less, which
+  hides what happens at a switch-on or a fault. So every frame as received is
+  also kept for a while in a RAM ring (EVENT_BUFFER_FRAMES of them), and when
+  the detector of a socket fires, the ring (the frames before the trigger)
+  and the next EVENT_POST_FRAMES frames go to an event file, in the capture
+  format (capture.h): it can be read by eye, or replayed.
+
+  The detector (event_detector.h) fires on a power deviation from the mean or
+  a step of the current. A trigger within the post-trigger window extends it, up to EVENT_MAX_FRAMES
+  frames in the file.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "FS.h"
+#include "atorch.h"
+#include "sample.h"
+#include "capture.h"
+#include "sd_logger.h"
+#include "event_detector.h"
+//
+#ifndef EVENT_BUFFER_FRAMES
+#define EVENT_BUFFER_FRAMES  120    // pre-trigger ring, shared by the sockets (sizeof(EventFrame) each)
+#endif
+#ifndef EVENT_POST_FRAMES
+#define EVENT_POST_FRAMES    60     // frames written after the last trigger
+#endif
+#define EVENT_MAX_FRAMES     1200   // longest event file [frames]
+
+// A frame as received, on its way to the storage task
+struct EventFrame {
+  int64_t us;                       // esp_timer time [us]
+  uint32_t meanW10;                 // the power mean before this frame (triggers only) [W*10]
+  uint8_t device;
+  uint8_t trigger;                  // EVENT_NONE, or what fired
+  uint8_t frame[ATORCH_FRAME_LEN];
+};
+
+class EventRecorder {
+public:
+  bool begin(uint32_t frames);      // allocate the ring (PSRAM if there is any)
+  // Open the event file for a frame with a trigger, and write the frames before it
+  bool start(fs::FS &fs, const char *path, const EventFrame &trigger, const char *tag);
+  void add(const EventFrame &frame);   // every frame, in order: into the event file, or the ring
+  void poll();                      // call regularly (the file's write-behind)
+  void abort();                     // the card is gone: close the event file
+  //
+  bool recording() const { return logger.isOpen(); }
+  uint32_t next() const { return events + 1; }   // number of the next event
+  void printStats(Print &out) const;
+
+private:
+  void write(const EventFrame &frame);
+  //
+  EventFrame *ring = nullptr;
+  uint32_t capacity = 0, head = 0, used = 0;   // head: the oldest frame
+  SdLogger logger;
+  char line[CAPTURE_LINE_LEN];
+  uint32_t postLeft = 0, written = 0;          // of the current event
+  //
+  uint32_t events = 0, missed = 0, aborted = 0, longest = 0;
+  uint64_t framesWritten = 0;
+};
@@ -0,0 +1,37 @@
+/**
+  event_detector.cpp - the trigger of the event files (see event_detector.h)
+*/
+//
+#include "event_detector.h"
+
+//////////////
+
+uint8_t EventDetector::add(const Sample &sample) {
+  int32_t watts10 = (int32_t)sample.watts10;
+  if (samples == 0) {
+    mean16 = (int64_t)watts10 << 16;
+    lastMilliamps = sample.milliamps;
+    samples = 1;
+    return EVENT_NONE;
+  }
+  int64_t diff = watts10 - (int32_t)(mean16 >> 16);
+  uint64_t diff2 = (uint64_t)(diff * diff);
+  int32_t step = (int32_t)sample.milliamps - (int32_t)lastMilliamps;
+  uint8_t trigger = EVENT_NONE;
+  if (samples >= EVENT_WARMUP) {
+    if ((diff >= EVENT_MIN_W10 || -diff >= EVENT_MIN_W10) && diff2 > (uint64_t)EVENT_SIGMAS * EVENT_SIGMAS * variance) {
+      trigger = EVENT_DEVIATION;
+    } else if (step >= EVENT_STEP_MA || -step >= EVENT_STEP_MA) {
+      trigger = EVENT_STEP;
+    }
+  } else {
+    samples++;
+  }
+  // Welford with a fixed weight w: mean += w*diff, variance = (1 - w)*(variance + w*diff^2).
+  // diff may be negative, so it is multiplied and divided rather than shifted.
+  mean16 += diff * 65536 / (1 << EVENT_WEIGHT_SHIFT);
+  uint64_t w2 = diff2 >> EVENT_WEIGHT_SHIFT;
+  variance = variance - (variance >> EVENT_WEIGHT_SHIFT) + w2 - (w2 >> EVENT_WEIGHT_SHIFT);
+  lastMilliamps = sample.milliamps;
+  return trigger;
+}
@@ -0,0 +1,40 @@
+/**
+  event_detector.h - the trigger of the event files (see event_capture.h)
+
+  The detector keeps an exponentially weighted mean and variance of the power
+  (Welford's update with the fixed weight 2^-EVENT_WEIGHT_SHIFT), and the
+  previous current: a few words, and O(1) integer work, per sample. It fires
+  when, after EVENT_WARMUP samples,
+    - the power is more than EVENT_SIGMAS standard deviations, and at least
+      EVENT_MIN_W10, away from its mean (a new load, a fault), or
+    - the current changes by EVENT_STEP_MA or more from one frame to the next
+      (an inrush, a trip).
+  It needs nothing of the Arduino core, so tools/core_test.cpp tests it on the host.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include "sample.h"
+//
+#define EVENT_WEIGHT_SHIFT   5      // the mean and variance follow about the last 2^5 samples
+#define EVENT_WARMUP         32     // samples before the detector is armed
+#define EVENT_SIGMAS         4
+#define EVENT_MIN_W10        200    // smallest power deviation that triggers [W*10]
+#define EVENT_STEP_MA        1000   // smallest current step that triggers [mA]
+//
+#define EVENT_NONE       0          // triggers
+#define EVENT_DEVIATION  1
+#define EVENT_STEP       2
+
+class EventDetector {
+public:
+  uint8_t add(const Sample &sample);   // returns EVENT_NONE, or what fired
+  uint32_t meanW10() const { return (uint32_t)(mean16 >> 16); }
+
+private:
+  int64_t mean16 = 0;               // power mean [W*10 * 65536]
+  uint64_t variance = 0;            // [(W*10)^2]
+  uint32_t lastMilliamps = 0;
+  uint32_t samples = 0;
+};
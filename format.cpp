@@ -0,0 +1,178 @@
+/**
+  format.cpp - allocation-free text formatting of the energy data (see format.h)
+*/
+//
+#include "format.h"
+
+//////////////
+
+char *fmtFixed(char *out, uint32_t value, uint8_t decimals, uint8_t width) {
+  // Build the digits backwards in a scratch buffer: at most 10 digits, a point and a leading zero
+  char tmp[12];
+  int n = 0;
+  do {
+    if (n == decimals && decimals > 0) tmp[n++] = '.';
+    tmp[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0 || n <= decimals);
+  //
+  for (int pad = width - n; pad > 0; pad--) *out++ = ' ';
+  while (n > 0) *out++ = tmp[--n];
+  *out = '\0';
+  return out;
+}
+
+//////////////
+
+char *fmtFixed64(char *out, uint64_t value, uint8_t decimals, uint8_t width) {
+  // 64-bit division is done in software on the ESP32, so use it only when needed
+  if (value <= 0xFFFFFFFFULL) return fmtFixed(out, (uint32_t)value, decimals, width);
+  //
+  char tmp[24];
+  int n = 0;
+  do {
+    if (n == decimals && decimals > 0) tmp[n++] = '.';
+    tmp[n++] = '0' + (char)(value % 10);
+    value /= 10;
+  } while (value > 0 || n <= decimals);
+  //
+  for (int pad = width - n; pad > 0; pad--) *out++ = ' ';
+  while (n > 0) *out++ = tmp[--n];
+  *out = '\0';
+  return out;
+}
+
+//////////////
+
+static char *fmt2(char *out, uint32_t x) {
+  // At least 2 digits, with a leading zero if x < 10
+  if (x < 10) *out++ = '0';
+  return fmtFixed(out, x, 0);
+}
+
+char *fmtHms(char *out, uint32_t secs) {
+  uint32_t hh = secs / 3600;
+  uint32_t mm = (secs / 60) % 60;
+  uint32_t ss = secs % 60;
+  out = fmt2(out, hh);
+  *out++ = ':';
+  out = fmt2(out, mm);
+  *out++ = ':';
+  return fmt2(out, ss);
+}
+
+//////////////
+
+char *fmtStr(char *out, const char *s) {
+  while (*s) *out++ = *s++;
+  *out = '\0';
+  return out;
+}
+
+//////////////
+
+size_t formatCsv(char *out, uint32_t secs, const Sample &sample, uint64_t kwh1e5, uint8_t channels) {
+  char *p = fmtHms(out, secs);
+  *p++ = ',';
+  if (channels & CSV_VOLTS) p = fmtFixed(p, sample.volts10, 1);
+  *p++ = ',';
+  if (channels & CSV_AMPS) p = fmtFixed(p, sample.milliamps, 3);
+  *p++ = ',';
+  if (channels & CSV_WATTS) p = fmtFixed(p, sample.watts10, 1);
+  *p++ = ',';
+  if (channels & CSV_PF) p = fmtFixed(p, (sample.pf1000 + 5) / 10, 2);   // rounded to 2 decimals
+  *p++ = ',';
+  if (channels & CSV_KWH) p = fmtFixed64(p, kwh1e5, 5);
+  *p++ = ',';
+  if (channels & CSV_HZ) p = fmtFixed(p, sample.hz10, 1);
+  p = fmtStr(p, "\r\n");
+  return p - out;
+}
+
+//////////////
+
+size_t formatRollup(char *out, const Rollup &r) {
+  static const uint8_t decimals[ROLL_CHANNELS] = { 1, 3, 1, 3, 1 };   // in the order of RollupChannel
+  char *p = out;
+  p = fmtHms(p, (uint32_t)(r.startUs/1000000));  *p++ = ',';
+  p = fmtFixed(p, r.count, 0);
+  for (int c = 0; c < ROLL_CHANNELS; c++) {
+    *p++ = ',';  p = fmtFixed(p, r.mean(c), decimals[c]);
+    *p++ = ',';  p = fmtFixed(p, r.min[c], decimals[c]);
+    *p++ = ',';  p = fmtFixed(p, r.max[c], decimals[c]);
+  }
+  *p++ = ',';
+  p = fmtFixed64(p, r.energyMWs() / 36000, 5);
+  p = fmtStr(p, "\r\n");
+  return p - out;
+}
+
+//////////////
+
+size_t formatLine(char *out, const char *board, const char *tag, const Sample &sample, uint64_t kwh1e5, uint64_t epochMs) {
+  char *p = out;
+  p = fmtStr(p, "energy,board=");  p = fmtStr(p, board);
+  p = fmtStr(p, ",socket=");       p = fmtStr(p, tag);
+  p = fmtStr(p, " V=");   p = fmtFixed(p, sample.volts10, 1);
+  p = fmtStr(p, ",I=");   p = fmtFixed(p, sample.milliamps, 3);
+  p = fmtStr(p, ",P=");   p = fmtFixed(p, sample.watts10, 1);
+  p = fmtStr(p, ",PF=");  p = fmtFixed(p, sample.pf1000, 3);
+  p = fmtStr(p, ",E=");   p = fmtFixed64(p, kwh1e5, 5);
+  p = fmtStr(p, ",F=");   p = fmtFixed(p, sample.hz10, 1);
+  p = fmtStr(p, ",s=");   p = fmtFixed(p, (uint32_t)(sample.us/1000000), 0);
+  p = fmtStr(p, "i");   // integer field
+  if (epochMs) {
+    *p++ = ' ';
+    p = fmtFixed64(p, epochMs, 0);
+    p = fmtStr(p, "000000");   // [ns]
+  }
+  p = fmtStr(p, "\n");
+  return p - out;
+}
+
+//////////////
+
+const char *parseHms(const char *s, const char *end, uint32_t &secs) {
+  uint32_t total = 0, field = 0;
+  bool digit = false;
+  int colons = 0;
+  for (; s < end; s++) {
+    if (*s >= '0' && *s <= '9') {
+      field = field*10 + (*s - '0');
+      digit = true;
+    } else if (*s == ':' && digit && colons < 2) {
+      total = (total + field) * 60;
+      field = 0;
+      digit = false;
+      colons++;
+    } else {
+      break;
+    }
+  }
+  secs = total + field;
+  return digit ? s : nullptr;
+}
+
+//////////////
+
+const char *parseFixed(const char *s, const char *end, uint8_t decimals, uint32_t &value) {
+  uint32_t v = 0;
+  bool digit = false;
+  for (; s < end && *s >= '0' && *s <= '9'; s++) {
+    v = v*10 + (*s - '0');
+    digit = true;
+  }
+  uint8_t d = 0;
+  if (s < end && *s == '.') {
+    for (s++; s < end && *s >= '0' && *s <= '9'; s++) {
+      if (d < decimals) {
+        v = v*10 + (*s - '0');
+        d++;
+      }
+      digit = true;
+    }
+  }
+  for (; d < decimals; d++) v *= 10;
+  value = v;
+  return digit ? s : nullptr;
+}
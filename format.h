@@ -0,0 +1,60 @@
+/**
+  format.h - allocation-free text formatting of the energy data
+
+  Everything is written into caller-provided char buffers, using integer
+  arithmetic on the scaled values the socket sends (no String, no float).
+  Every function returns a pointer to the terminating zero it wrote, so the
+  calls can be chained to build a line piece by piece.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include <stddef.h>
+#include "sample.h"
+#include "rollup.h"
+//
+#define CSV_LINE_LEN     80   // buffer size that holds any CSV record
+#define ROLLUP_LINE_LEN  192  // ... and any rollup record
+#define NET_LINE_LEN     192  // ... and any line protocol record
+#define ROLLUP_CSV_HEADER "Start [s], Samples, Voltage [V] mean, min, max, Current [A] mean, min, max, " \
+                          "Power [W] mean, min, max, Power Factor mean, min, max, Frequency [Hz] mean, min, max, Energy [kWh]\r\n"
+
+// value/10^decimals as a decimal number, right-aligned in width characters (0 = no padding)
+char *fmtFixed(char *out, uint32_t value, uint8_t decimals, uint8_t width = 0);
+char *fmtFixed64(char *out, uint64_t value, uint8_t decimals, uint8_t width = 0);
+// Running time "hh:mm:ss" (hh has two or more digits)
+char *fmtHms(char *out, uint32_t secs);
+// Copy a zero-terminated string
+char *fmtStr(char *out, const char *s);
+
+// The channels of a log record, a bit each
+#define CSV_VOLTS   0x01
+#define CSV_AMPS    0x02
+#define CSV_WATTS   0x04
+#define CSV_PF      0x08
+#define CSV_KWH     0x10
+#define CSV_HZ      0x20
+#define CSV_ALL     0x3F
+
+// One log record "hh:mm:ss,V,A,W,PF,kWh,Hz\r\n"; kwh1e5 is the energy total [kWh*100000].
+// The columns of the channels not in channels are left empty. out must hold CSV_LINE_LEN bytes.
+// Returns the length of the line.
+size_t formatCsv(char *out, uint32_t secs, const Sample &sample, uint64_t kwh1e5, uint8_t channels = CSV_ALL);
+
+// One rollup record "hh:mm:ss,samples,V mean,min,max,...,Hz mean,min,max,kWh\r\n" (ROLLUP_CSV_HEADER);
+// out must hold ROLLUP_LINE_LEN bytes. Returns the length of the line.
+size_t formatRollup(char *out, const Rollup &rollup);
+
+// One InfluxDB line protocol record of a sample, for the network export:
+//   "energy,board=<board>,socket=<tag> V=230.1,I=0.153,P=29.2,PF=0.760,E=0.00123,F=50.0,s=<uptime>i <ns>\n"
+// kwh1e5 as in formatCsv(); epochMs is the wall-clock time of the sample, 0 to leave the timestamp to
+// the server. out must hold NET_LINE_LEN bytes (board and tag of up to 12 characters). Returns the length.
+size_t formatLine(char *out, const char *board, const char *tag, const Sample &sample, uint64_t kwh1e5, uint64_t epochMs);
+
+// Reading the files back (the HTTP server, the history view): the number at s, which ends at the first
+// character that does not fit, or at end. Return a pointer to that character, or nullptr if there is no number.
+// Running time "hh:mm:ss", or plain seconds
+const char *parseHms(const char *s, const char *end, uint32_t &secs);
+// A decimal number, as value*10^decimals (further decimals are cut off)
+const char *parseFixed(const char *s, const char *end, uint8_t decimals, uint32_t &value);
@@ -0,0 +1,92 @@
+/**
+  format_bench.cpp - microbenchmark of the CSV and display formatting (see format_bench.h)
+*/
+//
+#include "format_bench.h"
+//
+#ifdef FORMAT_BENCHMARK
+//
+#include "esp_system.h"
+#include "format.h"
+//
+#define BENCH_ROUNDS 1000
+
+//////////////
+
+// The formatting as loop() used to do it (v1.0), kept here for comparison only
+static String hms0(int x) {
+	String s = String(x);
+	if (x < 10) s = "0" + s;
+	return s;
+}
+
+static String secs2hhmmss(uint32_t secs) {
+  int hh,mm,ss;
+  hh = secs/3600;
+  mm = (secs - hh*3600)/60;
+  ss = secs - hh*3600 - mm*60;
+  return (hms0(hh) + ":" + hms0(mm) + ":" + hms0(ss));
+}
+
+static size_t legacyFormat(uint32_t secs, const Sample &sample, double kwh) {
+  char buffer[16];
+  double volts = 0.1*sample.volts10, amps = 0.001*sample.milliamps, watts = 0.1*sample.watts10;
+  String vol = String(volts,1), cur = String(amps,3), pow = String(watts,1), ene = String(kwh,5),
+         pfa = String(0.001*sample.pf1000,2), fre = String(0.1*sample.hz10,1), hms = secs2hhmmss(secs);
+  String line = hms + "," + vol + "," + cur + "," + pow + "," + pfa+ "," + ene  + "," + fre + "\r\n";
+  size_t len = line.length();
+  // the display strings
+  len += (vol + " V").length();
+  dtostrf(amps, 6, 3, buffer);  len += (String(buffer) + " A").length();
+  dtostrf(watts, 6, 1, buffer); len += (String(buffer) + " W").length();
+  dtostrf(kwh, 8, 5, buffer);   len += (String(buffer) + " kWh").length();
+  len += (fre + " Hz").length();
+  return len;
+}
+
+//////////////
+
+static size_t fastFormat(uint32_t secs, const Sample &sample, uint64_t kwh1e5) {
+  char line[CSV_LINE_LEN], text[24];
+  size_t len = formatCsv(line, secs, sample, kwh1e5);
+  // the display strings
+  len += fmtStr(fmtFixed(text, sample.volts10, 1), " V") - text;
+  len += fmtStr(fmtFixed(text, sample.milliamps, 3, 6), " A") - text;
+  len += fmtStr(fmtFixed(text, sample.watts10, 1, 6), " W") - text;
+  len += fmtStr(fmtFixed64(text, kwh1e5, 5, 8), " kWh") - text;
+  len += fmtStr(fmtFixed(text, sample.hz10, 1), " Hz") - text;
+  return len;
+}
+
+//////////////
+
+void formatBenchmark(Print &out) {
+  // The sample frame from the README, with the values varied a little every round
+  Sample sample = { 0, 0, 2492, 153, 292, 17, 500, 765 };
+  volatile size_t sink = 0;   // keeps the results alive
+  uint32_t heap0, t0, tLegacy, tFast;
+  //
+  heap0 = esp_get_free_heap_size();
+  t0 = micros();
+  for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+    sample.milliamps = 153 + i % 7;
+    sink += legacyFormat(3600 + i, sample, 0.00017 + i*1e-6);
+  }
+  tLegacy = micros() - t0;
+  out.printf("Format benchmark, String/dtostrf: %lu ns per sample, heap %ld B\r\n",
+             (unsigned long)(tLegacy * 1000ULL / BENCH_ROUNDS), (long)esp_get_free_heap_size() - (long)heap0);
+  //
+  heap0 = esp_get_free_heap_size();
+  t0 = micros();
+  for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+    sample.milliamps = 153 + i % 7;
+    sink += fastFormat(3600 + i, sample, 17 + i/10);
+  }
+  tFast = micros() - t0;
+  out.printf("Format benchmark, fixed-point:    %lu ns per sample, heap %ld B, %lux faster\r\n",
+             (unsigned long)(tFast * 1000ULL / BENCH_ROUNDS), (long)esp_get_free_heap_size() - (long)heap0,
+             (unsigned long)(tFast ? tLegacy / tFast : 0));
+  (void)sink;
+}
+//
+#endif  // FORMAT_BENCHMARK
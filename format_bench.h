@@ -0,0 +1,11 @@
+/**
+  format_bench.h - compares format.h with the String based formatting it replaced
+
+  Build with -DFORMAT_BENCHMARK to run it once from setup().
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+
+void formatBenchmark(Print &out);
@@ -0,0 +1,143 @@
+/**
+  health.cpp - memory and pipeline health, for runs of days (see health.h)
+*/
+//
+#include "health.h"
+#include "format.h"
+#include "esp_heap_caps.h"
+//
+static volatile uint32_t failedAllocations = 0;
+
+//////////////
+
+static void onAllocFailed(size_t size, uint32_t caps, const char *function) {
+  failedAllocations++;
+}
+
+//////////////
+
+void HealthMonitor::begin() {
+  heap_caps_register_failed_alloc_callback(onAllocFailed);
+}
+
+//////////////
+
+void HealthMonitor::connected() {
+  uint32_t heap = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  if (connections++ == 0) firstConnectHeap = heap;
+  lastConnectHeap = heap;
+}
+
+//////////////
+
+void HealthMonitor::sample(HealthRecord &record, TaskStats *tasks, size_t count) {
+  multi_heap_info_t heap;
+  heap_caps_get_info(&heap, MALLOC_CAP_INTERNAL);
+  record.uptimeS = millis() / 1000;
+  record.heapFree = heap.total_free_bytes;
+  record.heapMin = heap.minimum_free_bytes;
+  record.heapLargest = heap.largest_free_block;
+  record.heapBlocks = heap.allocated_blocks;
+  record.psramFree = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+  record.allocFailures = failedAllocations;
+  record.stackMargin = 0xFFFFFFFF;
+  record.stackTask = "";
+  for (size_t i = 0; i < count; i++) {
+    uint32_t free = uxTaskGetStackHighWaterMark(tasks[i].handle);   // [bytes] on the ESP32
+    if (free < record.stackMargin) {
+      record.stackMargin = free;
+      record.stackTask = tasks[i].name;
+    }
+  }
+  record.heapPerReconnect = connections > 1 ? ((int32_t)lastConnectHeap - (int32_t)firstConnectHeap) / (int32_t)(connections - 1) : 0;
+  for (int i = 0; i < PERF_POINTS; i++) {
+#if PERF_ENABLE
+    record.stageUs[i] = perfHistograms[i].avgUs();
+#else
+    record.stageUs[i] = 0;
+#endif
+  }
+  if (soak) {
+    if (record.heapFree < soakMinHeap) soakMinHeap = record.heapFree;
+    if (record.heapLargest < soakMinLargest) soakMinLargest = record.heapLargest;
+  }
+  last = record;
+  records++;
+}
+
+//////////////
+
+void HealthMonitor::soakStart() {
+  multi_heap_info_t heap;
+  heap_caps_get_info(&heap, MALLOC_CAP_INTERNAL);
+  soak = true;
+  soakStartMs = millis();
+  soakStartHeap = soakMinHeap = heap.total_free_bytes;
+  soakStartBlocks = heap.allocated_blocks;
+  soakMinLargest = heap.largest_free_block;
+  soakDrops = 0;
+}
+
+//////////////
+
+void HealthMonitor::soakStop(Print &out) {
+  if (!soak) return;
+  soak = false;
+  multi_heap_info_t heap;
+  heap_caps_get_info(&heap, MALLOC_CAP_INTERNAL);
+  out.printf("Soak: %lu s, %lu links dropped; heap free %lu -> %lu B (%ld B), lowest %lu B, largest block lowest %lu B, "
+             "blocks %lu -> %lu, %lu failed allocations\r\n",
+             (unsigned long)((millis() - soakStartMs) / 1000), (unsigned long)soakDrops,
+             (unsigned long)soakStartHeap, (unsigned long)heap.total_free_bytes,
+             (long)heap.total_free_bytes - (long)soakStartHeap, (unsigned long)soakMinHeap, (unsigned long)soakMinLargest,
+             (unsigned long)soakStartBlocks, (unsigned long)heap.allocated_blocks, (unsigned long)failedAllocations);
+}
+
+//////////////
+
+static char *fmtField(char *out, uint32_t value) {
+  out = fmtFixed(out, value, 0);
+  *out++ = ',';
+  return out;
+}
+
+//////////////
+
+size_t formatHealth(char *out, const HealthRecord &r) {
+  char *p = fmtHms(out, r.uptimeS);
+  *p++ = ',';
+  p = fmtField(p, r.heapFree);
+  p = fmtField(p, r.heapMin);
+  p = fmtField(p, r.heapLargest);
+  p = fmtField(p, r.heapBlocks);
+  p = fmtField(p, r.psramFree);
+  p = fmtField(p, r.allocFailures);
+  p = fmtField(p, r.stackMargin);
+  p = fmtStr(p, r.stackTask);
+  *p++ = ',';
+  p = fmtField(p, r.reconnects);
+  if (r.heapPerReconnect < 0) *p++ = '-';
+  p = fmtField(p, (uint32_t)(r.heapPerReconnect < 0 ? -r.heapPerReconnect : r.heapPerReconnect));
+  p = fmtField(p, r.sampleHigh);
+  p = fmtField(p, r.storageHigh);
+  p = fmtField(p, r.uiHigh);
+  p = fmtField(p, r.netHigh);
+  p = fmtField(p, r.overruns);
+  p = fmtField(p, r.spoolUsed);
+  p = fmtField(p, r.spoolLost);
+  for (int i = 0; i < PERF_POINTS; i++) p = fmtField(p, r.stageUs[i]);
+  p[-1] = '\r';
+  p = fmtStr(p, "\n");
+  return p - out;
+}
+
+//////////////
+
+void HealthMonitor::printStats(Print &out) const {
+  if (records == 0) return;
+  out.printf("Health: heap %lu B free (lowest %lu B), largest block %lu B, %lu blocks, %lu failed allocations, "
+             "stack margin %lu B (%s), heap per reconnect %ld B, %lu records%s\r\n",
+             (unsigned long)last.heapFree, (unsigned long)last.heapMin, (unsigned long)last.heapLargest,
+             (unsigned long)last.heapBlocks, (unsigned long)last.allocFailures, (unsigned long)last.stackMargin,
+             last.stackTask, (long)last.heapPerReconnect, (unsigned long)records, soak ? ", soaking" : "");
+}
@@ -0,0 +1,83 @@
+/**
+  health.h - memory and pipeline health, for runs of days
+
+  Every HEALTH_MS loop() takes a HealthRecord: the free heap (now, the
+  lowest since boot, the largest free block, the blocks allocated), the
+  free PSRAM, the allocations that failed, the smallest stack margin of the
+  tasks, the reconnects and how the free heap moved from one connection to
+  the next, the high-water marks of the queues, the records lost, and the
+  mean time of each stage (perf.h). The storage task appends it to the
+  session's health file, logFile_S<session>_health.csv, one line a record.
+  A fragmenting heap shows as a largest block that keeps shrinking while
+  the free heap does not, a leak as a free heap that goes down with every
+  reconnect.
+
+  The soak ('k') compresses a week into less than two hours of running. It
+  replays the synthetic load at the highest replay speed, into a socket slot
+  of its own (SOAK_DEVICE), and drops the link of every live socket every
+  SOAK_RECONNECT_MS so that the reconnection path runs again and again. The
+  health records are taken every SOAK_HEALTH_MS meanwhile. When it is
+  stopped, the summary compares the heap at its start and end, and gives the
+  lowest free heap and largest block it went through: after a week at 100x
+  the free heap should be back where it started.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "tasks.h"
+#include "perf.h"
+//
+#define HEALTH_MS          60000   // a health record this often [ms]
+#define HEALTH_QUEUE_SIZE  4       // records waiting for the storage task
+#define HEALTH_LINE_LEN    320     // buffer size that holds any health line
+#define SOAK_HEALTH_MS     10000   // ... during a soak
+#define SOAK_RECONNECT_MS  20000   // during a soak, drop the links this often [ms]
+#define HEALTH_CSV_HEADER  "Uptime [s], Heap free [B], min, largest block, blocks, PSRAM free, Failed allocations, " \
+                           "Stack margin [B], task, Reconnects, Heap per reconnect [B], " \
+                           "Queue high water: sample, storage, ui, net, Overruns, Spool used, Spool lost, " \
+                           "Stage mean [us]: decode, integrate, format, SD write, TFT draw, BLE write, net publish\r\n"
+
+struct HealthRecord {
+  uint32_t uptimeS;
+  uint32_t heapFree, heapMin, heapLargest, heapBlocks;   // internal RAM [bytes]
+  uint32_t psramFree, allocFailures;
+  uint32_t stackMargin;        // the smallest free stack of the tasks [bytes]
+  const char *stackTask;       // ... its task
+  int32_t heapPerReconnect;    // mean change of the free heap from one connection to the next [bytes]
+  // Filled in by the caller
+  uint32_t reconnects;         // of all the sockets
+  uint16_t sampleHigh, storageHigh, uiHigh, netHigh;   // queue high-water marks
+  uint32_t overruns;           // of all the queues
+  uint32_t spoolUsed, spoolLost;
+  //
+  uint32_t stageUs[PERF_POINTS];   // mean time of each perf point (0 without PERF_ENABLE)
+};
+
+// One line of the health file (HEALTH_CSV_HEADER); out must hold HEALTH_LINE_LEN bytes. Returns the length.
+size_t formatHealth(char *out, const HealthRecord &record);
+
+class HealthMonitor {
+public:
+  void begin();                // setup(): count the failed allocations from now on
+  void connected();            // loop(): a socket was connected (subscribed)
+  // Take the heap, stack and timing figures; the caller fills in the reconnects and the queues
+  void sample(HealthRecord &record, TaskStats *tasks, size_t count);
+  //
+  void soakStart();
+  void soakStop(Print &out);   // and print its summary
+  void soakDropped() { soakDrops++; }   // a link was dropped by the soak
+  bool soaking() const { return soak; }
+  uint32_t intervalMs() const { return soak ? SOAK_HEALTH_MS : HEALTH_MS; }
+  //
+  void printStats(Print &out) const;
+
+private:
+  uint32_t connections = 0;
+  uint32_t firstConnectHeap = 0, lastConnectHeap = 0;   // free heap after the first and the last connection
+  HealthRecord last = {};
+  uint32_t records = 0;
+  //
+  bool soak = false;
+  uint32_t soakStartMs = 0, soakStartHeap = 0, soakStartBlocks = 0, soakMinHeap = 0, soakMinLargest = 0, soakDrops = 0;
+};
@@ -0,0 +1,344 @@
+/**
+  history.cpp - browsing the logged power on the TFT (see history.h)
+*/
+//
+#include "history.h"
+#include "format.h"
+#include "trend.h"
+#include "esp_timer.h"
+//
+#define HISTORY_BG     TFT_BLACK
+#define HISTORY_GRID   TFT_DARKGREY
+#define HISTORY_RANGE  TFT_DARKGREEN
+#define HISTORY_MEAN   TFT_GREENYELLOW
+
+static const uint32_t tierSeconds[HISTORY_TIERS] = { 1, 60, 3600 };   // a column
+static const char *const tierNames[HISTORY_TIERS] = { "1 s", "1 min", "1 h" };
+
+//////////////
+
+void HistoryIndex::reset(const char *path, uint32_t size) {
+  portENTER_CRITICAL(&lock);
+  strncpy(file, path, LOG_PATH_LEN - 1);
+  file[LOG_PATH_LEN - 1] = '\0';
+  count = 0;
+  gap = HISTORY_BUFFER;
+  end = size;
+  resets++;
+  portEXIT_CRITICAL(&lock);
+}
+
+//////////////
+
+void HistoryIndex::add(uint32_t timeS, uint32_t offset, uint32_t len) {
+  portENTER_CRITICAL(&lock);
+  bool due = count == 0 || offset - offsets[count - 1] >= gap;
+  if (due && count == HISTORY_INDEX_SIZE) {
+    // Full: keep every other entry, and leave twice the bytes between them from now on
+    for (uint16_t i = 0; i < HISTORY_INDEX_SIZE / 2; i++) {
+      times[i] = times[2*i];
+      offsets[i] = offsets[2*i];
+    }
+    count = HISTORY_INDEX_SIZE / 2;
+    gap *= 2;
+    due = offset - offsets[count - 1] >= gap;
+  }
+  if (due) {
+    times[count] = timeS;
+    offsets[count] = offset;
+    count++;
+  }
+  lastS = timeS;
+  end = offset + len;
+  portEXIT_CRITICAL(&lock);
+}
+
+//////////////
+
+bool HistoryIndex::find(uint32_t timeS, char *path, uint32_t &offset) const {
+  // Bisect for the last entry at or before timeS
+  portENTER_CRITICAL(&lock);
+  bool found = count > 0;
+  if (found) {
+    uint16_t lo = 0, hi = count;
+    while (hi - lo > 1) {
+      uint16_t mid = (lo + hi) / 2;
+      if (times[mid] <= timeS) lo = mid;
+      else hi = mid;
+    }
+    offset = offsets[lo];
+    strcpy(path, file);
+  }
+  portEXIT_CRITICAL(&lock);
+  return found;
+}
+
+//////////////
+
+bool HistoryIndex::span(uint32_t &firstS, uint32_t &lastLineS) const {
+  portENTER_CRITICAL(&lock);
+  bool found = count > 0;
+  firstS = found ? times[0] : 0;
+  lastLineS = lastS;
+  portEXIT_CRITICAL(&lock);
+  return found;
+}
+
+//////////////
+
+void HistoryView::touch(int16_t x) {
+  uint32_t window = HISTORY_W * tierSeconds[tier];
+  if (x < 320 / 3) {
+    startS = startS > window / 2 ? startS - window / 2 : 0;   // back
+    live = false;
+  } else if (x >= 2 * 320 / 3) {
+    startS += window / 2;   // forward; update() follows again once at the end
+  } else {
+    // The next zoom, keeping the end of the window
+    uint32_t endS = startS + window;
+    tier = (tier + 1) % HISTORY_TIERS;
+    window = HISTORY_W * tierSeconds[tier];
+    startS = endS > window ? endS - window : 0;
+  }
+}
+
+//////////////
+
+void HistoryView::addLine(const char *line, const char *end) {
+  // The power of one line, in its column: field 3 of the log, or fields 8, 9, 10 (mean, min, max) of a rollup
+  //
+  uint32_t secs, values[3];
+  const char *p = parseHms(line, end, secs);
+  if (!p || secs < startS) return;
+  uint32_t column = (secs - startS) / tierSeconds[tier];
+  if (column >= HISTORY_W) return;
+  int field = 0, first = tier == HISTORY_SECONDS ? 3 : 8, n = tier == HISTORY_SECONDS ? 1 : 3;
+  for (int got = 0; got < n; ) {
+    p = (const char *)memchr(p, ',', end - p);
+    if (!p) return;
+    p++;
+    if (++field >= first) {
+      if (!parseFixed(p, end, 1, values[got++])) return;
+    }
+  }
+  if (n == 1) values[1] = values[2] = values[0];
+  sum[column] += values[0];
+  if (values[1] < low[column]) low[column] = values[1];
+  if (count[column] == 0 || values[2] > high[column]) high[column] = values[2];
+  count[column]++;
+}
+
+//////////////
+
+bool HistoryView::readLines(fs::FS &fs, const char *path, uint32_t offset, uint32_t budget) {
+  // The lines from offset into their columns, up to the end of the window, the end of the lines
+  // written, or budget bytes
+  //
+  readAll = false;
+  File file = fs.open(path, FILE_READ);
+  if (!file) return false;
+  if (!file.seek(offset)) {
+    file.close();
+    return false;
+  }
+  uint32_t endS = startS + HISTORY_W * tierSeconds[tier], bytes = 0, secs;
+  size_t keep = 0;
+  bool done = false;
+  while (!done && bytes < budget) {
+    int n = file.read((uint8_t *)buffer + keep, HISTORY_BUFFER - keep);
+    if (n <= 0) {
+      readAll = true;   // the end of the file
+      break;
+    }
+    reads++;
+    bytes += n;
+    const char *limit = buffer + keep + n;
+    const char *zero = (const char *)memchr(buffer + keep, 0, n);   // the end marker of a log being written
+    if (zero) {
+      limit = zero;
+      done = readAll = true;
+    }
+    const char *line = buffer, *end;
+    while ((end = (const char *)memchr(line, '\n', limit - line)) != nullptr) {
+      if (parseHms(line, end, secs) && secs >= endS) {
+        done = true;
+        readAll = false;
+        break;
+      }
+      addLine(line, end);
+      line = end + 1;
+    }
+    keep = limit - line;
+    offset += line - buffer;
+    if (keep > HISTORY_BUFFER / 2) {   // not a line of ours
+      offset += keep;
+      keep = 0;
+    }
+    memmove(buffer, line, keep);
+  }
+  file.close();
+  bytesRead += bytes;
+  readEnd = offset;
+  return true;
+}
+
+//////////////
+
+bool HistoryView::load(fs::FS &fs, const HistoryIndex &index) {
+  // One seek, then the lines up to the end of the window: from the entry to the window's first
+  // line is less than two spacings of bytes
+  //
+  for (int i = 0; i < HISTORY_W; i++) {
+    low[i] = HISTORY_GAP;
+    high[i] = sum[i] = count[i] = 0;
+  }
+  char path[LOG_PATH_LEN];
+  uint32_t offset;
+  if (!index.find(startS, path, offset)) return false;
+  return readLines(fs, path, offset, 2 * index.spacing() + HISTORY_READ_MAX);
+}
+
+//////////////
+
+bool HistoryView::extend(fs::FS &fs, const HistoryIndex &index) {
+  // Following: move the columns along with the window, then add the lines written since the
+  // last read. A window that moved too far, or too many new bytes, are loaded afresh.
+  //
+  uint32_t shift = (startS - shownStartS) / tierSeconds[tier];
+  if (shift >= HISTORY_W || readEnd > index.size() || index.size() - readEnd > HISTORY_READ_MAX) return load(fs, index);
+  follows++;
+  if (shift > 0) {
+    int kept = HISTORY_W - shift;
+    memmove(low, low + shift, kept * sizeof(low[0]));
+    memmove(high, high + shift, kept * sizeof(high[0]));
+    memmove(sum, sum + shift, kept * sizeof(sum[0]));
+    memmove(count, count + shift, kept * sizeof(count[0]));
+    for (int i = kept; i < HISTORY_W; i++) {
+      low[i] = HISTORY_GAP;
+      high[i] = sum[i] = count[i] = 0;
+    }
+  }
+  char path[LOG_PATH_LEN];
+  uint32_t offset;
+  if (!index.find(startS, path, offset)) return false;   // for its path
+  return readLines(fs, path, readEnd, HISTORY_READ_MAX);
+}
+
+//////////////
+
+static int16_t plotY(uint32_t value, uint32_t scale) {
+  if (value > scale) value = scale;
+  return HISTORY_H - 1 - (int16_t)((uint64_t)value * (HISTORY_H - 1) / scale);
+}
+
+//////////////
+
+void HistoryView::drawLabels(const char *message) {
+  char text[40], *p;
+  tft.setTextColor(HISTORY_MEAN, HISTORY_BG);
+  tft.setTextPadding(HISTORY_W / 2);
+  if (message) {
+    tft.drawString(message, HISTORY_X, HISTORY_LABEL_Y, 2);
+  } else {
+    p = fmtStr(text, "Power 0-");
+    fmtStr(fmtFixed(p, scale / 10, 0), " W");
+    tft.drawString(text, HISTORY_X, HISTORY_LABEL_Y, 2);
+  }
+  tft.setTextDatum(TR_DATUM);
+  fmtStr(fmtStr(text, tierNames[tier]), live ? " a column, live" : " a column");
+  tft.drawString(text, HISTORY_X + HISTORY_W, HISTORY_LABEL_Y, 2);
+  tft.setTextColor(HISTORY_GRID, HISTORY_BG);
+  fmtHms(text, startS + HISTORY_W * tierSeconds[tier]);
+  tft.drawString(text, HISTORY_X + HISTORY_W, HISTORY_TIME_Y, 2);
+  tft.setTextDatum(TL_DATUM);
+  fmtHms(text, startS);
+  tft.drawString(text, HISTORY_X, HISTORY_TIME_Y, 2);
+  tft.setTextPadding(0);
+}
+
+//////////////
+
+void HistoryView::draw() {
+  // Every column: the range of the power in it (joined to the mean of the column before), and its mean
+  //
+  uint32_t top = 100;   // at least 10 W
+  for (int i = 0; i < HISTORY_W; i++) {
+    if (count[i] && high[i] > top) top = high[i];
+  }
+  scale = TrendChart::niceScale(top);
+  tft.startWrite();
+  drawLabels(nullptr);
+  int16_t before = -1;
+  for (int i = 0; i < HISTORY_W; i++) {
+    int16_t x = HISTORY_X + i;
+    tft.drawFastVLine(x, HISTORY_Y, HISTORY_H, HISTORY_BG);
+    if (i % 32 == 0) {
+      for (int y = 0; y < HISTORY_H; y += 4) tft.drawPixel(x, HISTORY_Y + y, HISTORY_GRID);
+    }
+    if (count[i] == 0) {
+      before = -1;
+      continue;
+    }
+    int16_t yLow = plotY(low[i], scale), yHigh = plotY(high[i], scale), yMean = plotY(sum[i] / count[i], scale);
+    if (before >= 0 && before > yLow) yLow = before;
+    if (before >= 0 && before < yHigh) yHigh = before;
+    tft.drawFastVLine(x, HISTORY_Y + yHigh, yLow - yHigh + 1, HISTORY_RANGE);
+    tft.drawPixel(x, HISTORY_Y + yMean, HISTORY_MEAN);
+    before = yMean;
+  }
+  tft.endWrite();
+}
+
+//////////////
+
+void HistoryView::update(fs::FS &fs, const HistoryIndex *indexes, bool force) {
+  uint32_t res = tierSeconds[tier], window = HISTORY_W * res, firstS, lastS;
+  if (!indexes[tier].span(firstS, lastS)) {
+    if (force || shownTier != tier) {
+      tft.fillRect(HISTORY_X, HISTORY_Y, HISTORY_W, HISTORY_H, HISTORY_BG);
+      drawLabels("No data yet");
+      shownTier = tier;
+    }
+    return;
+  }
+  // Keep the window within the lines indexed, on whole columns; past the newest ones it follows them
+  uint32_t newest = (lastS / res + 1) * res;
+  uint32_t newestStart = newest > window ? newest - window : 0;
+  if (live || startS >= newestStart) {
+    live = true;
+    startS = newestStart;
+  }
+  if (startS < firstS / res * res) startS = firstS / res * res;
+  startS = startS / res * res;
+  if (!force && tier == shownTier && startS == shownStartS && (lastS == shownLastS || lastS >= startS + window)) return;
+  //
+  const HistoryIndex &index = indexes[tier];
+  uint32_t files = index.files();
+  bool following = !force && live && readAll && tier == shownTier && &index == shownIndex && files == shownFiles &&
+                   startS >= shownStartS;
+  int64_t t0 = esp_timer_get_time();
+  bool loaded = following ? extend(fs, index) : load(fs, index);
+  int64_t t1 = esp_timer_get_time();
+  if (loaded) draw();
+  else drawLabels("Cannot read the file");
+  int64_t t2 = esp_timer_get_time();
+  loads++;
+  lastLoadUs = (uint32_t)(t1 - t0);
+  lastDrawUs = (uint32_t)(t2 - t1);
+  if (lastLoadUs > maxLoadUs) maxLoadUs = lastLoadUs;
+  if (lastDrawUs > maxDrawUs) maxDrawUs = lastDrawUs;
+  shownTier = tier;
+  shownStartS = startS;
+  shownLastS = lastS;
+  shownIndex = &index;
+  shownFiles = files;
+  if (!loaded) readAll = false;
+}
+
+//////////////
+
+void HistoryView::printStats(Print &out) const {
+  out.printf("History: %lu windows (%lu followed), %lu SD reads (%lu KB), load last %lu us, max %lu us, draw last %lu us, max %lu us\r\n",
+             (unsigned long)loads, (unsigned long)follows, (unsigned long)reads, (unsigned long)(bytesRead / 1024), (unsigned long)lastLoadUs,
+             (unsigned long)maxLoadUs, (unsigned long)lastDrawUs, (unsigned long)maxDrawUs);
+}
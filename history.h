@@ -0,0 +1,109 @@
+/**
+  history.h - browsing the logged power on the TFT
+
+  The history view plots HISTORY_W columns of power from the files of this
+  session, at one of three zooms: a second a column from the CSV log, a minute
+  from the minute rollups, an hour from the hour rollups (about 4 minutes,
+  4 hours and 10 days a screen). Each column shows the range of the power in
+  it, and its mean. A touch on the left or right third of the screen scrolls
+  by half a screen, one in the middle changes the zoom; at the newest end the
+  view follows what is written to the card.
+
+  Finding a window does not scan the file: while logging, the first line at
+  least a spacing of bytes after the last entry gets an entry (time, offset)
+  in a HistoryIndex of HISTORY_INDEX_SIZE entries. The spacing starts at
+  HISTORY_BUFFER; when the index is full every other entry goes and the
+  spacing doubles, so it covers a file of any length in fixed RAM, with
+  entries never more than twice the file size / HISTORY_INDEX_SIZE apart.
+  A window is then one seek and one contiguous read, in pieces of
+  HISTORY_BUFFER bytes: less than two spacings of bytes before it (the
+  entries that stay are a spacing and some lines apart), then its own lines,
+  HISTORY_READ_MAX bytes at most. For a segment of LOG_SEGMENT_BYTES that is
+  192 KB, or 192 reads, at worst. The drawing is one pass over the columns.
+  While the view follows the newest lines, a new line does not load the
+  window again: the columns move along with it, and only the bytes from where
+  the last read stopped to the end of the index are read, one read or two.
+
+  The current segment of the CSV log is indexed, and the rollups of the whole
+  session. The times are those of the files (seconds since boot).
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+#include "FS.h"
+#include "sd_logger.h"
+//
+#define HISTORY_W           256     // plot size [pixels] = columns
+#define HISTORY_H           128
+#define HISTORY_X           ((320 - HISTORY_W) / 2)
+#define HISTORY_Y           76
+#define HISTORY_LABEL_Y     52      // row of the scale and zoom labels (font 2)
+#define HISTORY_TIME_Y      (HISTORY_Y + HISTORY_H + 4)   // ... and of the window's start and end
+#define HISTORY_INDEX_SIZE  128     // entries in the index of one file
+#define HISTORY_BUFFER      1024    // bytes read from the card at a time
+#define HISTORY_READ_MAX    65536   // most bytes read for the lines of one window (after the entry's spacing)
+#define HISTORY_GAP         0xFFFFFFFF   // no line in this column
+
+enum HistoryTier { HISTORY_SECONDS, HISTORY_MINUTES, HISTORY_HOURS, HISTORY_TIERS };
+
+// The sparse index of one append-only file. add() is called by the storage task, find() by the ui task.
+class HistoryIndex {
+public:
+  void reset(const char *path, uint32_t size);              // a new file, size bytes long (its header)
+  void add(uint32_t timeS, uint32_t offset, uint32_t len);  // a line of len bytes was appended at offset
+  uint32_t size() const { return end; }                     // of the file, up to the last line added
+  // The file, and the offset of the last entry at or before timeS (or the first entry)
+  bool find(uint32_t timeS, char *path, uint32_t &offset) const;
+  bool span(uint32_t &firstS, uint32_t &lastS) const;       // the times of the first and last lines
+  uint32_t spacing() const { return gap; }                  // least bytes between two entries
+  uint32_t files() const { return resets; }                 // counts reset(), so a reader sees a new file
+
+private:
+  mutable portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+  char file[LOG_PATH_LEN] = "";
+  uint32_t times[HISTORY_INDEX_SIZE];
+  uint32_t offsets[HISTORY_INDEX_SIZE];
+  uint16_t count = 0;
+  uint32_t gap = HISTORY_BUFFER;   // least bytes from one entry to the next
+  uint32_t end = 0, lastS = 0;
+  uint32_t resets = 0;
+};
+
+class HistoryView {
+public:
+  explicit HistoryView(TFT_eSPI &display) : tft(display) {}
+  //
+  void touch(int16_t x);        // scroll or zoom, for a touch at x
+  // Draw the window, if it moved or (following) a new line is indexed; force: draw it anyway
+  void update(fs::FS &fs, const HistoryIndex *indexes, bool force);
+  //
+  void printStats(Print &out) const;
+
+private:
+  bool load(fs::FS &fs, const HistoryIndex &index);
+  bool extend(fs::FS &fs, const HistoryIndex &index);
+  bool readLines(fs::FS &fs, const char *path, uint32_t offset, uint32_t budget);
+  void addLine(const char *line, const char *end);
+  void draw();
+  void drawLabels(const char *message);
+  //
+  TFT_eSPI &tft;
+  int tier = HISTORY_SECONDS;
+  bool live = true;             // following the newest lines
+  uint32_t startS = 0;          // of the window
+  int shownTier = -1;
+  uint32_t shownStartS = 0, shownLastS = 0;
+  const HistoryIndex *shownIndex = nullptr;
+  uint32_t shownFiles = 0;
+  uint32_t readEnd = 0;         // offset of the first byte not read yet (the end of the last whole line)
+  bool readAll = false;         // the last read went on to the end of the lines written
+  uint32_t low[HISTORY_W], high[HISTORY_W], sum[HISTORY_W];    // of the lines in each column [W*10]
+  uint16_t count[HISTORY_W];
+  uint32_t scale = 0;           // full height of the plot [W*10]
+  char buffer[HISTORY_BUFFER];
+  //
+  uint32_t loads = 0, follows = 0, reads = 0, maxLoadUs = 0, maxDrawUs = 0, lastLoadUs = 0, lastDrawUs = 0;
+  uint64_t bytesRead = 0;
+};
@@ -0,0 +1,124 @@
+/**
+  link_state.cpp - connection state machine of one BLE socket (see link_state.h)
+*/
+//
+#include "link_state.h"
+
+//////////////
+
+const char *LinkMonitor::stateName() const {
+  switch (current) {
+    case LINK_SCANNING:    return "scanning";
+    case LINK_CONNECTING:  return "connecting";
+    case LINK_DISCOVERING: return "discovering";
+    case LINK_SUBSCRIBED:  return framed ? "receiving" : "subscribed";
+    case LINK_BACKOFF:     return "backoff";
+  }
+  return "?";
+}
+
+//////////////
+
+uint32_t LinkMonitor::random() {
+  // xorshift32, good enough to spread the retries of several boards
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+//////////////
+
+void LinkMonitor::found(uint32_t now) {
+  if (current != LINK_SCANNING) return;
+  current = LINK_CONNECTING;
+  attemptStart = now;
+  nAttempts++;
+}
+
+void LinkMonitor::connected(uint32_t now) {
+  if (current == LINK_CONNECTING) current = LINK_DISCOVERING;
+}
+
+void LinkMonitor::subscribed(uint32_t now) {
+  if (current != LINK_DISCOVERING) return;
+  current = LINK_SUBSCRIBED;
+  framed = false;
+}
+
+//////////////
+
+void LinkMonitor::frame(uint32_t now) {
+  lastFrame = now;
+  if (current != LINK_SUBSCRIBED || framed) return;
+  //
+  // First frame of this connection: the attempt has succeeded
+  framed = true;
+  consecutiveFailures = 0;
+  ttffMs = now - attemptStart;
+  if (ttffMs > maxTtffMs) maxTtffMs = ttffMs;
+  if (bootTtffMs == 0) bootTtffMs = now;
+  if (outage) {
+    outageMs = now - outageStart;
+    if (outageMs > maxOutMs) maxOutMs = outageMs;
+    totalOutMs += outageMs;
+    nOutages++;
+    outage = false;
+  }
+}
+
+//////////////
+
+void LinkMonitor::failed(uint32_t now) {
+  // Wait LINK_BACKOFF_MIN_MS * 2^(failures-1), capped, +/- LINK_JITTER_PERCENT
+  nFailures++;
+  consecutiveFailures++;
+  uint32_t d = LINK_BACKOFF_MIN_MS;
+  for (uint32_t i = 1; i < consecutiveFailures && d < LINK_BACKOFF_MAX_MS; i++) d *= 2;
+  if (d > LINK_BACKOFF_MAX_MS) d = LINK_BACKOFF_MAX_MS;
+  uint32_t span = d * LINK_JITTER_PERCENT / 100;
+  d = d - span + random() % (2*span + 1);
+  //
+  delayMs = d;
+  backoffStart = now;
+  current = LINK_BACKOFF;
+  framed = false;
+}
+
+//////////////
+
+void LinkMonitor::lost(uint32_t now) {
+  if (current != LINK_DISCOVERING && current != LINK_SUBSCRIBED) return;
+  if (framed) {
+    // A working link dropped: count the reconnection and start timing the outage
+    nReconnects++;
+    if (!outage) {
+      outage = true;
+      outageStart = lastFrame;
+    }
+    current = LINK_SCANNING;   // the first retry goes out without waiting
+    framed = false;
+  } else {
+    failed(now);
+  }
+}
+
+//////////////
+
+void LinkMonitor::poll(uint32_t now) {
+  if (current == LINK_BACKOFF && now - backoffStart >= delayMs) current = LINK_SCANNING;
+}
+
+//////////////
+
+uint32_t LinkMonitor::idleMs(uint32_t now) const {
+  switch (current) {
+    case LINK_CONNECTING:
+    case LINK_DISCOVERING:
+      return 0;   // the next step is due now
+    case LINK_BACKOFF:
+      return now - backoffStart >= delayMs ? 0 : delayMs - (now - backoffStart);
+    default:
+      return UINT32_MAX;   // waiting for an advertisement, a frame or a disconnection
+  }
+}
@@ -0,0 +1,87 @@
+/**
+  link_state.h - connection state machine of one BLE socket
+
+  The BLE calls themselves are made by loop() in main.cpp, one step per pass;
+  this class only decides what the next step is, when a failed attempt may be
+  retried, and keeps the link statistics. It knows nothing about BLE, so it
+  stays portable.
+
+    SCANNING     waiting for an advertisement of the socket
+    CONNECTING   advertisement seen, connect() is next
+    DISCOVERING  connected, service/characteristic lookup and subscription are next
+    SUBSCRIBED   notifications enabled (the first frame completes the attempt)
+    BACKOFF      an attempt failed; waiting before scanning again
+
+  Failed attempts are retried after an exponential backoff with jitter.
+  Time to first frame, reconnections and the length of every outage (last
+  frame before a disconnection to first frame after it) are recorded.
+
+  All the events are fed in by one task (loop()), with millis() timestamps.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+//
+#define LINK_BACKOFF_MIN_MS   1000    // delay after the first failed attempt [ms]
+#define LINK_BACKOFF_MAX_MS   60000   // the delay doubles with every failure up to this [ms]
+#define LINK_JITTER_PERCENT   25      // +/- random variation of the delay [%]
+
+enum LinkState {
+  LINK_SCANNING,
+  LINK_CONNECTING,
+  LINK_DISCOVERING,
+  LINK_SUBSCRIBED,
+  LINK_BACKOFF
+};
+
+class LinkMonitor {
+public:
+  void begin(uint32_t seed) { rng = seed ? seed : 1; }
+  //
+  // Events (now = millis())
+  void found(uint32_t now);       // advertisement seen while SCANNING
+  void connected(uint32_t now);   // connect() succeeded
+  void subscribed(uint32_t now);  // notifications enabled
+  void frame(uint32_t now);       // a valid frame arrived
+  void failed(uint32_t now);      // a connect or discovery step failed
+  void lost(uint32_t now);        // disconnected while DISCOVERING or SUBSCRIBED
+  void poll(uint32_t now);        // ends BACKOFF when its time is up
+  uint32_t idleMs(uint32_t now) const;   // how long poll() has nothing to do (no events) [ms]
+  //
+  LinkState state() const { return current; }
+  const char *stateName() const;
+  bool gotFrame() const { return framed; }   // SUBSCRIBED and the first frame has arrived
+  //
+  uint32_t attempts() const { return nAttempts; }
+  uint32_t failures() const { return nFailures; }
+  uint32_t reconnects() const { return nReconnects; }
+  uint32_t backoffMs() const { return delayMs; }                        // current (or last) backoff delay
+  uint32_t lastFirstFrameMs() const { return ttffMs; }                  // attempt start to first frame
+  uint32_t maxFirstFrameMs() const { return maxTtffMs; }
+  uint32_t bootFirstFrameMs() const { return bootTtffMs; }              // boot to the very first frame (0 = none yet)
+  uint32_t outages() const { return nOutages; }
+  uint32_t lastOutageMs() const { return outageMs; }
+  uint32_t maxOutageMs() const { return maxOutMs; }
+  uint64_t totalOutageMs() const { return totalOutMs; }
+  bool inOutage() const { return outage; }
+
+private:
+  uint32_t random();
+  //
+  LinkState current = LINK_SCANNING;
+  bool framed = false;
+  bool outage = false;        // the link was lost and no frame has arrived since
+  uint32_t attemptStart = 0;  // when the advertisement of the current attempt was seen
+  uint32_t backoffStart = 0;
+  uint32_t lastFrame = 0;
+  uint32_t outageStart = 0;   // last frame before the link was lost
+  uint32_t consecutiveFailures = 0;
+  uint32_t delayMs = 0;
+  uint32_t rng = 1;
+  //
+  uint32_t nAttempts = 0, nFailures = 0, nReconnects = 0, nOutages = 0;
+  uint32_t ttffMs = 0, maxTtffMs = 0, bootTtffMs = 0;
+  uint32_t outageMs = 0, maxOutMs = 0;
+  uint64_t totalOutMs = 0;
+};
@@ -0,0 +1,148 @@
+/**
+  log_index.cpp - the session index on the SD card (see log_index.h)
+*/
+//
+#include <time.h>
+#include <ctype.h>
+#include "log_index.h"
+#include "format.h"
+
+//////////////
+
+uint32_t clockEpoch() {
+  time_t now = time(nullptr);
+  return now > INDEX_CLOCK_SET ? (uint32_t)now : 0;
+}
+
+//////////////
+
+static uint16_t lastFileSession(fs::FS &fs, const char *path) {
+  // The highest session number ("_S0007") in the names of the files next to the index
+  //
+  char dir[LOG_PATH_LEN];
+  const char *slash = strrchr(path, '/');
+  size_t len = slash && slash > path ? slash - path : 1;
+  memcpy(dir, path, len);
+  dir[len] = '\0';
+  uint16_t last = 0;
+  File root = fs.open(dir);
+  if (!root) return 0;
+  for (File file = root.openNextFile(); file; file = root.openNextFile()) {
+    for (const char *p = strstr(file.name(), "_S"); p; p = strstr(p + 2, "_S")) {
+      if (isdigit(p[2]) && isdigit(p[3]) && isdigit(p[4]) && isdigit(p[5])) {
+        uint16_t session = (uint16_t)strtoul(p + 2, nullptr, 10);
+        if (session > last) last = session;
+      }
+    }
+    file.close();
+  }
+  root.close();
+  return last;
+}
+
+//////////////
+
+bool SessionIndex::begin(fs::FS &fs, const char *path) {
+  // One pass over the index: the highest session number, and the segments without a close line
+  //
+  strncpy(this->path, path, LOG_PATH_LEN - 1);
+  this->path[LOG_PATH_LEN - 1] = '\0';
+  uint16_t last = 0;
+  nPending = 0;
+  File file = fs.open(path, FILE_READ);
+  if (file) {
+    char line[2*LOG_PATH_LEN];
+    while (file.available()) {
+      size_t len = file.readBytesUntil('\n', line, sizeof(line) - 1);
+      line[len] = '\0';
+      char *fields[4], *p = line;
+      int n = 0;
+      while (n < 4 && p) {
+        fields[n++] = p;
+        p = strchr(p, ',');
+        if (p) *p++ = '\0';
+      }
+      if (n < 4) continue;   // the header, or a line torn by a power cut
+      uint16_t session = (uint16_t)strtoul(fields[1], nullptr, 10);
+      uint16_t segment = (uint16_t)strtoul(fields[2], nullptr, 10);
+      if (session > last) last = session;
+      if (strcmp(fields[0], "open") == 0 && nPending < INDEX_PENDING) {
+        Pending &pend = pending[nPending++];
+        pend.session = session;
+        pend.segment = segment;
+        strncpy(pend.file, fields[3], LOG_PATH_LEN - 1);
+        pend.file[LOG_PATH_LEN - 1] = '\0';
+      } else if (strcmp(fields[0], "close") == 0) {
+        for (int i = 0; i < nPending; i++) {
+          if (strcmp(pending[i].file, fields[3]) == 0) {
+            pending[i] = pending[--nPending];
+            break;
+          }
+        }
+      }
+    }
+    file.close();
+  } else {
+    // No index (a new card, or it was deleted): number the session after the files on the card
+    last = lastFileSession(fs, path);
+    file = fs.open(path, FILE_WRITE);
+    if (!file) {
+      Serial.printf("Failed to create %s\r\n", path);
+      return false;
+    }
+    file.print(INDEX_HEADER);
+    file.close();
+  }
+  current = last + 1;
+  this->fs = &fs;
+  Serial.printf("Session %u, %d segments to recover\r\n", (unsigned)current, nPending);
+  return true;
+}
+
+//////////////
+
+void SessionIndex::opened(uint16_t segment, const char *file, uint32_t uptimeS) {
+  append("open", current, segment, file, true, uptimeS, 0);
+}
+
+//////////////
+
+void SessionIndex::closed(uint16_t segment, const char *file, uint32_t uptimeS, uint32_t bytes) {
+  append("close", current, segment, file, true, uptimeS, bytes);
+}
+
+//////////////
+
+void SessionIndex::recovered(int i, uint32_t bytes) {
+  append("close", pending[i].session, pending[i].segment, pending[i].file, false, 0, bytes);
+}
+
+//////////////
+
+void SessionIndex::append(const char *event, uint16_t session, uint16_t segment, const char *file,
+                          bool times, uint32_t uptimeS, uint32_t bytes) {
+  // One line per event; the file is opened only for it, like the rollup files
+  //
+  if (!fs) return;
+  char line[2*LOG_PATH_LEN];
+  char *p = fmtStr(line, event);
+  *p++ = ',';
+  p = fmtFixed(p, session, 0);  *p++ = ',';
+  p = fmtFixed(p, segment, 0);  *p++ = ',';
+  p = fmtStr(p, file);          *p++ = ',';
+  uint32_t epoch = clockEpoch();
+  if (times) p = fmtFixed(p, uptimeS, 0);
+  *p++ = ',';
+  if (times && epoch) p = fmtFixed(p, epoch, 0);
+  *p++ = ',';
+  if (strcmp(event, "close") == 0) p = fmtFixed(p, bytes, 0);
+  fmtStr(p, "\r\n");
+  //
+  File out = fs->open(path, FILE_APPEND);
+  if (!out) {
+    Serial.printf("Failed to open %s\r\n", path);
+    return;
+  }
+  out.print(line);
+  out.close();
+}
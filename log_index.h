@@ -0,0 +1,65 @@
+/**
+  log_index.h - the session index on the SD card
+
+  Every boot is a new session, and each session writes its logs in segments
+  (one file per socket and segment), so nothing from an earlier session is
+  ever overwritten. The index is a small CSV file with one line when a segment
+  is opened and one when it is closed:
+
+    event,session,segment,file,uptime_s,epoch_s,bytes
+    open,7,3,/PowerMeterLog_S0007-003_A4C1381F2B3C.txt,172800,1760400000,
+    close,7,3,/PowerMeterLog_S0007-003_A4C1381F2B3C.txt,259200,1760486400,5123456
+
+  uptime_s is the time column of the log at that point (seconds since boot),
+  epoch_s the wall-clock time (Unix seconds), empty while the clock is not set.
+  A tool finds the files holding a time window from the index alone.
+
+  begin() reads the index, numbers the new session after the last one, and
+  lists the segments that were opened but never closed (the power was cut).
+  Without an index, the new session is numbered after the highest one in the
+  names of the files next to it, so that a lost index does not lead to
+  overwriting the files of session 1 and on.
+  Those are then cut to their data (SdLogger::recover()) and closed with
+  recovered(); their end times are left empty.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "FS.h"
+#include "sd_logger.h"
+//
+#define INDEX_HEADER    "event,session,segment,file,uptime_s,epoch_s,bytes\r\n"
+#define INDEX_PENDING   16          // most unclosed segments begin() lists
+#define INDEX_CLOCK_SET 1704067200  // time() is later than this once the clock is set (2024-01-01) [s]
+
+uint32_t clockEpoch();              // time(), or 0 while the clock is not set
+
+class SessionIndex {
+public:
+  bool begin(fs::FS &fs, const char *path);   // read the index, start the next session
+  bool ready() const { return fs != nullptr; }
+  uint16_t session() const { return current; }
+  //
+  void opened(uint16_t segment, const char *file, uint32_t uptimeS);
+  void closed(uint16_t segment, const char *file, uint32_t uptimeS, uint32_t bytes);
+  //
+  // The segments left open by earlier sessions
+  int pendingCount() const { return nPending; }
+  const char *pendingFile(int i) const { return pending[i].file; }
+  void recovered(int i, uint32_t bytes);
+
+private:
+  void append(const char *event, uint16_t session, uint16_t segment, const char *file,
+              bool times, uint32_t uptimeS, uint32_t bytes);
+  //
+  struct Pending {
+    uint16_t session, segment;
+    char file[LOG_PATH_LEN];
+  };
+  fs::FS *fs = nullptr;
+  char path[LOG_PATH_LEN];
+  uint16_t current = 0;
+  Pending pending[INDEX_PENDING];
+  int nPending = 0;
+};
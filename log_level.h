@@ -0,0 +1,18 @@
+/**
+  log_level.h - compile-time selection of the Serial diagnostics
+
+  Build with -DLOG_LEVEL=<n> to choose how much is printed. Diagnostics are
+  written as  if (LOG_LEVEL >= LOG_DEBUG) { ... }  so that the condition is a
+  constant and the compiler removes the disabled output (and its strings) entirely.
+*/
+//
+#pragma once
+//
+#define LOG_NONE   0  // nothing
+#define LOG_ERROR  1  // failures only
+#define LOG_INFO   2  // + connection events, statistics and the CSV records
+#define LOG_DEBUG  3  // + hex dump and decoded values of every BLE frame
+//
+#ifndef LOG_LEVEL
+#define LOG_LEVEL  LOG_INFO
+#endif
@@ -0,0 +1,274 @@
+/**
+  log_server.cpp - downloads of the log files over HTTP (see log_server.h)
+*/
+//
+#include <WiFi.h>
+#include "log_server.h"
+#include "binlog.h"
+#include "sd_logger.h"
+#include "format.h"
+
+//////////////
+
+static bool parseTime(const char *s, const char *end, uint32_t &secs) {
+  return parseHms(s, end, secs) != nullptr;
+}
+
+//////////////
+
+void LogServer::begin(fs::FS &card, bool (*cardReady)(), uint32_t (*samplesLost)()) {
+  fs = &card;
+  ready = cardReady;
+  lost = samplesLost;
+  server.on("/", HTTP_GET, [this]() { handleList(); });
+  server.on("/file", HTTP_GET, [this]() { handleFile(); });
+  server.onNotFound([this]() { server.send(404, "text/plain", "Not found\r\n"); });
+  server.begin();
+  Serial.printf("HTTP server on port %d\r\n", HTTP_PORT);
+}
+
+//////////////
+
+void LogServer::poll() {
+  bool up = WiFi.status() == WL_CONNECTED;
+  if (up && !wifiUp) Serial.printf("Log files at http://%s/\r\n", WiFi.localIP().toString().c_str());
+  wifiUp = up;
+  if (up) server.handleClient();
+}
+
+//////////////
+
+bool LogServer::sendChunk(const uint8_t *data, size_t len) {
+  server.sendContent((const char *)data, len);
+  sentBytes += len;
+  return server.client().connected();
+}
+
+//////////////
+
+void LogServer::handleList() {
+  if (!ready()) {
+    server.send(503, "text/plain", "No SD card\r\n");
+    return;
+  }
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/html", "");
+  server.sendContent("<html><body><table>\r\n");
+  File root = fs->open("/");
+  char row[3*LOG_PATH_LEN + 64];
+  for (File file = root.openNextFile(); file; file = root.openNextFile()) {
+    if (!file.isDirectory()) {
+      snprintf(row, sizeof(row), "<tr><td><a href=\"/file?name=%s\">%s</a></td><td align=right>%lu</td></tr>\r\n",
+               file.path(), file.name(), (unsigned long)file.size());
+      server.sendContent(row);
+    }
+    file.close();
+  }
+  root.close();
+  server.sendContent("</table></body></html>\r\n");
+  server.sendContent("");   // the last chunk
+}
+
+//////////////
+
+void LogServer::handleFile() {
+  String name = server.arg("name");
+  if (!ready()) {
+    server.send(503, "text/plain", "No SD card\r\n");
+    return;
+  }
+  if (!name.startsWith("/") || name.indexOf("..") >= 0 || name.length() >= LOG_PATH_LEN) {
+    server.send(400, "text/plain", "Bad file name\r\n");
+    return;
+  }
+  uint32_t from = 0, to = UINT32_MAX;
+  bool ranged = false, bad = false;
+  const char *names[2] = { "from", "to" };
+  uint32_t *times[2] = { &from, &to };
+  for (int i = 0; i < 2; i++) {
+    if (!server.hasArg(names[i])) continue;
+    String arg = server.arg(names[i]);
+    ranged = true;
+    if (!parseTime(arg.c_str(), arg.c_str() + arg.length(), *times[i])) bad = true;
+  }
+  if (bad) {
+    server.send(400, "text/plain", "Bad time range\r\n");
+    return;
+  }
+  File file = fs->open(name.c_str(), FILE_READ);
+  if (!file || file.isDirectory()) {
+    server.send(404, "text/plain", "No such file\r\n");
+    return;
+  }
+  bool binary = name.endsWith(".bin");
+  server.sendHeader("Content-Disposition", String("attachment; filename=\"") + (name.c_str() + 1) + "\"");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, binary ? "application/octet-stream" : name.endsWith(".csv") ? "text/csv" : "text/plain", "");
+  //
+  uint32_t lostBefore = lost();
+  uint32_t startMs = millis();
+  sentBytes = 0;
+  bool ok = binary ? sendBinary(file, from, to) : ranged ? sendTextRange(file, from, to) : sendText(file);
+  file.close();
+  if (ok) server.sendContent("");   // the last chunk
+  //
+  uint32_t ms = millis() - startMs;
+  uint32_t kbps = ms ? (uint32_t)((uint64_t)sentBytes * 1000 / 1024 / ms) : 0;
+  uint32_t lostNow = lost() - lostBefore;
+  downloads++;
+  if (!ok) aborted++;
+  totalBytes += sentBytes;
+  totalMs += ms;
+  if (kbps > peakKBps) peakKBps = kbps;
+  lostMeanwhile += lostNow;
+  Serial.printf("HTTP %s%s: %lu bytes in %lu ms (%lu KB/s), %lu samples lost meanwhile\r\n", name.c_str(),
+                ok ? "" : " (aborted)", (unsigned long)sentBytes, (unsigned long)ms, (unsigned long)kbps,
+                (unsigned long)lostNow);
+}
+
+//////////////
+
+bool LogServer::sendText(File &file) {
+  // The whole file, up to the end marker
+  for (;;) {
+    if (!ready()) return false;
+    int n = file.read(buffer, HTTP_CHUNK);
+    if (n <= 0) return true;
+    const uint8_t *zero = (const uint8_t *)memchr(buffer, 0, n);
+    if (zero) return zero == buffer || sendChunk(buffer, zero - buffer);
+    if (!sendChunk(buffer, n)) return false;
+  }
+}
+
+//////////////
+
+bool LogServer::lineTime(File &file, uint32_t pos, uint32_t &secs) {
+  // The time of the first line starting after pos; false at the end of the data
+  char line[2*HTTP_LINE_MAX];
+  if (!file.seek(pos)) return false;
+  int n = file.read((uint8_t *)line, sizeof(line));
+  if (n <= 0) return false;
+  const char *eol = (const char *)memchr(line, '\n', n);
+  return eol && parseTime(eol + 1, line + n, secs);
+}
+
+//////////////
+
+bool LogServer::sendTextRange(File &file, uint32_t from, uint32_t to) {
+  // The header line
+  int n = file.read(buffer, HTTP_LINE_MAX);
+  const uint8_t *eol = n > 0 ? (const uint8_t *)memchr(buffer, '\n', n) : nullptr;
+  if (!eol) return true;
+  uint32_t headerLen = eol + 1 - buffer;
+  if (!sendChunk(buffer, headerLen)) return false;
+  //
+  // Bisect for a position before the first line in range, within a chunk of it
+  uint32_t lo = headerLen, hi = file.size(), secs;
+  while (hi - lo > HTTP_CHUNK) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (lineTime(file, mid, secs) && secs < from) lo = mid;
+    else hi = mid;
+  }
+  //
+  // Then the lines in range, copied together in the buffer; a line cut by the end of a chunk
+  // is moved to the front and completed by the next read
+  file.seek(lo);
+  bool skip = lo > headerLen;   // lo is inside a line
+  size_t keep = 0;
+  for (;;) {
+    if (!ready()) return false;
+    n = file.read(buffer + keep, HTTP_CHUNK);
+    if (n <= 0) return true;
+    uint8_t *limit = buffer + keep + n;
+    const uint8_t *zero = (const uint8_t *)memchr(buffer + keep, 0, n);
+    if (zero) limit = (uint8_t *)zero;
+    uint8_t *line = buffer, *out = buffer;
+    bool done = zero != nullptr;
+    uint8_t *end;
+    while ((end = (uint8_t *)memchr(line, '\n', limit - line)) != nullptr) {
+      size_t len = end + 1 - line;
+      if (skip) {
+        skip = false;
+      } else if (parseTime((const char *)line, (const char *)end, secs)) {
+        if (secs > to) {
+          done = true;
+          break;
+        }
+        if (secs >= from) {
+          memmove(out, line, len);
+          out += len;
+        }
+      }
+      line = end + 1;
+    }
+    if (out > buffer && !sendChunk(buffer, out - buffer)) return false;
+    if (done) return true;
+    keep = limit - line;
+    if (keep > HTTP_LINE_MAX) {   // not a log line
+      keep = 0;
+      skip = true;
+    }
+    memmove(buffer, line, keep);
+  }
+}
+
+//////////////
+
+bool LogServer::blockTime(File &file, uint32_t block, uint32_t &secs) {
+  // The time of the first record of a data block; false if it is not one (the end marker)
+  uint8_t header[16];
+  if (!file.seek(block * BINLOG_BLOCK_SIZE) || file.read(header, sizeof(header)) != sizeof(header)) return false;
+  uint16_t magic = header[0] | header[1] << 8;
+  if (magic != BINLOG_BLOCK_MAGIC && magic != BINLOG_DELTA_MAGIC) return false;
+  uint64_t us = 0;
+  for (int i = 7; i >= 0; i--) us = us << 8 | header[8 + i];
+  secs = (uint32_t)(us / 1000000);
+  return true;
+}
+
+//////////////
+
+bool LogServer::sendBinary(File &file, uint32_t from, uint32_t to) {
+  // The file header block
+  if (file.read(buffer, BINLOG_BLOCK_SIZE) != BINLOG_BLOCK_SIZE) return true;
+  if (!sendChunk(buffer, BINLOG_BLOCK_SIZE)) return false;
+  //
+  // Bisect for the last block starting before from: it may hold the first records in range
+  uint32_t lo = 1, hi = file.size() / BINLOG_BLOCK_SIZE, secs;
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (blockTime(file, mid, secs) && secs < from) lo = mid;
+    else hi = mid;
+  }
+  //
+  // Then the blocks, up to the first one starting after to, or the end marker
+  file.seek(lo * BINLOG_BLOCK_SIZE);
+  for (;;) {
+    if (!ready()) return false;
+    int n = file.read(buffer, HTTP_CHUNK);
+    if (n < BINLOG_BLOCK_SIZE) return true;
+    int len = 0;
+    bool done = false;
+    for (; len + BINLOG_BLOCK_SIZE <= n; len += BINLOG_BLOCK_SIZE) {
+      const uint8_t *block = buffer + len;
+      uint16_t magic = block[0] | block[1] << 8;
+      uint64_t us = 0;
+      for (int i = 7; i >= 0; i--) us = us << 8 | block[8 + i];
+      if ((magic != BINLOG_BLOCK_MAGIC && magic != BINLOG_DELTA_MAGIC) || us / 1000000 > to) {
+        done = true;
+        break;
+      }
+    }
+    if (len && !sendChunk(buffer, len)) return false;
+    if (done) return true;
+  }
+}
+
+//////////////
+
+void LogServer::printStats(Print &out) const {
+  out.printf("HTTP: %lu downloads (%lu aborted), %lu KB, avg %lu KB/s, peak %lu KB/s, %lu samples lost meanwhile\r\n",
+             (unsigned long)downloads, (unsigned long)aborted, (unsigned long)(totalBytes / 1024),
+             (unsigned long)(totalMs ? totalBytes * 1000 / 1024 / totalMs : 0), (unsigned long)peakKBps,
+             (unsigned long)lostMeanwhile);
+}
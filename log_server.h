@@ -0,0 +1,67 @@
+/**
+  log_server.h - downloads of the log files over HTTP
+
+  A small web server on the Wi-Fi link:
+
+    GET /                                   the files on the card, with their sizes
+    GET /file?name=/x.txt                   a file
+    GET /file?name=/x.txt&from=2:00:00&to=3:00:00
+                                            the samples from..to of a log or rollup
+                                            [s since boot, or hh:mm:ss, as in the files]
+
+  A time range of a CSV file gives its header line and the lines in range; of
+  a binary log, the file header block and the data blocks that overlap the
+  range (still a valid binary log). The times only grow within a file, so the
+  start of the range is found by bisecting the file, not by reading it all.
+
+  The responses are chunked (HTTP/1.1), read from the card HTTP_CHUNK bytes
+  at a time, so a file of any size takes the same RAM. A log file still being
+  written is sent up to its end marker (see SdLogger::recover()).
+
+  The server runs in a task below the storage task's priority, so a download
+  only gets the time the logging leaves; FatFs serializes the card accesses.
+  Every download is reported on Serial, with its throughput and the samples
+  lost meanwhile.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include <WebServer.h>
+#include "FS.h"
+//
+#define HTTP_PORT      80
+#define HTTP_POLL_MS   50      // how often the server looks for requests [ms]
+#define HTTP_CHUNK     2048    // bytes read from the card, and sent, at a time
+#define HTTP_LINE_MAX  256     // longest line of a CSV file sent by time range
+
+class LogServer {
+public:
+  // ready() tells whether the card is mounted, lost() counts the samples lost since boot
+  void begin(fs::FS &fs, bool (*ready)(), uint32_t (*lost)());
+  void poll();   // answer the waiting requests; blocks while a file is sent
+  //
+  void printStats(Print &out) const;
+
+private:
+  void handleList();
+  void handleFile();
+  bool sendChunk(const uint8_t *data, size_t len);
+  bool sendText(File &file);
+  bool sendTextRange(File &file, uint32_t from, uint32_t to);
+  bool sendBinary(File &file, uint32_t from, uint32_t to);
+  bool lineTime(File &file, uint32_t pos, uint32_t &secs);
+  bool blockTime(File &file, uint32_t block, uint32_t &secs);
+  //
+  WebServer server{HTTP_PORT};
+  fs::FS *fs = nullptr;
+  bool (*ready)() = nullptr;
+  uint32_t (*lost)() = nullptr;
+  bool wifiUp = false;
+  uint8_t buffer[HTTP_CHUNK + HTTP_LINE_MAX];
+  uint32_t sentBytes = 0;       // of the current download
+  //
+  uint32_t downloads = 0, aborted = 0, lostMeanwhile = 0;
+  uint64_t totalBytes = 0, totalMs = 0;
+  uint32_t peakKBps = 0;
+};
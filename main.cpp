@@ -1,454 +1,2405 @@
-/**
-  CYD_BLE_ENERGY_RECORDER
-  Written by Ben Rodanski
-
-  This program periodically reads and records (on a micro SD card) the electric power consumption of an appliance, 
-  connected to an S1B smart programmable socket by Atorch (https://www.aliexpress.com/item/1005004588043273.html).
-  Communication with the S1B socket is via Bluetooth Low Energy (BLE) protocol.
-  Every second the program records the instantaneous voltage [V], current [A], power [W], power factor, energy [kWh], 
-  and frequency [Hz].
-
-  The energy data is extracted from a 36-byte message sent by the S1B socket.
-  A sample message looks like this:
-
-  FF5501010009BC0000990001240000001100006401F402FD002300000A0D3C00000000C1
-
-  According to GitHub (https://github.com/syssi/esphome-atorch-dl24/blob/main/docs/protocol-design.md)
-  the message structure is (the byte values, given below, are taken from the sample message;
-  byte numbering starts from 00):
-  
-    bytes 00-01, FF 55        - magic header
-    byte  02,    01           - message type (01=Report)
-    byte  03,    01           - device type (01=AC meter)
-    bytes 04-06, 00 09 BC     - voltage [V*10]
-    bytes 07-09, 00 00 99     - current [mA*10]
-    bytes 10-12, 00 01 24     - power [W*10]
-    bytes 13-16, 00 00 00 11  - energy [kWh*100]
-    bytes 17-19, 00 00 64     - price [c/kWh]
-    bytes 20-21, 01 F4        - frequency [Hz]
-    bytes 22-23, 02 FD        - power factor*1000
-    bytes 24-25, 00 23        - temperature
-    bytes 26-27, 00 00        - hour
-    byte  28,    0A           - minute
-    byte  29,    0D           - second
-    byte  30,    3C           - backlight time (seconds)
-    byte  31-34, 00 00 00 00  - unspecified
-    byte  35,    C1           - checksum
-  
-  The program was developed using MS Visual Studio Code IDE with PlatformIO (Core 6.1.18) and tested on
-  a Cheap Yellow Display (CYD) ESP32 board (https://randomnerdtutorials.com/cheap-yellow-display-esp32-2432s028r/).
-
-  Version.Revision Status
-  2025-05-07  v1.0  First stable release
-
-*/
-//
-#include <Arduino.h>
-#include <string.h>
-#include "FS.h"
-#include "SD.h"
-#include "BLEDevice.h"
-#include <Adafruit_GFX.h>     // Core graphics library
-#include <TFT_eSPI.h>         // User_Setup.h replaced by Rui Santos' version (https://randomnerdtutorials.com/cheap-yellow-display-esp32-2432s028r/)
-//
-// define SD Card SPI-Pins
-#define SDC_MOSI  23
-#define SDC_MISO  19
-#define SDC_CLK   18
-#define SDC_CS    5
-//
-SPIClass sdc_spi = SPIClass(VSPI);
-String logFile = "/PowerMeterLog.txt";
-bool sdOK = false;
-//
-TFT_eSPI tft = TFT_eSPI();
-//
-// The remote service we wish to connect to.
-static BLEUUID serviceUUID("0000ffe0-0000-1000-8000-00805f9b34fb");
-// The characteristic of the remote service we are interested in.
-static BLEUUID charUUID("0000FFE1-0000-1000-8000-00805F9B34FB");
-//
-static boolean doConnect = false;
-static boolean connected = false;
-static boolean doScan = false;
-static BLERemoteCharacteristic *pRemoteCharacteristic;
-static BLEAdvertisedDevice *myDevice;
-//
-// Energy data
-struct vipe {
-	double volts;		  // voltage
-	double amps;		  // current
-	double watts;		  // power
-	double pf;			  // power factor
-	double kwh=0.0;	  // energy (cummulative)
-	double hz;			  // frequency
-};
-vipe energy;
-//
-uint32_t startTime;
-String errMsg_SDC = "No SD card. Data not logged!",
-       errMsg_BLE = "No BLE connection. No data to display!";
-#define ERR_MSG_Y 28  // vertical position of the error message
-
-//////////////
-
-void writeFile(fs::FS &fs, const char * path, const char * message) {
-	// Write to the SD card (DON'T MODIFY THIS FUNCTION)
-  //
-	Serial.printf("Writing file: %s\n", path);
-
-	File file = fs.open(path, FILE_WRITE);
-	if (!file) {
-		Serial.println("Failed to open file for writing");
-		return;
-	}
-	if (file.print(message)) {
-		Serial.println("File written");
-	} else {
-		Serial.println("Write failed");
-	}
-	file.close();
-}
-
-//////////////
-
-void createFile(fs::FS &fs, const char * path, const char * labels) {
-	// If the log file doesn't exist, create the file on the SD card
-	// and write the data labels as its first record
-	//
-	Serial.printf("Attemptng to open file %s\r\n",path);
-	File file = SD.open(path);
-	if (!file) {
-		Serial.println("File doens't exist");
-		Serial.println("Creating file...");
-		writeFile(SD, path, labels);
-	}
-	else {
-		Serial.printf("File %s already exists. Appending.\r\n",path);  
-	}
-	//
-	file.close();
-}
-
-//////////////
-
-void appendFile(fs::FS &fs, const char * path, const char * message) {
-	// Append data to the SD card (DON'T MODIFY THIS FUNCTION)
-	//
-	Serial.printf("Appending to file: %s\n", path);
-	File file = fs.open(path, FILE_APPEND);
-	if (!file) {
-		Serial.println("Failed to open file for appending");
-		return;
-	}
-	if (file.print(message)) {
-		Serial.println("Message appended");
-	} else {
-		Serial.println("Append failed");
-	}
-	file.close();
-}
-
-//////////////
-
-static void notifyCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify) {
-	uint32_t tmp;
-  //
-  Serial.print("Notify callback for characteristic ");
-  Serial.print(pBLERemoteCharacteristic->getUUID().toString().c_str());
-  Serial.print(" of data length ");
-  Serial.println(length);
-  Serial.print("data: ");
-	for (int i = 0; i<length; i++) {
-	  if (pData[i] < 0x10) {Serial.print("0");}
-	  Serial.print(pData[i], HEX);
-	}
-  Serial.println();
-	//
-	// Now, we need to extract the numerical values from pData
-	tmp = ((uint32_t)pData[4] << 16) |
-		  ((uint32_t)pData[5] << 8)  |
-		  ((uint32_t)pData[6]);
-	energy.volts = 0.1*tmp;
-  Serial.printf("Voltage:   %6.1f V\n",energy.volts);
-	//
-	tmp = ((uint32_t)pData[7] << 16) |
-		  ((uint32_t)pData[8] << 8)  |
-		  ((uint32_t)pData[9]);
-	energy.amps = 0.001*tmp;
-  Serial.printf("Current:   %6.3f A\n",energy.amps);
-	//
-	tmp = ((uint32_t)pData[10] << 16) |
-		  ((uint32_t)pData[11] << 8)  |
-		  ((uint32_t)pData[12]);
-	energy.watts = 0.1*tmp;
-  Serial.printf("Power:     %6.1f W\n",energy.watts);
-	//
-	/*tmp = ((uint32_t)pData[13] << 24) |
-		  ((uint32_t)pData[14] << 16) |
-		  ((uint32_t)pData[15] << 8)  |
-		  ((uint32_t)pData[16]);
-	energy.kwh = 0.01*tmp;*/
-  // The Atorch S1B socket calculates the cumulative energy in kWh.
-  // The accumulation starts after system reset.
-  // This Energy Recorder begins the accumulation of energy value every time
-  // the program starts. Therefore, instead of using the energy sent in a BLE message,
-  // every second we calculate the energy increment (dP = voltage*current [Ws]) 
-  // and convert it to kWh (dividing by 3600000).
-  energy.kwh = energy.kwh + energy.volts*energy.amps/3600000;
-  Serial.printf("Energy:  %8.5f kWh\n",energy.kwh);
-	//
-	tmp = ((uint32_t)pData[20] << 8) |
-		  ((uint32_t)pData[21]);
-	energy.hz = 0.1*tmp;
-  Serial.printf("Frequency:   %4.1f Hz\n",energy.hz);
-	//
-	tmp = ((uint32_t)pData[22] << 8) |
-		  ((uint32_t)pData[23]);
-	energy.pf = 0.001*tmp;
-  Serial.printf("Power Factor: %4.2f\n",energy.pf);
-};
-
-//////////////
-
-class MyClientCallback : public BLEClientCallbacks {
-  void onConnect(BLEClient *pclient) {}
-
-  void onDisconnect(BLEClient *pclient) {
-    connected = false;
-    Serial.println("onDisconnect");
-  }
-};
-
-//////////////
-
-bool connectToServer() {
-  Serial.print("Forming a connection to ");
-  Serial.println(myDevice->getAddress().toString().c_str());
-
-  BLEClient *pClient = BLEDevice::createClient();
-  Serial.println(" - Created client");
-
-  pClient->setClientCallbacks(new MyClientCallback());
-
-  // Connect to the remote BLE Server.
-  pClient->connect(myDevice);  // if you pass BLEAdvertisedDevice instead of address, it will be recognized type of peer device address (public or private)
-  Serial.println(" - Connected to server");
-  pClient->setMTU(517);  // set client to request maximum MTU from server (default is 23 otherwise)
-
-  // Obtain a reference to the service we are after in the remote BLE server.
-  BLERemoteService *pRemoteService = pClient->getService(serviceUUID);
-  if (pRemoteService == nullptr) {
-    Serial.print("Failed to find our service UUID: ");
-    Serial.println(serviceUUID.toString().c_str());
-    pClient->disconnect();
-    return false;
-  }
-  Serial.println(" - Found our service");
-
-  // Obtain a reference to the characteristic in the service of the remote BLE server.
-  pRemoteCharacteristic = pRemoteService->getCharacteristic(charUUID);
-  if (pRemoteCharacteristic == nullptr) {
-    Serial.print("Failed to find our characteristic UUID: ");
-    Serial.println(charUUID.toString().c_str());
-    pClient->disconnect();
-    return false;
-  }
-  Serial.println(" - Found our characteristic");
-  //
-  // Read the value of the characteristic.
-  if (pRemoteCharacteristic->canRead()) {
-    std::string value = pRemoteCharacteristic->readValue();
-    Serial.print("The characteristic value was: ");
-    Serial.println(value.c_str());
-  }
-  //
-  if (pRemoteCharacteristic->canNotify()) {
-    pRemoteCharacteristic->registerForNotify(notifyCallback);
-  }
-  //
-  connected = true;
-  return true;
-}
-
-//////////////
-
-class MyAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks {
-  /**
-  * Scan for BLE servers and find the first one that advertises the service we are looking for.
-  * 
-  * Called for each advertising BLE server.
-  */
-  void onResult(BLEAdvertisedDevice advertisedDevice) {
-    Serial.print("BLE Advertised Device found: ");
-    Serial.println(advertisedDevice.toString().c_str());
-
-    // We have found a device, let us now see if it contains the service we are looking for.
-    if (advertisedDevice.haveServiceUUID() && advertisedDevice.isAdvertisingService(serviceUUID)) {
-
-      BLEDevice::getScan()->stop();
-      myDevice = new BLEAdvertisedDevice(advertisedDevice);
-      doConnect = true;
-      doScan = true;
-    } // Found our server
-  } // onResult
-};// MyAdvertisedDeviceCallbacks
-
-//////////////
-
-String hms0(int x) {
-	// Returns a 2-digit number with a leading zero if x < 10
-	//
-	String s = String(x);
-	if (x < 10) s = "0" + s;
-	//
-	return s;
-};
-
-//////////////
-
-String secs2hhmmss(uint32_t secs){
-  // Convert the running time from seconds to a string "hh:mm:ss"
-  //
-  int hh,mm,ss;
-  //
-  hh = secs/3600;
-  mm = (secs - hh*3600)/60;
-  ss = secs - hh*3600 - mm*60;
-  return (hms0(hh) + ":" + hms0(mm) + ":" + hms0(ss));
-};
-
-//////////////
-
-void setup() {
-  Serial.begin(115200);
-  Serial.println("Starting Arduino BLE Client application...");
-  //
-  // Initialize TFT
-  tft.init();
-  tft.setRotation(1);   // 1 and 3 are landscape
-  //
-  // Clear the display
-  tft.fillScreen(TFT_BLACK);
-  //
-  // Display the program name and version
-  tft.setTextColor(TFT_ORANGE, TFT_BLACK);
-  tft.drawString("ENERGY RECORDER  v1.0", 0, 0, 4);
-	//
-	// Mount the SD card
-	sdc_spi.begin(SDC_CLK, SDC_MISO, SDC_MOSI, SDC_CS);
-	if (!SD.begin(SDC_CS,sdc_spi,4000000,"/sd",5,true)){
-		Serial.println("SD Card Mount Failed");
-    tft.setTextColor(TFT_RED, TFT_BLACK);
-    tft.drawString(errMsg_SDC, 0, ERR_MSG_Y, 2);
-		sdOK = false;
-	} else {
-		Serial.println("SD Card Mounted");
-		writeFile(SD, logFile.c_str(), "Time [s], Voltage [V], Current [A], Power [W], Power Factor, Energy [kWh], Frequency [Hz]\r\n");
-		sdOK = true;
-	}
-  tft.setTextColor(TFT_GREENYELLOW, TFT_BLACK);
-  //
-  // Initiate a BLE connection
-  BLEDevice::init("");
-  //
-  // Retrieve a Scanner and set the callback we want to use to be informed when we
-  // have detected a new device. Specify that we want active scanning and start the
-  // scan to run for 5 seconds.
-  BLEScan *pBLEScan = BLEDevice::getScan();
-  pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
-  pBLEScan->setInterval(1349);
-  pBLEScan->setWindow(449);
-  pBLEScan->setActiveScan(true);
-  pBLEScan->start(5, false);
-  //
-  // Record the start time
-  startTime = millis();
-}  // End of setup.
-
-//////////////
-
-void loop() {
-  //
-  uint32_t newSecs;
-  char buffer[16];
-  String hms, newMillis, newValue, vol, cur, pow, ene, pfa, fre;
-  //
-  // Perform the calculations every second
-  uint32_t currentTime = millis();
-  if (currentTime > startTime + 999) {
-    startTime = currentTime;
-    //
-    // If the flag "doConnect" is true then we have scanned for and found the desired
-    // BLE Server with which we wish to connect.  Now we connect to it.  Once we are
-    // connected we set the connected flag to be true.
-    if (doConnect == true) {
-      if (connectToServer()) {
-        Serial.println("We are now connected to the BLE Server.");
-      } else {
-        Serial.println("We have failed to connect to the server; there is nothing more we will do.");
-      }
-      doConnect = false;
-    }
-    //
-    // If we are connected to a peer BLE Server, update the characteristic each time we are reached
-    // with the current time since boot.
-    if (connected) {
-      newSecs = startTime/1000;
-      newValue = "Time since boot: " + String(newSecs);
-      Serial.println("Setting new characteristic value to \"" + newValue + "\"");
-
-      // Set the characteristic's value to be the array of bytes that is actually a string.
-      pRemoteCharacteristic->writeValue(newValue.c_str(), newValue.length());
-    } else if (doScan) {
-      BLEDevice::getScan()->start(0);  // this is just example to start scan after disconnect, most likely there is better way to do it in arduino
-    }
-    //
-    // Only if we are connected
-    if (connected) {
-      //
-      // Display the energy data
-      vol = String(energy.volts,1);
-      cur = String(energy.amps,3);
-      pow = String(energy.watts,1);
-      ene = String(energy.kwh,5);
-      pfa = String(energy.pf,2);
-      fre = String(energy.hz,1);
-      hms = secs2hhmmss(newSecs);
-      //
-      //
-      tft.setTextColor(TFT_GREENYELLOW, TFT_BLACK);
-      tft.drawString("Run Time:", 0, 50, 4); tft.drawString(hms, 120, 50, 4);
-			tft.drawString("Voltage:", 0, 76, 4); tft.drawString(vol + " V", 120, 76, 4);
-      dtostrf(energy.amps, 6, 3, buffer);   // dtostrf() is used to format a floating point number
-			tft.drawString("Current:", 0, 102, 4); tft.drawString(String(buffer) + " A  ", 120, 102, 4);
-      dtostrf(energy.watts, 6, 1, buffer);
-			tft.drawString("Power:", 0, 128, 4); tft.drawString(String(buffer) + " W   ", 120, 128, 4);
-			tft.drawString("PF:", 0, 154, 4); tft.drawString(pfa, 120, 154, 4);
-      dtostrf(energy.kwh, 8, 5, buffer);
-			tft.drawString("Energy:", 0, 180, 4); tft.drawString(String(buffer) + " kWh   ", 120, 180,4);
-			tft.drawString("Frequency: " + fre + " Hz", 0, 206, 4);
-      //
-      if (sdOK) {
-        //
-        // Write the energy data to a log file
-        newValue = hms + "," + vol + "," + cur + "," + pow + "," + pfa+ "," + ene  + "," + fre + "\r\n";
-        appendFile(SD, logFile.c_str(), newValue.c_str());         
-        Serial.print(newValue);
-      } else {
-      //
-      // Display the SD card error message
-      tft.setTextColor(TFT_RED, TFT_BLACK);
-        tft.drawString(errMsg_SDC, 0, ERR_MSG_Y, 2);
-      }
-    } else {
-      //
-      // Display the BLE error message
-      Serial.println(errMsg_BLE);
-      tft.setTextColor(TFT_RED, TFT_BLACK);
-      tft.drawString(errMsg_BLE, 0, ERR_MSG_Y, 2);
-    }
-  }
-  //
-};// End of loop
- 
\ No newline at end of file
+/**
+  CYD_BLE_ENERGY_RECORDER
+  Written by Ben Rodanski
+
+  This program periodically reads and records (on a micro SD card) the electric power consumption of an appliance, 
+  connected to an S1B smart programmable socket by Atorch (https://www.aliexpress.com/item/1005004588043273.html).
+  Communication with the S1B socket is via Bluetooth Low Energy (BLE) protocol.
+  Every second the program records the instantaneous voltage [V], current [A], power [W], power factor, energy [kWh], 
+  and frequency [Hz].
+
+  The energy data is extracted from a 36-byte message sent by the S1B socket.
+  A sample message looks like this:
+
+  FF5501010009BC0000990001240000001100006401F402FD002300000A0D3C00000000C1
+
+  According to GitHub (https://github.com/syssi/esphome-atorch-dl24/blob/main/docs/protocol-design.md)
+  the message structure is (the byte values, given below, are taken from the sample message;
+  byte numbering starts from 00):
+  
+    bytes 00-01, FF 55        - magic header
+    byte  02,    01           - message type (01=Report)
+    byte  03,    01           - device type (01=AC meter)
+    bytes 04-06, 00 09 BC     - voltage [V*10]
+    bytes 07-09, 00 00 99     - current [mA*10]
+    bytes 10-12, 00 01 24     - power [W*10]
+    bytes 13-16, 00 00 00 11  - energy [kWh*100]
+    bytes 17-19, 00 00 64     - price [c/kWh]
+    bytes 20-21, 01 F4        - frequency [Hz]
+    bytes 22-23, 02 FD        - power factor*1000
+    bytes 24-25, 00 23        - temperature
+    bytes 26-27, 00 00        - hour
+    byte  28,    0A           - minute
+    byte  29,    0D           - second
+    byte  30,    3C           - backlight time (seconds)
+    byte  31-34, 00 00 00 00  - unspecified
+    byte  35,    C1           - checksum
+  
+  The program was developed using MS Visual Studio Code IDE with PlatformIO (Core 6.1.18) and tested on
+  a Cheap Yellow Display (CYD) ESP32 board (https://randomnerdtutorials.com/cheap-yellow-display-esp32-2432s028r/).
+
+  Version.Revision Status
+  2025-05-07  v1.0  First stable release
+
+*/
+//
+#include <Arduino.h>
+#include <string.h>
+#include <time.h>
+#include "FS.h"
+#include "SD.h"
+#include "BLEDevice.h"
+#include <Preferences.h>
+#include "esp_system.h"
+#include "esp_timer.h"
+#include <Adafruit_GFX.h>     // Core graphics library
+#include <TFT_eSPI.h>         // User_Setup.h replaced by Rui Santos' version (https://randomnerdtutorials.com/cheap-yellow-display-esp32-2432s028r/)
+#include "sd_logger.h"
+#include "sample.h"
+#include "spsc_queue.h"
+#include "atorch.h"
+#include "log_level.h"
+#include "display.h"
+#include "format.h"
+#include "format_bench.h"
+#include "energy.h"
+#include "tasks.h"
+#include "link_state.h"
+#include "binlog.h"
+#include "rollup.h"
+#include "trend.h"
+#include "perf.h"
+#include "capture.h"
+#include "spool.h"
+#include "log_index.h"
+#include "checkpoint.h"
+#include "power.h"
+#include "sink.h"
+#include "config.h"
+#include "command_queue.h"
+//
+// define SD Card SPI-Pins
+#define SDC_MOSI  23
+#define SDC_MISO  19
+#define SDC_CLK   18
+#define SDC_CS    5
+//
+SPIClass sdc_spi = SPIClass(VSPI);
+Config bootConfig;                    // the settings of this site (config.h), read by setup() only
+const Config &config = bootConfig;    // ... and used everywhere else
+String logFile;                       // config.logPath + "_S<session>-<segment>_<socket address>.txt" (CSV) or ".bin" (binary, see binlog.h)
+SessionIndex logIndex;                // logFile_index.csv: the sessions and their segments (see log_index.h); storage task only
+#define LOG_EXTENT_BYTES   (1UL << 20)   // the log files are preallocated this much at a time [bytes]
+volatile bool sdOK = false;           // the card is mounted and being written; managed by the storage task after setup()
+#define SD_RETRY_MS   5000            // while the card is out, try to mount it this often [ms]
+#define SPOOL_RECORDS        512      // records kept in RAM while the card is out (internal RAM, 24 KB)
+#define SPOOL_RECORDS_PSRAM  32768    // ... with PSRAM (1.5 MB, 9 hours of one socket)
+RecordSpool spool;                    // used by the storage task only
+uint32_t sdOutages = 0, sdRemounts = 0;
+#ifndef LOG_CSV
+#define LOG_CSV     1         // write the CSV log
+#endif
+#ifndef LOG_BINARY
+#define LOG_BINARY  0         // write the binary log (a third to a seventh of the SD traffic of the CSV log)
+#endif
+#ifndef CAPTURE_REPLAY
+#define CAPTURE_REPLAY 1      // the capture and replay modes (Serial commands)
+#endif
+#ifndef NET_EXPORT
+#define NET_EXPORT 0          // stream the samples over Wi-Fi (UDP or MQTT, see net_export.h)
+#endif
+#if NET_EXPORT
+#include "net_export.h"
+#endif
+#ifndef HTTP_SERVER
+#define HTTP_SERVER 0         // serve the log files over Wi-Fi (see log_server.h)
+#endif
+#if HTTP_SERVER
+#include "net_export.h"
+#include "log_server.h"
+#endif
+#ifndef EVENT_CAPTURE
+#define EVENT_CAPTURE 1       // write every frame around a power anomaly to an event file (see event_capture.h)
+#endif
+#if EVENT_CAPTURE
+#include "event_capture.h"
+#endif
+#ifndef HEALTH_LOG
+#define HEALTH_LOG 1          // a health record every minute: heap, stacks, queues (see health.h)
+#endif
+#if HEALTH_LOG
+#include "health.h"
+#endif
+#ifndef LOG_ROLLUPS
+#define LOG_ROLLUPS 1         // write the minute and hour summaries (logFile_S<session>_<tag>_1m.csv, _1h.csv)
+#endif
+#ifndef LOG_BINARY_ENCODING
+#define LOG_BINARY_ENCODING BINLOG_DELTA   // or BINLOG_FIXED (see binlog.h)
+#endif
+// The sinks the ingest task hands every record to (see sink.h); a sink set to 0 is not built at all
+#ifndef SINK_SD
+#define SINK_SD (LOG_CSV || LOG_BINARY || LOG_ROLLUPS)   // the storage task: the logs and rollups on the card
+#endif
+#ifndef SINK_DISPLAY
+#define SINK_DISPLAY 1        // the ui task and its views (0 for a logger without a screen to watch: no ui task at all)
+#endif
+#ifndef SINK_SERIAL
+#define SINK_SERIAL 0         // CSV lines on Serial, "<tag>,<line of the CSV log>"
+#endif
+#define SINK_SERIAL_LINES 8   // ... written SINK_SERIAL_LINES at a time
+#define SINK_SERIAL_MS    2000   // ... or when the oldest has waited this long [ms]
+#define LOG_STATS_MS 60000    // how often the statistics are printed [ms]
+uint32_t statsTime;
+//
+TFT_eSPI tft = TFT_eSPI();
+Dashboard dashboard(tft);
+#define DISPLAY_CYCLE_S 5     // with several sockets, how long each one is shown [s]
+#define VIEW_Y      50        // top of the area shared by the views
+#ifndef TREND_VIEW
+#define TREND_VIEW  SINK_DISPLAY   // the trend chart view
+#endif
+#if TREND_VIEW
+TrendChart trend(tft);
+#endif
+#ifndef HISTORY_VIEW
+#define HISTORY_VIEW (SINK_DISPLAY && (LOG_CSV || LOG_ROLLUPS))   // the history of the logged power, scrolled on the touch panel
+#endif
+#if HISTORY_VIEW
+#include "history.h"
+#include "touch.h"
+HistoryView history(tft);     // used by the ui task only
+TouchPanel touch;
+#define TOUCH_REPEAT_MS 300   // a press within this time of the last one is the same touch (bounces) [ms]
+static volatile bool touched = false;
+#endif
+// The BOOT button of the CYD shows the next view: the dashboard, the trend chart, the history, the status page.
+// When the backlight has been dimmed (power.h), a press (or touch) lights it up again.
+#define VIEW_BUTTON 0
+enum View { VIEW_DASHBOARD, VIEW_TREND, VIEW_HISTORY, VIEW_STATUS, VIEW_COUNT };
+static volatile bool viewPressed = false;
+static void IRAM_ATTR onViewButton() { viewPressed = true; }
+//
+// The remote service we wish to connect to.
+static BLEUUID serviceUUID("0000ffe0-0000-1000-8000-00805f9b34fb");
+// The characteristic of the remote service we are interested in.
+static BLEUUID charUUID("0000FFE1-0000-1000-8000-00805F9B34FB");
+//
+// Device table: one entry per S1B socket, filled in the order the sockets are found.
+// The ESP32 BLE controller supports up to 3 simultaneous central connections by default.
+#define MAX_SOCKETS   3
+#define SCAN_SECONDS  5       // length of one scan [s]
+#define SCAN_PERIOD_MS 30000  // while the table has room, look for more sockets this often [ms]
+struct Socket {
+  bool used;                                // entry assigned to a device
+  uint8_t address[6];
+  uint8_t addressType;                      // public or random (esp_ble_addr_type_t)
+  char tag[13];                             // address as 12 hex digits (file name, display)
+  bool direct;                              // try the address cached in NVS before scanning
+  bool saved;                               // address is stored in NVS
+  BLEAdvertisedDevice *device;              // last advertisement seen, used to connect
+  BLEClient *client;                        // created once, reused for every reconnection
+  BLERemoteCharacteristic *characteristic;
+  AtorchCommandQueue commands;              // control frames waiting to be written to the socket
+  LinkMonitor link;                         // connection state, driven by loop() only
+  volatile bool advertised;                 // set by onResult() while the link is SCANNING
+  volatile bool dropped;                    // set by onDisconnect()
+  volatile bool connected;                  // subscribed; read by all the tasks
+  // used by notifyCallback() (BLE task) only
+  AtorchAssembler assembler;                // joins and verifies the notifications
+  volatile uint32_t frameSeq;
+  volatile uint32_t lastFrameMs;            // millis() of the last valid frame
+  uint32_t notifications;
+#if EVENT_CAPTURE
+  EventDetector detector;                   // power anomalies
+#endif
+  // used by the ingest task only
+  uint32_t lastSeq;                         // last frame processed
+  uint32_t framesLost;                      // frames missing from the sequence
+  EnergyIntegrator integrator;              // energy (cummulative)
+  // used by the storage task only
+  SdLogger logger;                          // buffered writer for the CSV log (logPath)
+  bool logTried;
+  uint16_t segment;                         // of the logs in this session
+  uint32_t segmentEndS;                     // when the next segment starts [s since boot]
+  uint32_t stored;                          // records stored; every config.decimation-th is logged
+  String logPath, binPath;
+#if LOG_BINARY
+  SdLogger binLogger;                       // ... and for the binary log (binPath)
+  BinlogEncoder encoder;                    // the binary block being filled
+  uint32_t blockMs;                         // millis() when its first record was added
+  uint32_t csvBytes;                        // size of the same records as CSV (compression statistics)
+  uint32_t encodeUsMax, encodeUsTotal;      // time spent in encoder.add() [us]
+#endif
+#if LOG_ROLLUPS
+  RollupTier minutes{ROLLUP_MINUTE_S};      // summaries for logFile_S<session>_<tag>_1m.csv
+  RollupTier hours{ROLLUP_HOUR_S};          // ... and logFile_S<session>_<tag>_1h.csv
+#endif
+#if HISTORY_VIEW
+  HistoryIndex historyIndex[HISTORY_TIERS]; // of the CSV log and the rollups: added to by the storage task, read by the ui task
+#endif
+  // used by loop() only
+  uint32_t seenSeq;                         // frameSeq when loop() last looked
+  uint32_t lastNotifications;               // (statistics)
+};
+Socket sockets[MAX_SOCKETS];
+static volatile boolean scanning = false;    // a non-blocking scan is running
+//
+// The addresses of the sockets are kept in NVS, so that after a reboot they are
+// connected to directly, without waiting for a scan
+Preferences prefs;
+#define PREFS_NAMESPACE "recorder"
+EnergyCheckpoint checkpoint;   // the energy totals across resets: RTC memory on every sample, NVS from loop()
+#if MAX_SOCKETS > CHECKPOINT_SLOTS
+#error "CHECKPOINT_SLOTS must be at least MAX_SOCKETS"
+#endif
+uint32_t firstLoggedMs = 0;                  // millis() when the first record was logged
+static volatile boolean scanEnded = false;   // set when a scan ran its full time without being stopped
+static TaskHandle_t loopHandle = NULL;       // loop() sleeps until an event or its next timer
+#define LOOP_MIN_MS   10   // shortest wait of loop(), so that the lower priority tasks run [ms]
+uint32_t loopWakeups = 0, lastLoopWakeups = 0;
+static const uint8_t socketBacklights[] = { 60, 15, 0 };   // backlight times of the sockets (Serial 'b') [s]
+static uint8_t backlightIndex = 0;
+int powerRequested = POWER_MODE;             // the power mode asked for (Serial 'w'); see powerMode() for the one in effect
+uint32_t scanTime = 0;
+//
+// The pipeline (see tasks.h). Every queue has exactly one producer and one consumer task.
+#define SAMPLE_QUEUE_SIZE  32  // frames decoded by notifyCallback(), waiting for the ingest task
+#define STORAGE_QUEUE_SIZE 64  // records waiting for the storage task (long SD stalls)
+#define UI_QUEUE_SIZE      8   // records waiting for the ui task (only the latest of each socket is shown)
+#define NET_QUEUE_SIZE     32  // records waiting for the net task (it keeps its own backlog)
+typedef SpscQueue<Sample, SAMPLE_QUEUE_SIZE> SampleQueue;
+SampleQueue sampleQueue;
+SpscQueue<Record, STORAGE_QUEUE_SIZE> storageQueue;
+SpscQueue<Record, UI_QUEUE_SIZE> uiQueue;
+#if NET_EXPORT
+SpscQueue<Record, NET_QUEUE_SIZE> netQueue;
+NetExport net;   // used by the net task only
+#endif
+#if HTTP_SERVER
+LogServer logServer;   // used by the http task only
+#endif
+#if EVENT_CAPTURE
+#define EVENT_QUEUE_SIZE   16  // frames waiting for the storage task's event recorder
+typedef SpscQueue<EventFrame, EVENT_QUEUE_SIZE> EventQueue;
+EventQueue eventQueue;
+EventRecorder events;  // used by the storage task only
+#endif
+#if HEALTH_LOG
+SpscQueue<HealthRecord, HEALTH_QUEUE_SIZE> healthQueue;   // loop() -> storage task
+HealthMonitor health;  // used by loop() only
+uint32_t healthTime = 0, healthDropped = 0;
+static char healthLine[HEALTH_LINE_LEN];   // used by the storage task only
+#endif
+//
+TaskHandle_t ingestHandle = NULL, storageHandle = NULL;
+TaskStats taskStats[] = {
+  { "ingest",  NULL, INGEST_STACK,  0, 0 },
+  { "storage", NULL, STORAGE_STACK, 0, 0 },
+  { "loop",    NULL, CONFIG_ARDUINO_LOOP_STACK_SIZE, 0, 0 },
+#if SINK_DISPLAY
+  { "ui",      NULL, UI_STACK,      0, 0 },
+#endif
+#if CAPTURE_REPLAY
+  { "replay",  NULL, REPLAY_STACK,  0, 0 },
+#endif
+#if NET_EXPORT
+  { "net",     NULL, NET_STACK,     0, 0 },
+#endif
+#if HTTP_SERVER
+  { "http",    NULL, HTTP_STACK,    0, 0 },
+#endif
+};
+TaskStats &ingestStats = taskStats[0], &storageStats = taskStats[1], &loopStats = taskStats[2];
+#if SINK_DISPLAY
+TaskStats &uiStats = taskStats[3];
+#endif
+#if NET_EXPORT
+TaskStats &netStats = taskStats[sizeof(taskStats)/sizeof(taskStats[0]) - 1 - (HTTP_SERVER ? 1 : 0)];
+#endif
+#if HTTP_SERVER
+TaskStats &httpStats = taskStats[sizeof(taskStats)/sizeof(taskStats[0]) - 1];
+#endif
+//
+// The sinks. consume() runs in the ingest task, so it only hands the record on; each sink batches in its own way.
+#if SINK_SD
+struct StorageSink {   // the SD logger writes whole blocks, and the spool keeps the records while the card is out
+  static const char *name() { return "sd"; }
+  static bool consume(const Record &record) {
+    bool queued = storageQueue.push(record);
+    if (!queued) {   // spooled by the storage task if the card is out
+      PERF_COUNT(PERF_FRAMES_DROPPED);
+    }
+    xTaskNotifyGive(storageHandle);
+    return queued;
+  }
+  static void poll() {}
+};
+#endif
+#if SINK_DISPLAY
+struct DisplaySink {   // the ui task shows the latest record of each socket once a second
+  static const char *name() { return "display"; }
+  static bool consume(const Record &record) { return uiQueue.push(record); }   // if it is behind, it misses a value
+  static void poll() {}
+};
+#endif
+#if NET_EXPORT
+struct NetSink {       // the net task sends NET_BATCH records a packet
+  static const char *name() { return "net"; }
+  static bool consume(const Record &record) { return netQueue.push(record); }
+  static void poll() {}
+};
+#endif
+#if SINK_SERIAL
+struct SerialSink {    // SINK_SERIAL_LINES lines a write, into the Serial TX buffer (see setup())
+  static const char *name() { return "serial"; }
+  static bool consume(const Record &record) {
+    if (size + LINE_LEN > sizeof(buffer)) flush();
+    if (lines == 0) firstMs = millis();
+    char *p = fmtStr(buffer + size, sockets[record.sample.device].tag);
+    *p++ = ',';
+    size = p - buffer;
+    size += formatCsv(buffer + size, (uint32_t)(record.sample.us/1000000), record.sample, record.kwh1e5());
+    if (++lines >= SINK_SERIAL_LINES) flush();
+    return true;
+  }
+  static void poll() {
+    if (lines && millis() - firstMs >= SINK_SERIAL_MS) flush();
+  }
+  static void flush() {
+    Serial.write((const uint8_t *)buffer, size);
+    size = lines = 0;
+  }
+  static const size_t LINE_LEN = sizeof(Socket::tag) + CSV_LINE_LEN;   // the tag and its comma, the line
+  static char buffer[SINK_SERIAL_LINES * LINE_LEN];
+  static size_t size;
+  static uint32_t lines, firstMs;
+};
+char SerialSink::buffer[SINK_SERIAL_LINES * SerialSink::LINE_LEN];
+size_t SerialSink::size = 0;
+uint32_t SerialSink::lines = 0, SerialSink::firstMs = 0;
+#endif
+typedef SinkPipeline<
+#if SINK_SD
+  StorageSink,
+#endif
+#if SINK_DISPLAY
+  DisplaySink,
+#endif
+#if NET_EXPORT
+  NetSink,
+#endif
+#if SINK_SERIAL
+  SerialSink,
+#endif
+  NoSink> Sinks;
+//
+// Capture and replay (see capture.h), for testing without the socket. Serial commands:
+// 'c' starts or stops capturing the frames received, 'y' replays CAPTURE_FILE, 'g' replays
+// a synthetic load into every socket slot (not while any socket is known), 'x' stops the
+// replay, '+' and '-' change the replay speed. The replay task has queues of its own, like
+// the BLE task, so that every queue keeps one producer. When a replay is over, the ingest
+// task and then the storage task clear what it left in its slots, and only then are the
+// slots free for a socket or the next replay.
+#if CAPTURE_REPLAY
+#define CAPTURE_FILE       "/capture.txt"
+#define CAPTURE_QUEUE_SIZE 16
+struct CapturedFrame {
+  int64_t us;
+  uint8_t device;
+  uint8_t frame[ATORCH_FRAME_LEN];
+};
+SpscQueue<CapturedFrame, CAPTURE_QUEUE_SIZE> captureQueue;   // BLE task -> storage task
+static volatile bool capturing = false;
+SdLogger captureLogger;                                       // used by the storage task only
+SampleQueue replaySampleQueue;                                // replay task -> ingest task
+#if EVENT_CAPTURE
+EventQueue replayEventQueue;                                  // replay task -> storage task
+#endif
+enum ReplaySource { REPLAY_OFF, REPLAY_FILE, REPLAY_SYNTHETIC };
+#define REPLAY_ALL_SLOTS 0xFF
+static volatile int replaySource = REPLAY_OFF;
+static volatile uint32_t replayGeneration = 0;                // every start and stop takes the next: a replay runs while it is current
+static portMUX_TYPE replayLock = portMUX_INITIALIZER_UNLOCKED;   // replaySource, replayGeneration, replayDevice and the slot masks together
+static const uint8_t replaySpeeds[] = { 1, 2, 5, 10, 20, 50, 100 };   // times real time
+static volatile uint8_t replaySpeed = 0;                      // index into replaySpeeds
+static volatile uint8_t replayDevice = REPLAY_ALL_SLOTS;       // the socket slot the replay feeds, or all of them
+static volatile uint8_t replaySlots = 0;                      // bit per slot: given to the replay, until cleared after it
+static volatile uint8_t replayClearIngest = 0;                // ... the replay is over: for the ingest task to clear
+static volatile uint8_t replayClearStorage = 0;               // ... then for the storage task
+#if HEALTH_LOG
+#define SOAK_DEVICE (MAX_SOCKETS - 1)                         // ... during a soak (see health.h)
+uint32_t soakDropTime = 0;
+#endif
+TaskStats &replayStats = taskStats[SINK_DISPLAY ? 4 : 3];
+#endif
+//
+String errMsg_BLE = "No BLE connection. No data to display!";
+#define ERR_MSG_Y 28  // vertical position of the error message
+#define STATUS_Y  232 // vertical position of the status line (below the Frequency field, font 1)
+
+//////////////
+
+bool anyConnected() {
+  // A replay counts as a connection, so that the whole pipeline runs
+#if CAPTURE_REPLAY
+  if (replaySource != REPLAY_OFF) return true;
+#endif
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    if (sockets[i].connected) return true;
+  }
+  return false;
+}
+
+//////////////
+
+static bool givenToReplay(const Socket &socket) {
+  // This socket slot belongs to a replay, from its start until its state is cleared after it
+#if CAPTURE_REPLAY
+  return replaySlots & (1 << (&socket - sockets));
+#else
+  return false;
+#endif
+}
+
+//////////////
+
+static bool replaying(const Socket &socket) {
+  // The samples of this socket slot come from a replay, not a socket
+#if CAPTURE_REPLAY
+  return replaySource != REPLAY_OFF && givenToReplay(socket);
+#else
+  return false;
+#endif
+}
+
+//////////////
+
+static bool receiving(const Socket &socket) {
+  // More samples may be coming for this socket
+  return replaying(socket) || socket.connected;
+}
+
+//////////////
+
+void writeFile(fs::FS &fs, const char * path, const char * message) {
+	// Write to the SD card (DON'T MODIFY THIS FUNCTION)
+  //
+	Serial.printf("Writing file: %s\n", path);
+
+	File file = fs.open(path, FILE_WRITE);
+	if (!file) {
+		Serial.println("Failed to open file for writing");
+		return;
+	}
+	if (file.print(message)) {
+		Serial.println("File written");
+	} else {
+		Serial.println("Write failed");
+	}
+	file.close();
+}
+
+//////////////
+
+void createFile(fs::FS &fs, const char * path, const char * labels) {
+	// If the log file doesn't exist, create the file on the SD card
+	// and write the data labels as its first record
+	//
+	Serial.printf("Attemptng to open file %s\r\n",path);
+	File file = SD.open(path);
+	if (!file) {
+		Serial.println("File doens't exist");
+		Serial.println("Creating file...");
+		writeFile(SD, path, labels);
+	}
+	else {
+		Serial.printf("File %s already exists. Appending.\r\n",path);  
+	}
+	//
+	file.close();
+}
+
+//////////////
+
+void appendFile(fs::FS &fs, const char * path, const char * message) {
+	// Append data to the SD card (DON'T MODIFY THIS FUNCTION)
+	//
+	Serial.printf("Appending to file: %s\n", path);
+	File file = fs.open(path, FILE_APPEND);
+	if (!file) {
+		Serial.println("Failed to open file for appending");
+		return;
+	}
+	if (file.print(message)) {
+		Serial.println("Message appended");
+	} else {
+		Serial.println("Append failed");
+	}
+	file.close();
+}
+
+//////////////
+
+static void printFrame(const uint8_t *pData, size_t length) {
+  // Hex dump of a BLE notification, one Serial write per 32 bytes (LOG_DEBUG only)
+  //
+  static const char hexDigit[] = "0123456789ABCDEF";
+  char line[2*32 + 1];
+  //
+  Serial.printf("Notification of data length %u\r\ndata: ", (unsigned)length);
+  for (size_t i = 0; i < length; i += 32) {
+    size_t n = (length - i < 32) ? length - i : 32;
+    for (size_t j = 0; j < n; j++) {
+      line[2*j]     = hexDigit[pData[i + j] >> 4];
+      line[2*j + 1] = hexDigit[pData[i + j] & 0x0F];
+    }
+    Serial.write((const uint8_t *)line, 2*n);
+  }
+  Serial.println();
+}
+
+//////////////
+
+static void handOver(const uint8_t *frame, Socket &socket, bool replayed) {
+  // Decode a report frame into one Sample for the ingest task. The frames of the BLE task and
+  // those of the replay task go through queues of their own, and only the BLE task's are timed.
+  Sample sample;
+  //
+  if (replayed) {
+    atorchDecode(frame, ATORCH_FRAME_LEN, sample);
+  } else {
+    PERF_SCOPE(PERF_DECODE);
+    atorchDecode(frame, ATORCH_FRAME_LEN, sample);
+  }
+  PERF_COUNT(PERF_FRAMES_RECEIVED);
+  sample.us = esp_timer_get_time();
+  sample.seq = socket.frameSeq + 1;
+  socket.lastFrameMs = millis();
+  socket.frameSeq = sample.seq;
+  sample.device = (uint8_t)(&socket - sockets);
+#if CAPTURE_REPLAY
+  if (capturing && !replayed) {
+    // The frame as it was received, for a later replay (a full queue just loses it)
+    CapturedFrame captured;
+    captured.us = sample.us;
+    captured.device = sample.device;
+    memcpy(captured.frame, frame, ATORCH_FRAME_LEN);
+    captureQueue.push(captured);
+  }
+#endif
+#if EVENT_CAPTURE
+  {
+    // Every frame to the event recorder, tagged when the detector fires (a full queue just loses it)
+    EventFrame event;
+    event.us = sample.us;
+    event.device = sample.device;
+    event.meanW10 = socket.detector.meanW10();
+    event.trigger = socket.detector.add(sample);
+    memcpy(event.frame, frame, ATORCH_FRAME_LEN);
+#if CAPTURE_REPLAY
+    (replayed ? replayEventQueue : eventQueue).push(event);
+#else
+    eventQueue.push(event);
+#endif
+  }
+#endif
+  //
+  if (LOG_LEVEL >= LOG_DEBUG) {
+    Serial.printf("Socket:    %s\n",socket.tag);
+    Serial.printf("Voltage:   %6.1f V\n",0.1*sample.volts10);
+    Serial.printf("Current:   %6.3f A\n",0.001*sample.milliamps);
+    Serial.printf("Power:     %6.1f W\n",0.1*sample.watts10);
+    Serial.printf("Frequency:   %4.1f Hz\n",0.1*sample.hz10);
+    Serial.printf("Power Factor: %4.2f\n",0.001*sample.pf1000);
+  }
+  //
+  // Never blocks: if the ingest task has fallen SAMPLE_QUEUE_SIZE frames behind, this one is dropped and counted
+#if CAPTURE_REPLAY
+  SampleQueue &queue = replayed ? replaySampleQueue : sampleQueue;
+#else
+  SampleQueue &queue = sampleQueue;
+#endif
+  if (!queue.push(sample)) {
+    PERF_COUNT(PERF_FRAMES_DROPPED);
+  }
+  if (ingestHandle) xTaskNotifyGive(ingestHandle);
+}
+
+//////////////
+
+static void onFrame(const uint8_t *frame, void *context) {
+  // Called by the assembler, in the BLE task, for every complete report frame
+  handOver(frame, *(Socket *)context, false);
+}
+
+//////////////
+
+static void notifyCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify) {
+  // Runs in the BLE task: reassemble and verify the frame, decode it into one Sample and hand it over to the ingest task.
+  // No heap allocation and, unless LOG_LEVEL is LOG_DEBUG, no Serial output.
+  //
+  if (LOG_LEVEL >= LOG_DEBUG) printFrame(pData, length);
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    Socket &socket = sockets[i];
+    if (socket.characteristic == pBLERemoteCharacteristic) {
+      socket.notifications++;
+      socket.assembler.feed(pData, length, millis(), onFrame, &socket);
+      return;
+    }
+  }
+};
+
+//////////////
+
+static void wakeLoop() {
+  // An event for loop(): from the BLE callbacks and the Serial receive callback
+  if (loopHandle) xTaskNotifyGive(loopHandle);
+}
+
+//////////////
+
+class MyClientCallback : public BLEClientCallbacks {
+  void onConnect(BLEClient *pclient) {}
+
+  void onDisconnect(BLEClient *pclient) {
+    for (int i = 0; i < MAX_SOCKETS; i++) {
+      if (sockets[i].client == pclient) {
+        sockets[i].connected = false;
+        sockets[i].dropped = true;   // loop() tells the link state machine
+        wakeLoop();
+        Serial.printf("onDisconnect %s\r\n", sockets[i].tag);
+      }
+    }
+  }
+};
+MyClientCallback clientCallbacks;   // shared by all the clients
+
+//////////////
+
+bool connectStep(Socket &socket) {
+  // LINK_CONNECTING: open the connection (blocks loop() until connected or timed out)
+  //
+  Serial.print("Forming a connection to ");
+  Serial.println(socket.device->getAddress().toString().c_str());
+
+  if (socket.client == nullptr) {
+    socket.client = BLEDevice::createClient();
+    socket.client->setClientCallbacks(&clientCallbacks);
+    Serial.println(" - Created client");
+  }
+  BLEClient *pClient = socket.client;
+
+  // Connect to the remote BLE Server.
+  if (!pClient->connect(socket.device)) {  // if you pass BLEAdvertisedDevice instead of address, it will be recognized type of peer device address (public or private)
+    Serial.println(" - Connection failed");
+    return false;
+  }
+  Serial.println(" - Connected to server");
+  return true;
+}
+
+//////////////
+
+static uint32_t addressSeed(const uint8_t *a) {
+  // Seed of the backoff jitter: differs between sockets and between boards
+  return ((uint32_t)a[2] << 24 | (uint32_t)a[3] << 16 | (uint32_t)a[4] << 8 | a[5]) ^ (uint32_t)esp_timer_get_time();
+}
+
+//////////////
+
+bool directConnectStep(Socket &socket) {
+  // LINK_CONNECTING with the address from NVS (after a reboot): no advertisement needed.
+  // If the socket is not there, this blocks loop() for the connection timeout once;
+  // after that the socket is found by scanning as usual.
+  //
+  Serial.printf("Forming a direct connection to %s\r\n", socket.tag);
+  socket.direct = false;
+  if (socket.client == nullptr) {
+    socket.client = BLEDevice::createClient();
+    socket.client->setClientCallbacks(&clientCallbacks);
+  }
+  if (!socket.client->connect(BLEAddress(socket.address), (esp_ble_addr_type_t)socket.addressType)) {
+    Serial.println(" - Connection failed, falling back to scanning");
+    return false;
+  }
+  Serial.println(" - Connected to server");
+  return true;
+}
+
+//////////////
+
+void loadSockets() {
+  // Fill the device table with the sockets remembered in NVS
+  //
+  char key[8];
+  prefs.begin(PREFS_NAMESPACE, true);
+  uint8_t n = prefs.getUChar("sockets", 0);
+  for (int i = 0; i < n && i < MAX_SOCKETS; i++) {
+    Socket &socket = sockets[i];
+    sprintf(key, "addr%d", i);
+    if (prefs.getBytes(key, socket.address, 6) != 6) break;
+    if (!config.anySocket && memcmp(socket.address, config.socket, 6) != 0) {
+      // Not the one this site records (config.txt): its slot is left free for that one
+      memset(socket.address, 0, 6);
+      Serial.printf("Socket %d in NVS is not the configured one, skipped\r\n", i + 1);
+      continue;
+    }
+    sprintf(key, "type%d", i);
+    socket.addressType = prefs.getUChar(key, BLE_ADDR_TYPE_PUBLIC);
+    for (int j = 0; j < 6; j++) sprintf(socket.tag + 2*j, "%02X", socket.address[j]);
+    socket.link.begin(addressSeed(socket.address));
+    socket.used = true;
+    socket.direct = true;
+    socket.saved = true;
+    Serial.printf("Socket %d is %s (from NVS)\r\n", i + 1, socket.tag);
+    //
+    // Continue the energy total where it was before the reset, so the log stays continuous
+    socket.integrator.restore(checkpoint.restore(i, socket.address));
+    if (checkpoint.source(i) != CHECKPOINT_NONE) {
+      char text[24];
+      fmtFixed64(text, socket.integrator.kwh1e5(), 5);
+      Serial.printf("  Energy total %s kWh (from %s)\r\n", text, checkpoint.source(i) == CHECKPOINT_RTC ? "RTC memory" : "NVS");
+    }
+  }
+  prefs.end();
+}
+
+//////////////
+
+void saveSocket(Socket &socket) {
+  // Remember a socket that we have subscribed to. Written once per socket, not on every connection.
+  //
+  char key[8];
+  int i = &socket - sockets;
+  prefs.begin(PREFS_NAMESPACE, false);
+  sprintf(key, "addr%d", i);
+  prefs.putBytes(key, socket.address, 6);
+  sprintf(key, "type%d", i);
+  prefs.putUChar(key, socket.addressType);
+  if (prefs.getUChar("sockets", 0) < i + 1) prefs.putUChar("sockets", i + 1);
+  prefs.end();
+  socket.saved = true;
+}
+
+//////////////
+
+bool discoverStep(Socket &socket) {
+  // LINK_DISCOVERING: find our characteristic and subscribe to its notifications
+  //
+  BLEClient *pClient = socket.client;
+  pClient->setMTU(517);  // set client to request maximum MTU from server (default is 23 otherwise)
+
+  // Obtain a reference to the service we are after in the remote BLE server.
+  BLERemoteService *pRemoteService = pClient->getService(serviceUUID);
+  if (pRemoteService == nullptr) {
+    Serial.print("Failed to find our service UUID: ");
+    Serial.println(serviceUUID.toString().c_str());
+    return false;
+  }
+  Serial.println(" - Found our service");
+
+  // Obtain a reference to the characteristic in the service of the remote BLE server.
+  BLERemoteCharacteristic *pRemoteCharacteristic = pRemoteService->getCharacteristic(charUUID);
+  if (pRemoteCharacteristic == nullptr || !pRemoteCharacteristic->canNotify()) {
+    Serial.print("Failed to find our characteristic UUID: ");
+    Serial.println(charUUID.toString().c_str());
+    return false;
+  }
+  Serial.println(" - Found our characteristic");
+  //
+  socket.characteristic = pRemoteCharacteristic;   // tells notifyCallback() which socket a notification came from
+  socket.assembler.reset();   // don't join the first notification to a fragment from the last connection
+  pRemoteCharacteristic->registerForNotify(notifyCallback);
+  return true;
+}
+
+//////////////
+
+void serviceLink(Socket &socket, uint32_t now) {
+  // Called by loop() on every pass: feed the events to the state machine and take the next step.
+  // Only one blocking BLE call is made per pass.
+  //
+  LinkMonitor &link = socket.link;
+  if (socket.dropped) {
+    socket.dropped = false;
+    link.lost(now);
+    if (LOG_LEVEL >= LOG_INFO) Serial.printf("Socket %s: link lost, %s\r\n", socket.tag, link.stateName());
+  }
+  if (socket.frameSeq != socket.seenSeq) {
+    socket.seenSeq = socket.frameSeq;
+    link.frame(socket.lastFrameMs);
+  }
+  link.poll(now);
+  //
+  switch (link.state()) {
+    case LINK_SCANNING:
+      if (socket.advertised || socket.direct) {
+        link.found(now);
+        socket.advertised = false;
+      }
+      break;
+    case LINK_CONNECTING:
+      if (socket.direct ? directConnectStep(socket) : connectStep(socket)) {
+        link.connected(millis());
+      } else {
+        link.failed(millis());
+        Serial.printf("We have failed to connect to socket %s; retrying in %lu ms.\r\n", socket.tag, (unsigned long)link.backoffMs());
+      }
+      break;
+    case LINK_DISCOVERING:
+      if (discoverStep(socket)) {
+        link.subscribed(millis());
+        socket.connected = true;
+        Serial.printf("We are now connected to socket %s.\r\n", socket.tag);
+#if HEALTH_LOG
+        health.connected();
+#endif
+        if (!socket.saved) saveSocket(socket);
+      } else {
+        socket.client->disconnect();
+        link.failed(millis());
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+//////////////
+
+static void scanComplete(BLEScanResults results) {
+  // The scan ran its full time: the sockets still waiting for an advertisement are not around
+  scanning = false;
+  scanEnded = true;
+  wakeLoop();
+}
+
+//////////////
+
+class MyAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks {
+  /**
+  * Scan for BLE servers that advertise the service we are looking for
+  * and assign each of them an entry in the device table.
+  * 
+  * Called for each advertising BLE server.
+  */
+  void onResult(BLEAdvertisedDevice advertisedDevice) {
+    if (LOG_LEVEL >= LOG_INFO) {
+      Serial.print("BLE Advertised Device found: ");
+      Serial.println(advertisedDevice.toString().c_str());
+    }
+
+    // We have found a device, let us now see if it contains the service we are looking for.
+    if (advertisedDevice.haveServiceUUID() && advertisedDevice.isAdvertisingService(serviceUUID)) {
+      BLEAddress bleAddress = advertisedDevice.getAddress();
+      uint8_t address[6];
+      memcpy(address, *bleAddress.getNative(), 6);
+      if (!config.anySocket && memcmp(address, config.socket, 6) != 0) return;   // not the one this site records
+      Socket *socket = nullptr;
+      for (int i = 0; i < MAX_SOCKETS && socket == nullptr; i++) {
+        if (sockets[i].used && memcmp(sockets[i].address, address, 6) == 0) socket = &sockets[i];
+      }
+      for (int i = 0; i < MAX_SOCKETS && socket == nullptr; i++) {
+        if (givenToReplay(sockets[i])) continue;   // fed by the replay, or not cleared yet
+        if (!sockets[i].used) {
+          // A new socket
+          socket = &sockets[i];
+          socket->used = true;
+          memcpy(socket->address, address, 6);
+          socket->addressType = advertisedDevice.getAddressType();
+          for (int j = 0; j < 6; j++) sprintf(socket->tag + 2*j, "%02X", address[j]);
+          socket->link.begin(addressSeed(address));
+          Serial.printf("Socket %d is %s\r\n", i + 1, socket->tag);
+        }
+      }
+      if (socket == nullptr || givenToReplay(*socket)) return;   // table full, or fed by the replay
+      if (socket->link.state() != LINK_SCANNING || socket->advertised || socket->direct) return;   // not waiting
+
+      BLEDevice::getScan()->stop();
+      scanning = false;
+      delete socket->device;
+      socket->device = new BLEAdvertisedDevice(advertisedDevice);
+      socket->advertised = true;   // loop() will connect
+      wakeLoop();
+    } // Found our server
+  } // onResult
+};// MyAdvertisedDeviceCallbacks
+
+//////////////
+
+static void ingest(const Sample &sample, bool replayed) {
+  // The ingest task: integrate the energy of one frame and pass the result on to the sinks
+  //
+  Record record;
+  Socket &socket = sockets[sample.device];
+  if (socket.lastSeq != 0 && sample.seq != socket.lastSeq + 1) socket.framesLost += sample.seq - socket.lastSeq - 1;
+  socket.lastSeq = sample.seq;
+  //
+  // The Atorch S1B socket calculates the cumulative energy in kWh.
+  // The accumulation starts after system reset, and its resolution is only 10 Wh.
+  // This Energy Recorder begins the accumulation of energy value every time
+  // the program starts. Therefore, instead of using the energy sent in a BLE message,
+  // we integrate the reported power over the measured time between frames [mWs].
+  {
+    PERF_SCOPE(PERF_INTEGRATE);
+    socket.integrator.add(sample);
+  }
+  record.sample = sample;
+  record.mWs = socket.integrator.milliwattSeconds();
+  if (!replayed) checkpoint.update(sample.device, socket.address, record.mWs);
+  if (LOG_LEVEL >= LOG_DEBUG) {
+    char text[24];
+    fmtFixed64(text, record.kwh1e5(), 5);
+    Serial.printf("Energy:  %s kWh\n", text);
+  }
+  //
+  Sinks::consume(record);
+}
+
+//////////////
+
+#if CAPTURE_REPLAY
+static void clearReplayedIngest(uint8_t slots) {
+  // The ingest task: the replay is over and its samples are integrated. Start the energy of its
+  // slots from zero again, and hand them on to the storage task.
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    if (!(slots & (1 << i))) continue;
+    sockets[i].integrator.reset();
+    sockets[i].lastSeq = 0;
+    sockets[i].framesLost = 0;
+  }
+  portENTER_CRITICAL(&replayLock);
+  replayClearIngest &= ~slots;
+  replayClearStorage |= slots;
+  portEXIT_CRITICAL(&replayLock);
+  xTaskNotifyGive(storageHandle);
+}
+#endif
+
+//////////////
+
+static void ingestTask(void *parameter) {
+  // Core 0: drain the sample queues of the BLE task and of the replay
+  //
+  Sample sample;
+  //
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));  // woken by notifyCallback() or the replay
+    ingestStats.wake();
+    while (sampleQueue.pop(sample)) ingest(sample, false);
+#if CAPTURE_REPLAY
+    uint8_t clear = replayClearIngest;   // read first: the replay task queued all its samples before
+    while (replaySampleQueue.pop(sample)) ingest(sample, true);
+    if (clear) clearReplayedIngest(clear);
+#endif
+    Sinks::poll();
+    ingestStats.sleep();
+  }
+}
+
+//////////////
+
+#if LOG_BINARY
+static void sealBlock(Socket &socket) {
+  // Queue the binary block being filled, however full it is
+  //
+  if (socket.encoder.empty()) return;
+  const uint8_t *block = socket.encoder.seal();
+  socket.binLogger.logBlock(block, socket.encoder.sealedCount());
+}
+#endif
+
+//////////////
+
+static String sessionPath(const Socket &socket, const char *suffix) {
+  // The files kept for the whole session
+  char name[LOG_PATH_LEN];
+  snprintf(name, sizeof(name), "%s_S%04u_%s%s", logFile.c_str(), (unsigned)logIndex.session(), socket.tag, suffix);
+  return String(name);
+}
+
+//////////////
+
+#if HEALTH_LOG
+static String healthPath() {
+  // The health records of the board, for the whole session
+  char name[LOG_PATH_LEN];
+  snprintf(name, sizeof(name), "%s_S%04u_health.csv", logFile.c_str(), (unsigned)logIndex.session());
+  return String(name);
+}
+#endif
+
+//////////////
+
+static String segmentPath(const Socket &socket, const char *suffix) {
+  // The log files of the current segment, dated once the clock is set
+  //
+  char date[10] = "";
+  time_t now = clockEpoch();
+  if (now) {
+    struct tm t;
+    gmtime_r(&now, &t);
+    snprintf(date, sizeof(date), "_%04d%02d%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
+  }
+  char name[LOG_PATH_LEN];
+  snprintf(name, sizeof(name), "%s%s_S%04u-%03u_%s%s", logFile.c_str(), date, (unsigned)logIndex.session(),
+           (unsigned)socket.segment, socket.tag, suffix);
+  return String(name);
+}
+
+//////////////
+
+static void openSegment(Socket &socket, uint32_t nowS) {
+  // New, preallocated log files, each listed in the index
+  //
+#if LOG_CSV
+  socket.logPath = segmentPath(socket, ".txt");
+  if (socket.logger.begin(SD, socket.logPath.c_str(), LOG_EXTENT_BYTES)) {
+    socket.logger.log("Time [s], Voltage [V], Current [A], Power [W], Power Factor, Energy [kWh], Frequency [Hz]\r\n");
+    logIndex.opened(socket.segment, socket.logPath.c_str(), nowS);
+#if HISTORY_VIEW
+    socket.historyIndex[HISTORY_SECONDS].reset(socket.logPath.c_str(), socket.logger.size());
+#endif
+  }
+#endif
+#if LOG_BINARY
+  // Starting with the header block, so that all the blocks are sector-aligned
+  socket.binPath = segmentPath(socket, ".bin");
+  uint8_t header[BINLOG_BLOCK_SIZE];
+  if (socket.binLogger.begin(SD, socket.binPath.c_str(), LOG_EXTENT_BYTES)) {
+    socket.encoder.setEncoding(LOG_BINARY_ENCODING);
+    BinlogEncoder::header(header, socket.address);
+    socket.binLogger.logBlock(header, 0);
+    logIndex.opened(socket.segment, socket.binPath.c_str(), nowS);
+  }
+#endif
+  // The segment ends after config.segmentS, or at the end of the day when the date is known
+  uint32_t epoch = clockEpoch();
+  socket.segmentEndS = nowS + (epoch ? config.segmentS - epoch % config.segmentS : config.segmentS);
+}
+
+//////////////
+
+static void closeSegment(Socket &socket, uint32_t nowS) {
+  // Write out and close the log files, cut to their data
+  //
+#if LOG_CSV
+  if (socket.logger.isOpen()) {
+    uint32_t bytes = socket.logger.size();
+    socket.logger.end();
+    logIndex.closed(socket.segment, socket.logPath.c_str(), nowS, bytes);
+  }
+#endif
+#if LOG_BINARY
+  if (socket.binLogger.isOpen()) {
+    sealBlock(socket);
+    uint32_t bytes = socket.binLogger.size();
+    socket.binLogger.end();
+    logIndex.closed(socket.segment, socket.binPath.c_str(), nowS, bytes);
+  }
+#endif
+}
+
+//////////////
+
+static void openLog(Socket &socket, uint32_t nowS) {
+  // Called by the storage task when the first record of a socket arrives
+  //
+  socket.logTried = true;
+  socket.segment = 0;
+  openSegment(socket, nowS);
+#if LOG_ROLLUPS
+  // The rollups get a line a minute at most, so they have no SdLogger: each line opens, appends
+  // to and closes its file, which keeps no handle or buffer open and nothing waiting in RAM
+  writeFile(SD, sessionPath(socket, "_1m.csv").c_str(), ROLLUP_CSV_HEADER);
+  writeFile(SD, sessionPath(socket, "_1h.csv").c_str(), ROLLUP_CSV_HEADER);
+#if HISTORY_VIEW
+  socket.historyIndex[HISTORY_MINUTES].reset(sessionPath(socket, "_1m.csv").c_str(), strlen(ROLLUP_CSV_HEADER));
+  socket.historyIndex[HISTORY_HOURS].reset(sessionPath(socket, "_1h.csv").c_str(), strlen(ROLLUP_CSV_HEADER));
+#endif
+#endif
+}
+
+//////////////
+
+#if LOG_ROLLUPS
+static void writeRollup(Socket &socket, const char *suffix, const Rollup &rollup) {
+  // One line per period, so the small summary files are simply appended to
+  //
+  char line[ROLLUP_LINE_LEN];
+  formatRollup(line, rollup);
+  appendFile(SD, sessionPath(socket, suffix).c_str(), line);
+#if HISTORY_VIEW
+  HistoryIndex &index = socket.historyIndex[strcmp(suffix, "_1m.csv") == 0 ? HISTORY_MINUTES : HISTORY_HOURS];
+  index.add((uint32_t)(rollup.startUs/1000000), index.size(), strlen(line));
+#endif
+}
+
+//////////////
+
+static void closeMinute(Socket &socket) {
+  // A minute has ended: write it, and add it to its hour
+  //
+  writeRollup(socket, "_1m.csv", socket.minutes.closed());
+  if (socket.hours.add(socket.minutes.closed())) writeRollup(socket, "_1h.csv", socket.hours.closed());
+}
+#endif
+
+//////////////
+
+static void startSession() {
+  // Once the card is mounted: number this session after the last one in the index, and cut the
+  // files that an earlier session left open (the power was cut) to their data
+  //
+  if (!logIndex.begin(SD, (logFile + "_index.csv").c_str())) return;
+  for (int i = 0; i < logIndex.pendingCount(); i++) {
+    const char *file = logIndex.pendingFile(i);
+    size_t len = strlen(file);
+    bool binary = len > 4 && strcmp(file + len - 4, ".bin") == 0;
+    uint32_t bytes = SdLogger::recover(SD, file, binary);
+    Serial.printf("Recovered %s: %lu bytes\r\n", file, (unsigned long)bytes);
+    logIndex.recovered(i, bytes);
+  }
+}
+
+//////////////
+
+static bool mountCard() {
+  return SD.begin(SDC_CS,sdc_spi,config.sdHz,"/sd",5,true);
+}
+
+//////////////
+
+static bool cardFailed() {
+  // A write to any of the files did not complete
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    if (sockets[i].logger.failed()) return true;
+#if LOG_BINARY
+    if (sockets[i].binLogger.failed()) return true;
+#endif
+  }
+  return false;
+}
+
+//////////////
+
+static void cardLost() {
+  // Close every file, keeping what is still buffered; the records are spooled until the card is back
+  //
+  Serial.println("SD card lost, spooling the records");
+  sdOK = false;
+  sdOutages++;
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    sockets[i].logger.suspend();
+#if LOG_BINARY
+    sockets[i].binLogger.suspend();
+#endif
+  }
+#if CAPTURE_REPLAY
+  captureLogger.suspend();
+#endif
+#if EVENT_CAPTURE
+  events.abort();
+#endif
+}
+
+//////////////
+
+static void cardBack() {
+  // The card was mounted again: reopen the files of the sockets already logging
+  //
+  Serial.printf("SD card mounted again, writing %lu spooled records\r\n", (unsigned long)spool.used());
+  sdOK = true;
+  sdRemounts++;
+  if (!logIndex.ready()) startSession();   // the card was not there at boot
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    Socket &socket = sockets[i];
+    if (!socket.logTried) continue;
+    bool resumed = true;
+#if LOG_CSV
+    resumed = socket.logger.resume(SD, socket.logPath.c_str()) && resumed;
+#endif
+#if LOG_BINARY
+    resumed = socket.binLogger.resume(SD, socket.binPath.c_str()) && resumed;
+#endif
+    if (resumed) continue;
+    //
+    // A file that cannot be reopened is left as it is (its buffered records are lost), and the
+    // socket carries on in a new segment. If that cannot be opened either, the card is no good.
+    uint32_t nowS = (uint32_t)(esp_timer_get_time()/1000000);
+    Serial.printf("Socket %d: cannot reopen its log, starting a new segment\r\n", i + 1);
+    closeSegment(socket, nowS);
+    socket.segment++;
+    openSegment(socket, nowS);
+    bool opened = true;
+#if LOG_CSV
+    opened = opened && socket.logger.isOpen();
+#endif
+#if LOG_BINARY
+    opened = opened && socket.binLogger.isOpen();
+#endif
+    if (!opened) {
+      cardLost();
+      return;
+    }
+  }
+}
+
+//////////////
+
+static void logRecord(Socket &socket, const Record &record, uint32_t nowS, char *line) {
+  // Write one record to the CSV and binary logs of its socket
+  //
+  bool logged = false;
+  {
+    PERF_SCOPE(PERF_FORMAT);
+    formatCsv(line, nowS, record.sample, record.kwh1e5(), config.channels);
+  }
+#if LOG_CSV && HISTORY_VIEW
+  uint32_t offset = socket.logger.size();   // where the line goes in the file
+  logged = socket.logger.log(line);
+  if (logged) socket.historyIndex[HISTORY_SECONDS].add(nowS, offset, strlen(line));
+#elif LOG_CSV
+  logged = socket.logger.log(line);
+#endif
+#if LOG_BINARY
+  if (socket.binLogger.isOpen()) {
+    if (socket.encoder.empty()) socket.blockMs = millis();
+    int64_t startUs = esp_timer_get_time();
+    if (!socket.encoder.add(record)) {
+      sealBlock(socket);
+      socket.encoder.add(record);
+      socket.blockMs = millis();
+    }
+    uint32_t us = (uint32_t)(esp_timer_get_time() - startUs);
+    if (us > socket.encodeUsMax) socket.encodeUsMax = us;
+    socket.encodeUsTotal += us;
+    socket.csvBytes += strlen(line);
+    logged = true;
+  }
+#endif
+  if (logged) {
+    PERF_COUNT(PERF_FRAMES_LOGGED);
+  } else {
+    PERF_COUNT(PERF_FRAMES_DROPPED);
+  }
+  if (logged && firstLoggedMs == 0) {
+    firstLoggedMs = millis();
+    Serial.printf("Boot to first logged sample: %lu ms\r\n", (unsigned long)firstLoggedMs);
+  }
+  if (LOG_LEVEL >= LOG_INFO) Serial.printf("%s,%s", socket.tag, line);
+}
+
+//////////////
+
+static void storeRecord(const Record &record, char *line) {
+  // Log one record to the files of its socket (the card is mounted)
+  //
+  Socket &socket = sockets[record.sample.device];
+  uint32_t nowS = (uint32_t)(record.sample.us/1000000);
+  if (!socket.logTried) {
+    openLog(socket, nowS);
+  } else if (nowS >= socket.segmentEndS || socket.logger.size() >= config.segmentBytes
+#if LOG_BINARY
+             || socket.binLogger.size() >= config.segmentBytes
+#endif
+             ) {
+    closeSegment(socket, nowS);
+    socket.segment++;
+    openSegment(socket, nowS);
+  }
+  if (socket.stored++ % config.decimation == 0) logRecord(socket, record, nowS, line);
+#if LOG_ROLLUPS
+  Rollup one;
+  one.set(record);
+  if (socket.minutes.add(one)) closeMinute(socket);
+#endif
+}
+
+//////////////
+
+#if EVENT_CAPTURE
+static void recordEvent(const EventFrame &event) {
+  // The storage task: one frame to the event recorder, which opens an event file on a trigger
+  if (event.trigger && !events.recording() && sdOK && logIndex.ready()) {
+    const Socket &socket = sockets[event.device];
+    char suffix[12];
+    snprintf(suffix, sizeof(suffix), "_E%03lu.txt", (unsigned long)events.next());
+    events.start(SD, sessionPath(socket, suffix).c_str(), event, socket.tag);
+  }
+  events.add(event);
+}
+#endif
+
+//////////////
+
+#if CAPTURE_REPLAY
+static void clearReplayedStorage(uint8_t slots) {
+  // The storage task: the last records of the replay are stored. Close its log files and forget
+  // its slots, so that a socket found later starts a log of its own, under its own tag.
+  uint32_t nowS = (uint32_t)(esp_timer_get_time()/1000000);
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    if (!(slots & (1 << i))) continue;
+    Socket &socket = sockets[i];
+    if (socket.logTried) closeSegment(socket, nowS);
+    socket.logTried = false;
+    socket.stored = 0;
+#if LOG_ROLLUPS
+    socket.minutes = RollupTier(ROLLUP_MINUTE_S);
+    socket.hours = RollupTier(ROLLUP_HOUR_S);
+#endif
+    socket.tag[0] = '\0';
+  }
+  portENTER_CRITICAL(&replayLock);
+  replayClearStorage &= ~slots;
+  replaySlots &= ~slots;
+  portEXIT_CRITICAL(&replayLock);
+}
+#endif
+
+//////////////
+
+static void storageTask(void *parameter) {
+  // Core 1: format the records and write them to the SD card in blocks, one log file per socket.
+  // While the card is out the records wait in the spool, and the card is mounted again every SD_RETRY_MS.
+  //
+  Record record;
+  char line[CSV_LINE_LEN];
+#if CAPTURE_REPLAY
+  char captureLine[CAPTURE_LINE_LEN];
+#endif
+  uint32_t retryMs = millis();
+  if (sdOK) startSession();
+  //
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));  // woken by the ingest task, or once a second for logger.poll()
+    storageStats.wake();
+    if (!sdOK && millis() - retryMs >= SD_RETRY_MS) {
+      retryMs = millis();
+      SD.end();
+      if (mountCard()) cardBack();
+    }
+    //
+    // The spooled records first, in bulk (the loggers write them out in whole blocks), then the new ones
+#if CAPTURE_REPLAY
+    uint8_t clear = replayClearStorage;   // read first: the ingest task queued all the records of those slots before
+#endif
+    while (sdOK && spool.pop(record)) {
+      storeRecord(record, line);
+      if (cardFailed()) cardLost();
+    }
+    while (storageQueue.pop(record)) {
+      if (!sdOK) {
+        spool.push(record);
+        continue;
+      }
+      storeRecord(record, line);
+      if (cardFailed()) cardLost();
+    }
+#if CAPTURE_REPLAY
+    if (clear && spool.used() == 0) clearReplayedStorage(clear);   // later if some are spooled
+#endif
+    for (int i = 0; i < MAX_SOCKETS; i++) {
+      Socket &socket = sockets[i];
+#if LOG_ROLLUPS
+      // Close the periods that no more samples came for (the link is down). Not while records
+      // of those periods may still be in the spool.
+      int64_t nowUs = esp_timer_get_time();
+      if (sdOK && spool.used() == 0) {
+        if (socket.minutes.poll(nowUs)) closeMinute(socket);
+        if (socket.hours.poll(nowUs)) writeRollup(socket, "_1h.csv", socket.hours.closed());
+      }
+#endif
+#if LOG_BINARY
+      if (socket.binLogger.isOpen()) {
+        // A block that is not filling up (slow frames) is queued partly empty, so its records
+        // are not held back longer than the flush interval
+        if (!socket.encoder.empty() && (!receiving(socket) || millis() - socket.blockMs >= config.flushMs)) sealBlock(socket);
+        socket.binLogger.poll();
+        if (!receiving(socket)) socket.binLogger.flush();
+      }
+#endif
+      if (!socket.logger.isOpen()) continue;
+      //
+      // Write the buffered log records to the SD card when a block is full or the flush interval is up
+      socket.logger.poll();
+      //
+      // No more samples are coming, so don't keep the last ones waiting in RAM
+      if (!receiving(socket)) socket.logger.flush();
+    }
+    if (sdOK && cardFailed()) cardLost();
+#if CAPTURE_REPLAY
+    //
+    // The capture file is open while capturing
+    if (capturing && !captureLogger.isOpen() && sdOK) captureLogger.begin(SD, CAPTURE_FILE);
+    CapturedFrame captured;
+    while (captureQueue.pop(captured)) {
+      if (!sdOK) continue;   // not spooled
+      formatCapture(captureLine, captured.frame, captured.us, captured.device);
+      captureLogger.log(captureLine);
+    }
+    if (captureLogger.isOpen()) {
+      captureLogger.poll();
+      if (!capturing) captureLogger.end();
+    }
+#endif
+#if EVENT_CAPTURE
+    //
+    // The frames around power anomalies
+    EventFrame event;
+    while (eventQueue.pop(event)) recordEvent(event);
+#if CAPTURE_REPLAY
+    while (replayEventQueue.pop(event)) recordEvent(event);
+#endif
+    events.poll();
+#endif
+#if HEALTH_LOG
+    //
+    // The health records, one line each in a file of the session
+    HealthRecord healthRecord;
+    while (healthQueue.pop(healthRecord)) {
+      if (!sdOK || !logIndex.ready()) {
+        healthDropped++;
+        continue;
+      }
+      formatHealth(healthLine, healthRecord);
+      String path = healthPath();
+      if (!SD.exists(path.c_str())) writeFile(SD, path.c_str(), HEALTH_CSV_HEADER);
+      appendFile(SD, path.c_str(), healthLine);
+    }
+#endif
+    storageStats.sleep();
+  }
+}
+
+//////////////
+
+#if NET_EXPORT
+static const char *socketTag(uint8_t device) {
+  return sockets[device].tag;
+}
+
+//////////////
+
+static void netTask(void *parameter) {
+  // Core 1: move the records into the backlog, and send the batches that are due. The network calls
+  // may block for a while (a broker that is not answering), which only holds up this task.
+  //
+  Record record;
+  net.begin(socketTag);
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    netStats.wake();
+    while (netQueue.pop(record)) net.add(record);
+    net.poll();
+    netStats.sleep();
+  }
+}
+#endif
+
+//////////////
+
+#if HTTP_SERVER
+static bool cardReady() {
+  return sdOK;
+}
+
+//////////////
+
+static uint32_t samplesLost() {
+  // Everything that can lose samples while a download competes for the card and the CPU
+  uint32_t lost = sampleQueue.overruns() + storageQueue.overruns() + spool.lost();
+#if CAPTURE_REPLAY
+  lost += replaySampleQueue.overruns();
+#endif
+  for (int i = 0; i < MAX_SOCKETS; i++) lost += sockets[i].framesLost;
+  return lost;
+}
+
+//////////////
+
+static void httpTask(void *parameter) {
+  // Core 1, below the storage task: answer the requests for the log files. A download keeps
+  // this task busy until it is sent, which holds up nothing else.
+  //
+  logServer.begin(SD, cardReady, samplesLost);
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(HTTP_POLL_MS));
+    httpStats.wake();
+    logServer.poll();
+    httpStats.sleep();
+  }
+}
+#endif
+
+//////////////
+
+#if CAPTURE_REPLAY
+static bool replayCurrent(uint32_t generation) {
+  // The replay started as this generation has not been stopped or replaced
+  return replayGeneration == generation;
+}
+
+//////////////
+
+static void replayEnded(uint32_t generation) {
+  // The replay task: a replay ran to its end, unless a newer command has taken over already.
+  // Either way it feeds its slots no more, so they are passed on to be cleared.
+  portENTER_CRITICAL(&replayLock);
+  if (replayGeneration == generation) {
+    replaySource = REPLAY_OFF;
+    replayGeneration++;
+  }
+  replayClearIngest |= replaySlots;
+  portEXIT_CRITICAL(&replayLock);
+  xTaskNotifyGive(ingestHandle);
+}
+
+//////////////
+
+static void replayTask(void *parameter) {
+  // Core 1: feed captured or synthetic frames to handOver(), as notifyCallback() does, at
+  // replaySpeeds[replaySpeed] times their recorded pace, into the slots that replaying()
+  // gives to the replay. The BLE task only feeds the others.
+  //
+  char line[CAPTURE_LINE_LEN];
+  uint8_t frame[ATORCH_FRAME_LEN];
+  //
+  for (;;) {
+    uint32_t generation;
+    xTaskNotifyWait(0, 0, &generation, portMAX_DELAY);   // woken by replayStart() with its generation
+    portENTER_CRITICAL(&replayLock);
+    bool current = replayGeneration == generation;
+    int source = replaySource;
+    uint8_t slot = replayDevice;
+    portEXIT_CRITICAL(&replayLock);
+    if (!current) {
+      replayEnded(generation);   // stopped before it began
+      continue;
+    }
+    File file;
+    if (source == REPLAY_FILE) {
+      file = SD.open(CAPTURE_FILE);
+      if (!file) {
+        Serial.println("Replay: no " CAPTURE_FILE);
+        replayEnded(generation);
+        continue;
+      }
+    }
+    replayStats.wake();
+    uint32_t overruns = replaySampleQueue.overruns() + storageQueue.overruns();
+    uint32_t frames = 0;
+    int64_t startUs = esp_timer_get_time(), dueUs = startUs, lastUs = 0;
+    //
+    while (replayCurrent(generation)) {
+      int64_t us;
+      uint8_t device = 0;
+      if (source == REPLAY_FILE) {
+        size_t len = file.readBytesUntil('\n', line, sizeof(line) - 1);
+        if (len == 0) break;   // end of the capture
+        line[len] = '\0';
+        if (!parseCapture(line, frame, us, device) || device >= MAX_SOCKETS) continue;
+      } else {
+        syntheticFrame(frames, frame);
+        us = (int64_t)frames * 1000000;
+        device = slot == REPLAY_ALL_SLOTS ? 0 : slot;
+      }
+      //
+      // Keep the recorded intervals, divided by the speed
+      if (frames == 0) lastUs = us;
+      dueUs += (us - lastUs) / replaySpeeds[replaySpeed];
+      lastUs = us;
+      int64_t waitUs;
+      replayStats.sleep();
+      while ((waitUs = dueUs - esp_timer_get_time()) >= 1000 && replayCurrent(generation)) {
+        vTaskDelay(pdMS_TO_TICKS(waitUs > 100000 ? 100 : waitUs / 1000));   // 'x' still stops a long gap
+      }
+      replayStats.wake();
+      if (!replayCurrent(generation)) break;
+      Socket &socket = sockets[device];
+      if (socket.tag[0] == '\0') snprintf(socket.tag, sizeof(socket.tag), "replay%u", device);
+      handOver(frame, socket, true);
+      frames++;
+    }
+    if (file) file.close();
+    replayStats.sleep();
+    //
+    uint32_t ms = (uint32_t)((esp_timer_get_time() - startUs) / 1000);
+    Serial.printf("Replay: %lu frames in %lu ms (%lu frames/s), %lu lost to full queues\r\n",
+                  (unsigned long)frames, (unsigned long)ms, (unsigned long)(ms ? frames * 1000ULL / ms : 0),
+                  (unsigned long)(replaySampleQueue.overruns() + storageQueue.overruns() - overruns));
+    replayEnded(generation);
+  }
+}
+
+//////////////
+
+static void replayStart(int source, uint8_t slot) {
+  // loop(): start a replay into the socket slot given, or all of them (REPLAY_ALL_SLOTS)
+  portENTER_CRITICAL(&replayLock);
+  replayDevice = slot;
+  replaySlots = slot == REPLAY_ALL_SLOTS ? (1 << MAX_SOCKETS) - 1 : 1 << slot;
+  replaySource = source;
+  uint32_t generation = ++replayGeneration;
+  portEXIT_CRITICAL(&replayLock);
+  xTaskNotify(replayStats.handle, generation, eSetValueWithOverwrite);
+}
+
+//////////////
+
+static void replayStop() {
+  // loop(): the replay task stops at its next frame; a new replay may start once its slots are cleared
+  portENTER_CRITICAL(&replayLock);
+  replaySource = REPLAY_OFF;
+  replayGeneration++;
+  portEXIT_CRITICAL(&replayLock);
+}
+
+//////////////
+
+static void replayCommand(char command) {
+  // The Serial commands of the capture and replay modes
+  //
+  switch (command) {
+    case 'c':
+      capturing = !capturing;
+      Serial.printf("Capture %s\r\n", capturing ? "started (" CAPTURE_FILE ")" : "stopped");
+      break;
+    case 'y':
+    case 'g':
+      // Into every slot: only while no socket is known, not even one restored and still scanning
+      if (replaySource != REPLAY_OFF) break;
+      if (replaySlots != 0) {
+        Serial.println("Replay: the last one is still being cleared");
+        break;
+      }
+      for (int i = 0; i < MAX_SOCKETS; i++) {
+        if (sockets[i].used) {
+          Serial.printf("Replay: not while a socket is known (slot %d)\r\n", i + 1);
+          return;
+        }
+      }
+      Serial.printf("Replay of %s at %ux\r\n", command == 'y' ? CAPTURE_FILE : "a synthetic load", replaySpeeds[replaySpeed]);
+      replayStart(command == 'y' ? REPLAY_FILE : REPLAY_SYNTHETIC, REPLAY_ALL_SLOTS);
+      break;
+    case 'x':
+      replayStop();
+      break;
+    case '+':
+      if (replaySpeed + 1 < (int)sizeof(replaySpeeds)) replaySpeed++;
+      Serial.printf("Replay speed %ux\r\n", replaySpeeds[replaySpeed]);
+      break;
+    case '-':
+      if (replaySpeed > 0) replaySpeed--;
+      Serial.printf("Replay speed %ux\r\n", replaySpeeds[replaySpeed]);
+      break;
+  }
+}
+
+//////////////
+
+#if HEALTH_LOG
+static void soakCommand(uint32_t now) {
+  // Start the soak, the synthetic load at the highest speed into a slot of its own, or stop it
+  //
+  if (health.soaking()) {
+    replayStop();
+    return;   // loop() ends the soak once the replay has stopped and its slot is cleared
+  }
+  if (replaySlots != 0 || sockets[SOAK_DEVICE].used) {
+    Serial.printf("Soak: not while replaying, or with a socket in slot %d\r\n", SOAK_DEVICE + 1);
+    return;
+  }
+  replaySpeed = sizeof(replaySpeeds) - 1;
+  health.soakStart();
+  soakDropTime = now;
+  healthTime = now - health.intervalMs();   // a first record now
+  Serial.printf("Soak started: a synthetic load at %ux, links dropped every %lu s\r\n",
+                replaySpeeds[replaySpeed], (unsigned long)(SOAK_RECONNECT_MS / 1000));
+  replayStart(REPLAY_SYNTHETIC, SOAK_DEVICE);
+}
+#endif
+#endif
+
+//////////////
+
+static bool viewAvailable(int view) {
+  switch (view) {
+    case VIEW_DASHBOARD: return true;
+#if TREND_VIEW
+    case VIEW_TREND: return trend.isReady();
+#endif
+#if HISTORY_VIEW
+    case VIEW_HISTORY: return true;
+#endif
+#if PERF_ENABLE
+    case VIEW_STATUS: return true;
+#endif
+    default: return false;
+  }
+}
+
+//////////////
+
+#if PERF_ENABLE
+static void drawStatusPage() {
+  // The performance statistics (perf.h), one line per point and counter, in the monospaced font 1
+  //
+  char line[PERF_LINE_LEN];
+  int16_t y = VIEW_Y + 4;
+  tft.startWrite();
+  tft.setTextColor(TFT_GREENYELLOW, TFT_BLACK);
+  tft.setTextPadding(tft.width());
+  tft.drawString(PERF_HEADER, 0, y, 1);
+  y += 14;
+  for (int i = 0; i < PERF_POINTS; i++, y += 12) {
+    perfLine(line, i);
+    tft.drawString(line, 0, y, 1);
+  }
+  y += 6;
+  for (int i = 0; i < PERF_COUNTERS; i++, y += 12) {
+    perfCounterLine(line, i);
+    tft.drawString(line, 0, y, 1);
+  }
+  tft.setTextPadding(0);
+  tft.endWrite();
+}
+#endif
+
+//////////////
+
+#if HISTORY_VIEW
+static void IRAM_ATTR onTouch() {
+  // The pen interrupt: the ui task reads the panel
+  touched = true;
+  BaseType_t woken = pdFALSE;
+  if (uiStats.handle) vTaskNotifyGiveFromISR(uiStats.handle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+//////////////
+#endif
+
+#if SINK_DISPLAY
+static void uiTask(void *parameter) {
+  // Core 1: refresh the dashboard once a second. Only the fields whose text changed are repainted.
+  // With several sockets, each one is shown for DISPLAY_CYCLE_S seconds in turn.
+  // The trend chart (TREND_VIEW), the history (HISTORY_VIEW) and the status page (PERF_ENABLE) take
+  // the place of the dashboard while they are shown. A touch on the history is handled at once.
+  //
+  static Record latest[MAX_SOCKETS];
+  bool seen[MAX_SOCKETS] = {};
+  Record next;
+  int shown = 0;
+  uint32_t shownSecs = 0;
+  char text[DASH_FIELD_LEN], tag[DASH_FIELD_LEN] = "";
+  char sdMsg[40], shownSdMsg[40] = "";
+#if LOG_BINARY
+  char status[40], shownStatus[40] = "";
+#endif
+  int view = VIEW_DASHBOARD;
+#if TREND_VIEW
+  static TrendRing rings[MAX_SOCKETS];
+  uint32_t ringSeq[MAX_SOCKETS] = {};
+  int plotted = -1;   // socket in the chart; -1: draw it from scratch
+  for (int i = 0; i < MAX_SOCKETS; i++) rings[i].clear();
+#endif
+  uint32_t activityMs = millis();   // last button press or touch (backlight)
+#if HISTORY_VIEW
+  bool historyMoved = false;        // draw the history at once
+  uint32_t touchMs = 0;
+#endif
+  TickType_t secondTick = xTaskGetTickCount() + pdMS_TO_TICKS(1000);   // of the next once-a-second update
+  //
+  for (;;) {
+    // Sleep until the next second, or a touch
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(secondTick - now) > 0) ulTaskNotifyTake(pdTRUE, secondTick - now);
+    bool second = (int32_t)(xTaskGetTickCount() - secondTick) >= 0;
+    if (second) secondTick += pdMS_TO_TICKS(1000);
+    uiStats.wake();
+#if HISTORY_VIEW
+    int16_t touchX, touchY;
+    if (touched) {
+      touched = false;
+      if (touch.read(touchX, touchY) && millis() - touchMs >= TOUCH_REPEAT_MS) {
+        touchMs = activityMs = millis();
+        if (!backlightBright()) {
+          backlightSet(true);   // a touch on the dimmed display only lights it up
+        } else if (view == VIEW_HISTORY) {
+          history.touch(touchX);
+          historyMoved = true;
+        }
+      }
+    }
+    if (view == VIEW_HISTORY && (second || historyMoved) && sdOK) {
+      PERF_SCOPE(PERF_TFT_DRAW);
+      history.update(SD, sockets[shown].historyIndex, historyMoved);
+      historyMoved = false;
+    }
+#endif
+    if (!second) {
+      uiStats.sleep();
+      continue;
+    }
+    while (uiQueue.pop(next)) {
+      latest[next.sample.device] = next;
+      seen[next.sample.device] = true;
+    }
+#if TREND_VIEW
+    //
+    // One column a second for every socket: its latest sample, or a gap if none came
+    for (int i = 0; i < MAX_SOCKETS; i++) {
+      if (!seen[i]) continue;
+      const Sample &sample = latest[i].sample;
+      bool fresh = sample.seq != ringSeq[i];
+      ringSeq[i] = sample.seq;
+      rings[i].add(fresh ? sample.watts10 : TREND_GAP, fresh ? sample.milliamps : TREND_GAP);
+    }
+#endif
+    if (viewPressed) {
+      viewPressed = false;
+      activityMs = millis();
+      if (!backlightBright()) {
+        backlightSet(true);   // a press on the dimmed display only lights it up
+      } else {
+        do {
+          view = (view + 1) % VIEW_COUNT;
+        } while (!viewAvailable(view));
+        tft.fillRect(0, VIEW_Y, tft.width(), STATUS_Y - VIEW_Y, TFT_BLACK);
+        if (view == VIEW_DASHBOARD) dashboard.begin(TFT_GREENYELLOW, TFT_BLACK);   // labels, and every field repainted
+#if TREND_VIEW
+        plotted = -1;
+#endif
+#if HISTORY_VIEW
+        historyMoved = true;   // drawn on the next touch or second
+#endif
+      }
+    }
+    if (BACKLIGHT_DIM_MS && backlightBright() && millis() - activityMs >= BACKLIGHT_DIM_MS) backlightSet(false);
+#if PERF_ENABLE
+    if (view == VIEW_STATUS) {
+      PERF_SCOPE(PERF_TFT_DRAW);
+      drawStatusPage();
+    }
+#endif
+    //
+    // Pick the socket to show
+    uint32_t secs = millis()/1000;
+    if (!seen[shown] || (secs - shownSecs >= DISPLAY_CYCLE_S && view != VIEW_HISTORY)) {   // the history stays on its socket
+      for (int i = 1; i <= MAX_SOCKETS; i++) {
+        int candidate = (shown + i) % MAX_SOCKETS;
+        if (seen[candidate]) {
+          shown = candidate;
+          break;
+        }
+      }
+      shownSecs = secs;
+    }
+    const Record &record = latest[shown];
+    //
+    // Only if we are connected
+    if (anyConnected() && seen[shown]) {
+      //
+      // Display the energy data
+#if TREND_VIEW
+      if (view == VIEW_TREND) {
+        PERF_SCOPE(PERF_TFT_DRAW);
+        if (plotted != shown) trend.show(rings[shown]);
+        else trend.update(rings[shown]);
+        plotted = shown;
+      }
+#endif
+      if (view == VIEW_DASHBOARD) {
+        PERF_SCOPE(PERF_TFT_DRAW);
+        fmtHms(text, secs);
+        dashboard.setField(FIELD_RUNTIME, text);
+        fmtStr(fmtFixed(text, record.sample.volts10, 1), " V");
+        dashboard.setField(FIELD_VOLTAGE, text);
+        fmtStr(fmtFixed(text, record.sample.milliamps, 3, 6), " A");
+        dashboard.setField(FIELD_CURRENT, text);
+        fmtStr(fmtFixed(text, record.sample.watts10, 1, 6), " W");
+        dashboard.setField(FIELD_POWER, text);
+        fmtFixed(text, (record.sample.pf1000 + 5) / 10, 2);
+        dashboard.setField(FIELD_PF, text);
+        fmtStr(fmtFixed64(text, record.kwh1e5(), 5, 8), " kWh");
+        dashboard.setField(FIELD_ENERGY, text);
+        fmtStr(fmtFixed(text, record.sample.hz10, 1), " Hz");
+        dashboard.setField(FIELD_FREQUENCY, text);
+        dashboard.render();
+      }
+      //
+      // Which socket this is: "n:" and the last 2 bytes of its address, right-aligned on the message row
+      text[0] = '1' + shown;
+      text[1] = ':';
+      strcpy(text + 2, sockets[shown].tag + 8);
+      if (strcmp(text, tag) != 0) {
+        strcpy(tag, text);
+        tft.setTextColor(TFT_ORANGE, TFT_BLACK);
+        tft.setTextDatum(TR_DATUM);
+        tft.drawString(tag, tft.width() - 1, ERR_MSG_Y, 2);
+        tft.setTextDatum(TL_DATUM);
+      }
+#if LOG_BINARY
+      //
+      // Binary log of this socket: bytes per record, compression against the CSV log, encoding time
+      const Socket &s = sockets[shown];
+      uint32_t bpk = s.encoder.bytesPerKiloRecord();
+      uint32_t records = s.encoder.records();
+      if (bpk && records) {
+        char *p = fmtStr(status, "Log ");
+        p = fmtStr(fmtFixed(p, bpk / 100, 1), " B/rec  x");
+        p = fmtStr(fmtFixed(p, (uint32_t)((uint64_t)s.csvBytes * 10000 / ((uint64_t)records * bpk)), 1), "  ");
+        fmtStr(fmtFixed(p, s.encodeUsTotal / records, 0), " us");
+        if (strcmp(status, shownStatus) != 0) {
+          strcpy(shownStatus, status);
+          tft.setTextColor(TFT_DARKGREY, TFT_BLACK);
+          tft.setTextPadding(tft.width());
+          tft.drawString(status, 0, STATUS_Y, 1);
+          tft.setTextPadding(0);
+        }
+      }
+#endif
+      //
+      //
+      // While the SD card is out: how full the spool is and how many records it could not keep
+      sdMsg[0] = '\0';
+      if (!sdOK) {
+        char *p = fmtStr(sdMsg, "No SD card: spool ");
+        p = fmtStr(fmtFixed(p, spool.percentFull(), 0), "%, ");
+        fmtStr(fmtFixed(p, spool.lost(), 0), " lost");
+      }
+      if (strcmp(sdMsg, shownSdMsg) != 0) {
+        strcpy(shownSdMsg, sdMsg);
+        tft.fillRect(0, ERR_MSG_Y, tft.width() - 64, 16, TFT_BLACK);   // up to the socket tag
+        tft.setTextColor(TFT_RED, TFT_BLACK);
+        tft.drawString(sdMsg, 0, ERR_MSG_Y, 2);
+      }
+    } else {
+      //
+      // Display the BLE error message
+      Serial.println(errMsg_BLE);
+      tft.setTextColor(TFT_RED, TFT_BLACK);
+      tft.drawString(errMsg_BLE, 0, ERR_MSG_Y, 2);
+      tag[0] = '\0';  // the message may have covered the socket tag
+      shownSdMsg[0] = '\0';
+    }
+    uiStats.sleep();
+  }
+}
+#endif
+
+//////////////
+
+#if HEALTH_LOG
+static void takeHealth() {
+  // loop(): a health record for the storage task
+  //
+  HealthRecord record;
+  health.sample(record, taskStats, sizeof(taskStats)/sizeof(taskStats[0]));
+  record.reconnects = 0;
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    if (sockets[i].used) record.reconnects += sockets[i].link.reconnects();
+  }
+  record.sampleHigh = sampleQueue.highWater();
+  record.storageHigh = storageQueue.highWater();
+  record.uiHigh = uiQueue.highWater();
+  record.overruns = sampleQueue.overruns() + storageQueue.overruns();   // the ui queue only skips values
+#if CAPTURE_REPLAY
+  if (replaySampleQueue.highWater() > record.sampleHigh) record.sampleHigh = replaySampleQueue.highWater();
+  record.overruns += replaySampleQueue.overruns();
+#endif
+#if NET_EXPORT
+  record.netHigh = netQueue.highWater();
+  record.overruns += netQueue.overruns();
+#else
+  record.netHigh = 0;
+#endif
+  record.spoolUsed = spool.used();
+  record.spoolLost = spool.lost();
+  healthQueue.push(record);   // overruns are counted by the queue
+  xTaskNotifyGive(storageHandle);
+}
+#endif
+
+//////////////
+
+void printStats(uint32_t elapsedMs) {
+  Serial.printf("Sample queue: %lu frames, %lu overruns, high water %lu/%u\r\n",
+                (unsigned long)sampleQueue.pushed(), (unsigned long)sampleQueue.overruns(),
+                (unsigned long)sampleQueue.highWater(), (unsigned)sampleQueue.capacity());
+#if CAPTURE_REPLAY
+  Serial.printf("Replay queue: %lu frames, %lu overruns, high water %lu/%u\r\n",
+                (unsigned long)replaySampleQueue.pushed(), (unsigned long)replaySampleQueue.overruns(),
+                (unsigned long)replaySampleQueue.highWater(), (unsigned)replaySampleQueue.capacity());
+#endif
+  Serial.println("Sinks:");
+  Sinks::printStats(Serial);
+  Serial.printf("Storage queue: %lu overruns, high water %lu/%u\r\n",
+                (unsigned long)storageQueue.overruns(), (unsigned long)storageQueue.highWater(), (unsigned)storageQueue.capacity());
+  Serial.printf("SD card: %s, %lu outages, %lu remounts; spool %lu/%lu records, %lu lost\r\n",
+                sdOK ? "mounted" : "out", (unsigned long)sdOutages, (unsigned long)sdRemounts,
+                (unsigned long)spool.used(), (unsigned long)spool.capacity(), (unsigned long)spool.lost());
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    Socket &socket = sockets[i];
+    if (!socket.used) continue;
+    //
+    uint32_t n = socket.notifications;
+    uint32_t rate = elapsedMs ? (uint32_t)((uint64_t)(n - socket.lastNotifications) * 100000 / elapsedMs) : 0;  // [notifications/s*100]
+    socket.lastNotifications = n;
+    Serial.printf("Socket %d %s: %s, %lu.%02lu notifications/s, %lu lost\r\n", i + 1, socket.tag,
+                  socket.link.stateName(),
+                  (unsigned long)(rate / 100), (unsigned long)(rate % 100), (unsigned long)socket.framesLost);
+    const LinkMonitor &l = socket.link;
+    Serial.printf("  Link: %lu attempts, %lu failed, %lu reconnects, first frame after %lu ms (max %lu, boot %lu), "
+                  "%lu outages (last %lu ms, max %lu ms, total %lu s)%s\r\n",
+                  (unsigned long)l.attempts(), (unsigned long)l.failures(), (unsigned long)l.reconnects(),
+                  (unsigned long)l.lastFirstFrameMs(), (unsigned long)l.maxFirstFrameMs(), (unsigned long)l.bootFirstFrameMs(),
+                  (unsigned long)l.outages(), (unsigned long)l.lastOutageMs(), (unsigned long)l.maxOutageMs(),
+                  (unsigned long)(l.totalOutageMs()/1000), l.inOutage() ? ", in an outage now" : "");
+    Serial.print("  ");
+    socket.commands.printStats(Serial);
+    const AtorchAssembler &a = socket.assembler;
+    Serial.printf("  BLE frames: %lu good, %lu bad checksum, %lu unsupported, %lu short, %lu resyncs (%lu bytes skipped)\r\n",
+                  (unsigned long)a.goodFrames(), (unsigned long)a.badChecksumFrames(),
+                  (unsigned long)a.unsupportedFrames(), (unsigned long)a.shortFrames(),
+                  (unsigned long)a.resyncs(), (unsigned long)a.skippedBytes());
+    const EnergyIntegrator &e = socket.integrator;
+    Serial.printf("  Energy: %llu mWs, socket counter +%lu Wh (difference %ld Wh), %lu gaps over %lu s (%lu s not integrated)\r\n",
+                  (unsigned long long)e.milliwattSeconds(), (unsigned long)e.socketKwh100()*10,
+                  (long)e.driftWh(), (unsigned long)e.gaps(),
+                  (unsigned long)(e.gapUs()/1000000), (unsigned long)(e.missingUs()/1000000));
+    if (socket.logger.isOpen()) {
+      Serial.print("  ");
+      socket.logger.printStats(Serial);
+    }
+#if LOG_BINARY
+    if (socket.binLogger.isOpen()) {
+      Serial.print("  Binary ");
+      socket.binLogger.printStats(Serial);
+      const BinlogEncoder &b = socket.encoder;
+      uint32_t bpk = b.bytesPerKiloRecord();
+      Serial.printf("  Binary encoding: %lu records in %lu blocks, %lu.%03lu B/record (CSV %lu B/record), encode avg %lu us, max %lu us\r\n",
+                    (unsigned long)b.records(), (unsigned long)b.blocks(),
+                    (unsigned long)(bpk/1000), (unsigned long)(bpk%1000),
+                    (unsigned long)(b.records() ? socket.csvBytes/b.records() : 0),
+                    (unsigned long)(b.records() ? socket.encodeUsTotal/b.records() : 0),
+                    (unsigned long)socket.encodeUsMax);
+    }
+#endif
+  }
+  if (firstLoggedMs) Serial.printf("Boot to first logged sample: %lu ms\r\n", (unsigned long)firstLoggedMs);
+  checkpoint.printStats(Serial);
+#if HEALTH_LOG
+  health.printStats(Serial);
+  Serial.printf("Health queue: %lu overruns; %lu records not written (no card)\r\n",
+                (unsigned long)healthQueue.overruns(), (unsigned long)healthDropped);
+#endif
+#if EVENT_CAPTURE
+  events.printStats(Serial);
+  Serial.printf("Event queue: %lu overruns, high water %lu/%u\r\n",
+                (unsigned long)eventQueue.overruns(), (unsigned long)eventQueue.highWater(), (unsigned)eventQueue.capacity());
+#if CAPTURE_REPLAY
+  Serial.printf("Replay event queue: %lu overruns, high water %lu/%u\r\n",
+                (unsigned long)replayEventQueue.overruns(), (unsigned long)replayEventQueue.highWater(), (unsigned)replayEventQueue.capacity());
+#endif
+#endif
+  powerPrintStats(Serial);
+#if NET_EXPORT
+  net.printStats(Serial);
+  Serial.printf("Net queue: %lu overruns, high water %lu/%u\r\n",
+                (unsigned long)netQueue.overruns(), (unsigned long)netQueue.highWater(), (unsigned)netQueue.capacity());
+#endif
+#if HTTP_SERVER
+  logServer.printStats(Serial);
+#endif
+  uint32_t wakeups = loopWakeups;
+  uint32_t wakeRate = elapsedMs ? (uint32_t)((uint64_t)(wakeups - lastLoopWakeups) * 100000 / elapsedMs) : 0;  // [wakeups/s*100]
+  lastLoopWakeups = wakeups;
+  Serial.printf("Loop: %lu.%02lu wakeups/s\r\n", (unsigned long)(wakeRate / 100), (unsigned long)(wakeRate % 100));
+  dashboard.printStats(Serial);
+#if TREND_VIEW
+  trend.printStats(Serial);
+#endif
+#if HISTORY_VIEW
+  history.printStats(Serial);
+  Serial.printf("Touch panel: %lu touches\r\n", (unsigned long)touch.touches());
+#endif
+  printTaskStats(Serial, taskStats, sizeof(taskStats)/sizeof(taskStats[0]));
+}
+
+//////////////
+
+void setup() {
+#if SINK_SERIAL
+  Serial.setTxBufferSize(2 * sizeof(SerialSink::buffer));   // the serial sink's writes do not wait for the UART
+#endif
+  Serial.begin(115200);
+  Serial.println("Starting Arduino BLE Client application...");
+  loopHandle = xTaskGetCurrentTaskHandle();   // setup() and loop() run in the same task
+  Serial.onReceive(wakeLoop);
+  powerApply(powerRequested, Serial);
+  //
+  // Initialize TFT
+  tft.init();
+  tft.setRotation(1);   // 1 and 3 are landscape
+  //
+  // Clear the display
+  tft.fillScreen(TFT_BLACK);
+#ifdef TFT_BL
+  backlightBegin(TFT_BL);
+#endif
+  //
+  // Display the program name and version
+  tft.setTextColor(TFT_ORANGE, TFT_BLACK);
+  tft.drawString("ENERGY RECORDER  v1.0", 0, 0, 4);
+  //
+#if SINK_DISPLAY
+  // The dashboard labels never change, so they are drawn only once
+  dashboard.begin(TFT_GREENYELLOW, TFT_BLACK);
+#endif
+	//
+	// Mount the SD card. The log file of each socket is created when its first record arrives.
+	sdc_spi.begin(SDC_CLK, SDC_MISO, SDC_MOSI, SDC_CS);
+	if (!mountCard()){
+		Serial.println("SD Card Mount Failed, the records are spooled until it is inserted");
+		sdOK = false;
+	} else {
+		Serial.println("SD Card Mounted");
+		sdOK = true;
+		//
+		// The settings of this site; the card is mounted again if it is to run at another clock
+		bootConfig.load(SD, CONFIG_FILE, Serial);
+		if (config.sdHz != CONFIG_SD_HZ) {
+			SD.end();
+			sdOK = mountCard();
+			if (!sdOK) Serial.printf("SD Card Mount Failed at %lu Hz\r\n", (unsigned long)config.sdHz);
+		}
+	}
+	config.print(Serial);
+	logFile = config.logPath;
+	for (int i = 0; i < MAX_SOCKETS; i++) {
+	  sockets[i].logger.setFlush(config.flushBytes, config.flushMs);
+#if LOG_BINARY
+	  sockets[i].binLogger.setFlush(config.flushBytes, config.flushMs);
+#endif
+	}
+	//
+	// Keep the records while the card is out: in PSRAM if there is any, else a smaller spool in internal RAM
+	uint32_t spoolRecords = psramFound() ? SPOOL_RECORDS_PSRAM : SPOOL_RECORDS;
+	Record *spoolBuffer = (Record *)(psramFound() ? ps_malloc(spoolRecords * sizeof(Record)) : malloc(spoolRecords * sizeof(Record)));
+	spool.begin(spoolBuffer, spoolRecords);
+	Serial.printf("Record spool: %lu records%s\r\n", (unsigned long)spool.capacity(), psramFound() ? " in PSRAM" : "");
+#if EVENT_CAPTURE
+	if (!events.begin(EVENT_BUFFER_FRAMES)) Serial.println("No memory for the event ring");
+#endif
+#if HEALTH_LOG
+	health.begin();
+#endif
+	//
+	// Write out whatever is still buffered when the program restarts (the loggers that are not open do nothing)
+	esp_register_shutdown_handler([]() {
+	  for (int i = 0; i < MAX_SOCKETS; i++) {
+	    sockets[i].logger.flush();
+#if LOG_BINARY
+	    sockets[i].binLogger.flush();
+#endif
+	  }
+	});
+  tft.setTextColor(TFT_GREENYELLOW, TFT_BLACK);
+  //
+#ifdef FORMAT_BENCHMARK
+  formatBenchmark(Serial);
+#endif
+  //
+  // Initiate a BLE connection. The sockets known from the last run are connected
+  // to directly by loop(); scanning is only needed if that fails.
+  BLEDevice::init("");
+#if TREND_VIEW
+  //
+  // The chart's sprite is allocated after BLE, which needs its RAM more
+  trend.begin();
+#endif
+#if HISTORY_VIEW
+  touch.begin(onTouch);
+#endif
+  pinMode(VIEW_BUTTON, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(VIEW_BUTTON), onViewButton, FALLING);
+  loadSockets();
+  //
+  // Retrieve a Scanner and set the callback we want to use to be informed when we
+  // have detected a new device. Specify that we want active scanning. The scans
+  // are started (without blocking) by loop().
+  BLEScan *pBLEScan = BLEDevice::getScan();
+  pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
+  pBLEScan->setInterval(config.scanIntervalMs);
+  pBLEScan->setWindow(config.scanWindowMs);
+  pBLEScan->setActiveScan(true);
+  //
+  // Start the pipeline. The ingest task is created last: until then notifyCallback() has nobody to wake.
+  xTaskCreatePinnedToCore(storageTask, "storage", STORAGE_STACK, NULL, STORAGE_PRIORITY, &storageHandle, STORAGE_CORE);
+#if SINK_DISPLAY
+  xTaskCreatePinnedToCore(uiTask, "ui", UI_STACK, NULL, UI_PRIORITY, &uiStats.handle, UI_CORE);
+#endif
+  xTaskCreatePinnedToCore(ingestTask, "ingest", INGEST_STACK, NULL, INGEST_PRIORITY, &ingestHandle, INGEST_CORE);
+  storageStats.handle = storageHandle;
+  ingestStats.handle = ingestHandle;
+#if CAPTURE_REPLAY
+  xTaskCreatePinnedToCore(replayTask, "replay", REPLAY_STACK, NULL, REPLAY_PRIORITY, &replayStats.handle, REPLAY_CORE);
+#endif
+#if NET_EXPORT || HTTP_SERVER
+  wifiBegin();
+#endif
+#if NET_EXPORT
+  xTaskCreatePinnedToCore(netTask, "net", NET_STACK, NULL, NET_PRIORITY, &netStats.handle, NET_CORE);
+#endif
+#if HTTP_SERVER
+  xTaskCreatePinnedToCore(httpTask, "http", HTTP_STACK, NULL, HTTP_PRIORITY, &httpStats.handle, HTTP_CORE);
+#endif
+  //
+  // Record the start time
+  statsTime = millis();
+  scanTime = statsTime;
+#if HEALTH_LOG
+  healthTime = statsTime;
+#endif
+}  // End of setup.
+
+//////////////
+
+void loop() {
+  // The Arduino loopTask only looks after the BLE connections. Each pass makes at most
+  // one blocking BLE call per socket; the logging and the display run in their own tasks.
+  //
+  uint32_t currentTime = millis();
+  //
+  if (currentTime - statsTime >= LOG_STATS_MS) {
+    printStats(currentTime - statsTime);
+    statsTime = currentTime;
+  }
+  //
+  // Save the energy totals to NVS when they are due (the flash writes stay off the sample path)
+  checkpoint.poll();
+#if HEALTH_LOG
+  //
+  // A health record when it is due; during a soak, drop the links of the live sockets now and then
+  if (currentTime - healthTime >= health.intervalMs()) {
+    healthTime = currentTime;
+    takeHealth();
+  }
+#if CAPTURE_REPLAY
+  if (health.soaking() && replaySlots == 0) {
+    health.soakStop(Serial);   // SOAK_DEVICE is cleared: no log, tag or energy of the soak left in it
+  } else if (health.soaking() && currentTime - soakDropTime >= SOAK_RECONNECT_MS) {
+    soakDropTime = currentTime;
+    for (int i = 0; i < MAX_SOCKETS; i++) {
+      if (!sockets[i].connected) continue;
+      sockets[i].client->disconnect();   // onDisconnect() starts the reconnection
+      health.soakDropped();
+    }
+  }
+#endif
+#endif
+  //
+  // Serial commands: 's' prints the statistics now, 'p' the performance histograms, 'r' resets them;
+  // 'w' the next power mode; 'e' resets the energy counter of the sockets, 'b' sets their backlight time
+  // to the next of socketBacklights; 'k' starts or stops the soak (health.h); for the capture and
+  // replay commands see CAPTURE_REPLAY
+  while (Serial.available()) {
+    char command = Serial.read();
+    switch (command) {
+      case 's': printStats(currentTime - statsTime); break;
+      case 'w':
+        powerRequested = (powerRequested + 1) % POWER_MODES;
+        powerApply(powerRequested, Serial);
+        break;
+      case 'e':
+      case 'b':
+        if (command == 'b') backlightIndex = (backlightIndex + 1) % (sizeof(socketBacklights)/sizeof(socketBacklights[0]));
+        for (int i = 0; i < MAX_SOCKETS; i++) {
+          if (!sockets[i].used) continue;
+          bool queued = command == 'e' ? sockets[i].commands.post(ATORCH_CMD_RESET_ENERGY, 0, currentTime)
+                                       : sockets[i].commands.post(ATORCH_CMD_BACKLIGHT, socketBacklights[backlightIndex], currentTime);
+          Serial.printf("Socket %d: %s %s\r\n", i + 1, command == 'e' ? "energy reset" : "backlight time", queued ? "queued" : "not queued, too many commands");
+        }
+        break;
+#if PERF_ENABLE
+      case 'p': perfPrint(Serial); break;
+      case 'r': perfReset(); Serial.println("Performance statistics reset"); break;
+#endif
+#if CAPTURE_REPLAY
+      case 'c': case 'y': case 'g': case 'x': case '+': case '-':
+        replayCommand(command);
+        break;
+#endif
+#if CAPTURE_REPLAY && HEALTH_LOG
+      case 'k':
+        soakCommand(currentTime);
+        break;
+#endif
+      default: break;
+    }
+  }
+  //
+  loopStats.wake();
+  bool waiting = false, busy = false, room = false, known = false;
+  if (scanEnded) {
+    // Nobody we are waiting for was heard during a whole scan: back off before the next
+    scanEnded = false;
+    for (int i = 0; i < MAX_SOCKETS; i++) {
+      if (sockets[i].used && sockets[i].link.state() == LINK_SCANNING && !sockets[i].advertised) {
+        sockets[i].link.failed(currentTime);
+      }
+    }
+  }
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    Socket &socket = sockets[i];
+    if (!socket.used) {
+      room = true;
+      continue;
+    }
+    known = true;
+    if (givenToReplay(socket)) continue;   // its link waits until the replay is over
+    serviceLink(socket, millis());
+    LinkState state = socket.link.state();
+    if (state == LINK_SCANNING) waiting = true;
+    if (state == LINK_CONNECTING || state == LINK_DISCOVERING) busy = true;
+  }
+  //
+  // Scan (without blocking) for the known sockets that are waiting for an advertisement,
+  // and for new ones: all the time until the first is found, then every SCAN_PERIOD_MS
+  // while the table has room. Not while connecting.
+  currentTime = millis();
+  if (!scanning && !busy && (waiting || (room && (!known || currentTime - scanTime >= SCAN_PERIOD_MS)))) {
+    scanTime = currentTime;
+    scanning = BLEDevice::getScan()->start(SCAN_SECONDS, scanComplete, false);
+  }
+  //
+  // Write the commands that are due to the sockets
+  uint32_t commandMs = COMMAND_IDLE_MS;
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    Socket &socket = sockets[i];
+    if (socket.used) commandMs = min(commandMs, socket.commands.poll(socket.characteristic, socket.connected, ATORCH_DEV_AC_METER, millis()));
+  }
+  //
+  // Sleep until the next thing is due: the statistics, a step of a link, the next command or
+  // the next scan. Advertisements, disconnections, the end of a scan and Serial input wake the loop earlier.
+  currentTime = millis();
+  uint32_t waitMs = LOG_STATS_MS - min(currentTime - statsTime, (uint32_t)LOG_STATS_MS);
+#if HEALTH_LOG
+  waitMs = min(waitMs, health.intervalMs() - min(currentTime - healthTime, health.intervalMs()));
+#if CAPTURE_REPLAY
+  if (health.soaking()) waitMs = min(waitMs, SOAK_RECONNECT_MS - min(currentTime - soakDropTime, (uint32_t)SOAK_RECONNECT_MS));
+#endif
+#endif
+  waitMs = min(waitMs, commandMs);
+  for (int i = 0; i < MAX_SOCKETS; i++) {
+    if (sockets[i].used) waitMs = min(waitMs, sockets[i].link.idleMs(currentTime));
+  }
+  if (!scanning && room && known) waitMs = min(waitMs, SCAN_PERIOD_MS - min(currentTime - scanTime, (uint32_t)SCAN_PERIOD_MS));
+  if (busy || (waiting && !scanning)) waitMs = 0;
+  loopStats.sleep();
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(max(waitMs, (uint32_t)LOOP_MIN_MS)));
+  loopWakeups++;
+  //
+};// End of loop
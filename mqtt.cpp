@@ -0,0 +1,101 @@
+/**
+  mqtt.cpp - minimal MQTT 3.1.1 publisher (see mqtt.h)
+*/
+//
+#include "mqtt.h"
+//
+#define MQTT_CONNECT    0x10
+#define MQTT_CONNACK    0x20
+#define MQTT_PUBLISH    0x30   // QoS 0, no retain
+#define MQTT_PINGREQ    0xC0
+
+//////////////
+
+bool MqttPublisher::sendHeader(uint8_t type, size_t remaining) {
+  // Fixed header: the packet type, and the length of the rest as a base-128 varint
+  uint8_t header[5];
+  size_t n = 0;
+  header[n++] = type;
+  do {
+    uint8_t b = remaining & 0x7F;
+    remaining >>= 7;
+    header[n++] = remaining ? (b | 0x80) : b;
+  } while (remaining && n < sizeof(header));
+  return client->write(header, n) == n;
+}
+
+//////////////
+
+bool MqttPublisher::sendString(const char *s) {
+  size_t len = strlen(s);
+  uint8_t prefix[2] = { (uint8_t)(len >> 8), (uint8_t)len };
+  return client->write(prefix, 2) == 2 && client->write((const uint8_t *)s, len) == len;
+}
+
+//////////////
+
+bool MqttPublisher::connect(Client &c, const char *host, uint16_t port, const char *clientId) {
+  client = &c;
+  if (!client->connect(host, port)) return false;
+  //
+  static const uint8_t variable[] = { 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, MQTT_KEEPALIVE_S >> 8, MQTT_KEEPALIVE_S & 0xFF };
+  if (!sendHeader(MQTT_CONNECT, sizeof(variable) + 2 + strlen(clientId)) ||
+      client->write(variable, sizeof(variable)) != sizeof(variable) || !sendString(clientId)) {
+    client->stop();
+    return false;
+  }
+  //
+  // CONNACK: 0x20 0x02 flags return-code
+  uint8_t ack[4];
+  size_t got = 0;
+  uint32_t start = millis();
+  while (got < sizeof(ack) && millis() - start < MQTT_CONNACK_MS) {
+    int b = client->read();
+    if (b < 0) {
+      delay(10);
+      continue;
+    }
+    ack[got++] = (uint8_t)b;
+  }
+  if (got < sizeof(ack) || ack[0] != MQTT_CONNACK || ack[3] != 0) {
+    Serial.printf("MQTT broker %s refused the connection (%d)\r\n", host, got == sizeof(ack) ? ack[3] : -1);
+    client->stop();
+    return false;
+  }
+  lastSendMs = millis();
+  return true;
+}
+
+//////////////
+
+bool MqttPublisher::publish(const char *topic, const uint8_t *payload, size_t len) {
+  if (!connected()) return false;
+  bool ok = sendHeader(MQTT_PUBLISH, 2 + strlen(topic) + len) && sendString(topic) &&
+            client->write(payload, len) == len;
+  if (!ok) client->stop();
+  lastSendMs = millis();
+  return ok;
+}
+
+//////////////
+
+void MqttPublisher::poll() {
+  if (!connected()) return;
+  while (client->available()) client->read();   // PINGRESP
+  if (millis() - lastSendMs >= MQTT_KEEPALIVE_S * 500UL) {
+    if (!sendHeader(MQTT_PINGREQ, 0)) client->stop();
+    lastSendMs = millis();
+  }
+}
+
+//////////////
+
+void MqttPublisher::stop() {
+  if (client) client->stop();
+}
+
+//////////////
+
+bool MqttPublisher::connected() {
+  return client && client->connected();
+}
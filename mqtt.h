@@ -0,0 +1,33 @@
+/**
+  mqtt.h - minimal MQTT 3.1.1 publisher
+
+  Just what the network export needs: CONNECT (clean session, no credentials
+  or will), PUBLISH at QoS 0, and PINGREQ to keep an idle connection alive.
+  Anything the broker sends after the CONNACK (PINGRESP) is read and dropped.
+  The calls block for at most the Client timeout, so they are made from the
+  network task only.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "Client.h"
+//
+#define MQTT_KEEPALIVE_S   60     // the broker drops the connection after 1.5 times this without a packet [s]
+#define MQTT_CONNACK_MS    3000   // how long connect() waits for the broker's answer [ms]
+
+class MqttPublisher {
+public:
+  bool connect(Client &client, const char *host, uint16_t port, const char *clientId);
+  bool publish(const char *topic, const uint8_t *payload, size_t len);
+  void poll();   // keep-alive; call regularly
+  void stop();
+  bool connected();
+
+private:
+  bool sendHeader(uint8_t type, size_t remaining);
+  bool sendString(const char *s);
+  //
+  Client *client = nullptr;
+  uint32_t lastSendMs = 0;
+};
@@ -0,0 +1,149 @@
+/**
+  net_export.cpp - streaming of the samples over Wi-Fi (see net_export.h)
+*/
+//
+#include <sys/time.h>
+#include "net_export.h"
+#include "format.h"
+#include "log_index.h"
+#include "perf.h"
+#include "esp_timer.h"
+
+//////////////
+
+void wifiBegin() {
+  WiFi.mode(WIFI_STA);
+  WiFi.setSleep(true);         // modem sleep: needed with BLE on the same radio
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(NET_SSID, NET_PASSWORD);
+}
+
+//////////////
+
+void NetExport::begin(const char *(*tagOfDevice)(uint8_t device)) {
+  tagOf = tagOfDevice;
+  uint32_t n = psramFound() ? NET_BACKLOG_PSRAM : NET_BACKLOG;
+  Record *buffer = (Record *)(psramFound() ? ps_malloc(n * sizeof(Record)) : malloc(n * sizeof(Record)));
+  backlog.begin(buffer, n);
+  //
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  for (int i = 0; i < 6; i++) sprintf(board + 2*i, "%02X", mac[i]);
+  snprintf(topic, sizeof(topic), "%s/%s", NET_TOPIC, board);
+  Serial.printf("Network export to %s:%d (%s), board %s, backlog %lu records\r\n", NET_HOST, NET_PORT,
+                NET_PROTOCOL == NET_MQTT ? "MQTT" : "UDP", board, (unsigned long)backlog.capacity());
+}
+
+//////////////
+
+void NetExport::add(const Record &record) {
+  if (backlog.used() == 0) oldestMs = millis();
+  backlog.push(record);
+  if (backlog.used() > backlogHigh) backlogHigh = backlog.used();
+}
+
+//////////////
+
+bool NetExport::connectLink() {
+  // Wi-Fi reconnects by itself; the host name is looked up, and the broker connected, once it is up
+  //
+  if (WiFi.status() != WL_CONNECTED) {
+    if (wifiUp) linkLosses++;
+    wifiUp = up = false;
+    return false;
+  }
+  if (!wifiUp) {
+    wifiUp = true;
+    Serial.printf("Wi-Fi connected, %s, RSSI %d dBm\r\n", WiFi.localIP().toString().c_str(), WiFi.RSSI());
+    if (!clockEpoch()) configTime(0, 0, NET_NTP_SERVER);
+    if (!WiFi.hostByName(NET_HOST, hostIp)) {
+      Serial.printf("Cannot resolve %s\r\n", NET_HOST);
+      wifiUp = false;
+      return false;
+    }
+    lastTryMs = millis() - NET_RETRY_MS;
+  }
+  if (NET_PROTOCOL == NET_MQTT) {
+    if (!mqtt.connected()) {
+      if (up) linkLosses++;
+      up = false;
+      if (millis() - lastTryMs < NET_RETRY_MS) return false;
+      lastTryMs = millis();
+      if (!mqtt.connect(tcp, NET_HOST, NET_PORT, board)) return false;
+      Serial.printf("MQTT connected to %s, topic %s\r\n", NET_HOST, topic);
+    }
+    mqtt.poll();
+  } else if (!up) {
+    udp.begin(0);
+  }
+  up = true;
+  return true;
+}
+
+//////////////
+
+uint64_t NetExport::epochMs(int64_t us) const {
+  // The wall-clock time of a sample taken at us (esp_timer); 0 while the clock is not set
+  if (!clockEpoch()) return 0;
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  int64_t nowUs = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+  return (uint64_t)((nowUs + (us - esp_timer_get_time())) / 1000);
+}
+
+//////////////
+
+bool NetExport::send(const char *packet, size_t len) {
+  PERF_SCOPE(PERF_NET_PUBLISH);
+  if (NET_PROTOCOL == NET_MQTT) return mqtt.publish(topic, (const uint8_t *)packet, len);
+  return udp.beginPacket(hostIp, NET_PORT) && udp.write((const uint8_t *)packet, len) == len && udp.endPacket();
+}
+
+//////////////
+
+void NetExport::poll() {
+  static char packet[NET_PACKET_SIZE];
+  char line[NET_LINE_LEN];
+  //
+  if (!connectLink()) return;
+  while (backlog.used() >= NET_BATCH || (backlog.used() > 0 && millis() - oldestMs >= NET_BATCH_MS)) {
+    // As many of the oldest records as fit, then send them; they are removed only if that worked
+    size_t len = 0;
+    uint32_t n = 0;
+    Record record;
+    while (n < NET_BATCH && backlog.peek(n, record)) {
+      size_t lineLen = formatLine(line, board, tagOf(record.sample.device), record.sample, record.kwh1e5(),
+                                  epochMs(record.sample.us));
+      if (len + lineLen > sizeof(packet)) break;
+      memcpy(packet + len, line, lineLen);
+      len += lineLen;
+      n++;
+    }
+    if (n == 0) break;
+    int64_t startUs = esp_timer_get_time();
+    bool sent = send(packet, len);
+    uint32_t us = (uint32_t)(esp_timer_get_time() - startUs);
+    totalSendUs += us;
+    if (us > maxSendUs) maxSendUs = us;
+    if (!sent) {
+      failures++;
+      return;   // try again on the next poll
+    }
+    packets++;
+    records += n;
+    backlog.drop(n);
+    oldestMs = millis();   // the rest are newer (close enough)
+  }
+}
+
+//////////////
+
+void NetExport::printStats(Print &out) const {
+  out.printf("Network: %s, %lu packets (%lu records), %lu failed, %lu link losses, publish avg %lu us, max %lu us; "
+             "backlog %lu/%lu records (high water %lu), %lu lost\r\n",
+             up ? "up" : wifiUp ? "Wi-Fi up, no broker" : "Wi-Fi down",
+             (unsigned long)packets, (unsigned long)records, (unsigned long)failures, (unsigned long)linkLosses,
+             (unsigned long)(packets + failures ? totalSendUs / (packets + failures) : 0), (unsigned long)maxSendUs,
+             (unsigned long)backlog.used(), (unsigned long)backlog.capacity(), (unsigned long)backlogHigh,
+             (unsigned long)backlog.lost());
+}
@@ -0,0 +1,89 @@
+/**
+  net_export.h - streaming of the samples over Wi-Fi
+
+  The network task gets every record the SD logger gets (its own queue from
+  the ingest task) and keeps them in a bounded backlog (a RecordSpool,
+  in PSRAM if there is any). Whenever NET_BATCH records are waiting, or the
+  oldest has waited NET_BATCH_MS, up to NET_BATCH of them are sent as one packet
+  of InfluxDB line protocol (formatLine()), as a UDP datagram or an MQTT
+  publish (QoS 0) on NET_TOPIC/<board>. The records leave the backlog only
+  once their packet was sent; while Wi-Fi or the broker is down the backlog
+  fills up, and then drops its oldest records (counted).
+
+  BLE and Wi-Fi share the radio. The Wi-Fi modem sleeps between beacons,
+  which the ESP32 requires for the two to coexist.
+
+  The settings below can be given as build flags (-DNET_SSID=\"...\").
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "spool.h"
+#include "mqtt.h"
+//
+#define NET_UDP   0
+#define NET_MQTT  1
+#ifndef NET_PROTOCOL
+#define NET_PROTOCOL  NET_UDP
+#endif
+#ifndef NET_SSID
+#define NET_SSID      ""
+#endif
+#ifndef NET_PASSWORD
+#define NET_PASSWORD  ""
+#endif
+#ifndef NET_HOST
+#define NET_HOST      "192.168.1.10"   // the collector (Telegraf/InfluxDB UDP listener) or MQTT broker
+#endif
+#ifndef NET_PORT
+#define NET_PORT      (NET_PROTOCOL == NET_MQTT ? 1883 : 8089)
+#endif
+#ifndef NET_TOPIC
+#define NET_TOPIC     "cyd"
+#endif
+#define NET_NTP_SERVER     "pool.ntp.org"   // sets the clock once Wi-Fi is up (timestamps, dated log files)
+#define NET_BATCH          10        // records in one packet
+#define NET_BATCH_MS       10000     // ... or fewer, once the oldest has waited this long [ms]
+#define NET_PACKET_SIZE    1400      // fits one Ethernet frame
+#define NET_RETRY_MS       10000     // how often to try the broker again [ms]
+#define NET_BACKLOG        256       // records kept while the link is down (internal RAM)
+#define NET_BACKLOG_PSRAM  16384     // ... with PSRAM
+
+// The Wi-Fi station (NET_SSID), shared with the HTTP server: started by setup(), before the tasks using it
+void wifiBegin();
+
+class NetExport {
+public:
+  // tagOf(device) names the socket of a record
+  void begin(const char *(*tagOf)(uint8_t device));
+  void add(const Record &record);   // into the backlog
+  void poll();                      // connect, and send the batches that are due
+  //
+  bool linkUp() const { return up; }
+  void printStats(Print &out) const;
+
+private:
+  bool connectLink();               // Wi-Fi, and the broker with MQTT
+  bool send(const char *packet, size_t len);
+  uint64_t epochMs(int64_t us) const;
+  //
+  const char *(*tagOf)(uint8_t device) = nullptr;
+  char board[13];                   // Wi-Fi MAC address, 12 hex digits
+  char topic[32];
+  RecordSpool backlog;
+  uint32_t oldestMs = 0;            // millis() when the oldest record in the backlog was added (about)
+  uint32_t backlogHigh = 0;
+  bool up = false, wifiUp = false;
+  IPAddress hostIp;
+  uint32_t lastTryMs = 0;
+  WiFiUDP udp;
+  WiFiClient tcp;
+  MqttPublisher mqtt;
+  //
+  uint32_t packets = 0, records = 0, failures = 0, linkLosses = 0;
+  uint32_t maxSendUs = 0;
+  uint64_t totalSendUs = 0;
+};
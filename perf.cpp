@@ -0,0 +1,96 @@
+/**
+  perf.cpp - latency histograms and counters of the hot paths (see perf.h)
+*/
+//
+#include <string.h>
+#include "perf.h"
+#include "format.h"
+
+//////////////
+
+void PerfHistogram::add(uint32_t us) {
+  int b = us ? 32 - __builtin_clz(us) : 0;
+  bucket[b < PERF_BUCKETS ? b : PERF_BUCKETS - 1]++;
+  count++;
+  totalUs += us;
+  if (us > maxUs) maxUs = us;
+}
+
+//////////////
+
+uint32_t PerfHistogram::percentileUs(uint32_t permille) const {
+  if (count == 0) return 0;
+  uint64_t target = ((uint64_t)count * permille + 999) / 1000;
+  uint32_t sum = 0;
+  for (int b = 0; b < PERF_BUCKETS - 1; b++) {
+    sum += bucket[b];
+    if (sum >= target) return b ? (1UL << b) - 1 : 0;
+  }
+  return maxUs;
+}
+
+#if PERF_ENABLE
+//
+PerfHistogram perfHistograms[PERF_POINTS];
+std::atomic<uint32_t> perfCounters[PERF_COUNTERS];
+//
+static const char *pointNames[PERF_POINTS] = { "decode", "integrate", "format", "SD write", "TFT draw", "BLE write", "net publish" };
+static const char *counterNames[PERF_COUNTERS] = { "frames received", "frames logged", "frames dropped" };
+
+//////////////
+
+static char *fmtPadded(char *out, const char *s, int width) {
+  char *p = fmtStr(out, s);
+  while (p - out < width) *p++ = ' ';
+  *p = '\0';
+  return p;
+}
+
+size_t perfLine(char *out, int point) {
+  const PerfHistogram &h = perfHistograms[point];
+  char *p = fmtPadded(out, pointNames[point], 10);
+  p = fmtFixed(p, h.count, 0, 8);
+  p = fmtFixed(p, h.avgUs(), 0, 7);
+  p = fmtFixed(p, h.percentileUs(500), 0, 7);
+  p = fmtFixed(p, h.percentileUs(990), 0, 7);
+  p = fmtFixed(p, h.maxUs, 0, 7);
+  return p - out;
+}
+
+//////////////
+
+size_t perfCounterLine(char *out, int counter) {
+  char *p = fmtPadded(out, counterNames[counter], 17);
+  p = fmtFixed(p, perfCounters[counter].load(std::memory_order_relaxed), 0, 10);
+  return p - out;
+}
+
+//////////////
+
+void perfPrint(Print &out) {
+  char line[PERF_LINE_LEN];
+  out.println(PERF_HEADER);
+  for (int i = 0; i < PERF_POINTS; i++) {
+    perfLine(line, i);
+    out.println(line);
+  }
+  out.print("Histograms (bucket b: 2^(b-1) to 2^b-1 us):");
+  for (int i = 0; i < PERF_POINTS; i++) {
+    out.printf("\r\n  %-10s", pointNames[i]);
+    for (int b = 0; b < PERF_BUCKETS; b++) out.printf(" %lu", (unsigned long)perfHistograms[i].bucket[b]);
+  }
+  out.println();
+  for (int i = 0; i < PERF_COUNTERS; i++) {
+    perfCounterLine(line, i);
+    out.println(line);
+  }
+}
+
+//////////////
+
+void perfReset() {
+  // Not atomic with respect to the tasks timing; a sample or two may be lost across a reset
+  memset(perfHistograms, 0, sizeof(perfHistograms));
+  for (int i = 0; i < PERF_COUNTERS; i++) perfCounters[i].store(0, std::memory_order_relaxed);
+}
+#endif
@@ -0,0 +1,83 @@
+/**
+  perf.h - latency histograms and counters of the hot paths
+
+  PERF_SCOPE(point) at the top of a block times the block with esp_timer and
+  adds the time to the histogram of point. Each point is timed by one task
+  only, so the histograms need no locking; the counters may be bumped from
+  several tasks and are atomic.
+
+  Histogram bucket b counts the times of b significant bits: bucket 0 is
+  0 us, bucket 1 is 1 us, bucket 2 is 2-3 us, ... bucket 15 is 16.4 ms or more.
+
+  With PERF_ENABLE 0 the macros expand to nothing, so the instrumented code
+  is exactly the uninstrumented code.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include <atomic>
+#include "esp_timer.h"
+//
+#ifndef PERF_ENABLE
+#define PERF_ENABLE  1
+#endif
+#define PERF_BUCKETS     16
+#define PERF_LINE_LEN    64    // buffer size that holds any perfLine()
+#define PERF_HEADER      "Time [us]    count    avg    p50    p99    max"   // column titles of perfLine()
+
+enum PerfPoint {
+  PERF_DECODE,       // atorchDecode() (BLE task)
+  PERF_INTEGRATE,    // EnergyIntegrator::add() (ingest task)
+  PERF_FORMAT,       // formatCsv() (storage task)
+  PERF_SD_WRITE,     // one SdLogger write to the card (storage task)
+  PERF_TFT_DRAW,     // one frame of the dashboard or the chart (ui task)
+  PERF_BLE_WRITE,    // a command written to the socket (loop, command_queue.h)
+  PERF_NET_PUBLISH,  // one packet of the network export (net task)
+  PERF_POINTS
+};
+
+enum PerfCounter {
+  PERF_FRAMES_RECEIVED,   // valid report frames
+  PERF_FRAMES_LOGGED,     // records queued for the SD card
+  PERF_FRAMES_DROPPED,    // frames lost to a full queue or logger
+  PERF_COUNTERS
+};
+
+struct PerfHistogram {
+  uint32_t bucket[PERF_BUCKETS];
+  uint32_t count, maxUs;
+  uint64_t totalUs;
+  //
+  void add(uint32_t us);
+  uint32_t avgUs() const { return count ? (uint32_t)(totalUs / count) : 0; }
+  uint32_t percentileUs(uint32_t permille) const;   // upper edge of the bucket holding that fraction of the times
+};
+
+#if PERF_ENABLE
+extern PerfHistogram perfHistograms[PERF_POINTS];
+extern std::atomic<uint32_t> perfCounters[PERF_COUNTERS];
+
+class PerfScope {
+public:
+  explicit PerfScope(PerfPoint p) : point(p), start(esp_timer_get_time()) {}
+  ~PerfScope() { perfHistograms[point].add((uint32_t)(esp_timer_get_time() - start)); }
+private:
+  PerfPoint point;
+  int64_t start;
+};
+
+#define PERF_CONCAT2(a, b)   a##b
+#define PERF_CONCAT(a, b)    PERF_CONCAT2(a, b)
+#define PERF_SCOPE(point)    PerfScope PERF_CONCAT(perfScope, __LINE__)(point)
+#define PERF_COUNT(counter)  perfCounters[counter].fetch_add(1, std::memory_order_relaxed)
+
+// One line of text per point ("name  count  avg  p50  p99  max [us]"), and per counter ("name  value")
+size_t perfLine(char *out, int point);
+size_t perfCounterLine(char *out, int counter);
+void perfPrint(Print &out);   // everything, with the histograms
+void perfReset();
+#else
+#define PERF_SCOPE(point)
+#define PERF_COUNT(counter)
+#endif
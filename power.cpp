@@ -0,0 +1,94 @@
+/**
+  power.cpp - CPU clock, light sleep and backlight (see power.h)
+*/
+//
+#include "power.h"
+#include "esp_pm.h"
+//
+static int current = POWER_FULL;
+static bool pmUsed = false;     // esp_pm is in charge of the clock
+static bool backlightOn = true;
+static bool backlightAttached = false;
+
+//////////////
+
+static esp_err_t configurePm(int maxMhz, int minMhz, bool lightSleep) {
+  esp_pm_config_esp32_t config;
+  config.max_freq_mhz = maxMhz;
+  config.min_freq_mhz = minMhz;
+  config.light_sleep_enable = lightSleep;
+  return esp_pm_configure(&config);
+}
+
+//////////////
+
+bool powerApply(int mode, Print &out) {
+  // Try the mode, then the next lower one that the core supports
+  //
+  esp_err_t err = ESP_OK;
+  int applied = mode;
+  if (mode == POWER_SLEEP && (err = configurePm(POWER_MAX_MHZ, POWER_MIN_MHZ, true)) != ESP_OK) applied = POWER_SCALED;
+  esp_err_t e = ESP_OK;
+  if (applied == POWER_SCALED) e = configurePm(POWER_MAX_MHZ, POWER_MIN_MHZ, false);
+  if (applied == POWER_FULL) e = configurePm(POWER_MAX_MHZ, POWER_MAX_MHZ, false);
+  pmUsed = e == ESP_OK;
+  if (!pmUsed) {
+    // No power manager: set the clock directly, the low one for POWER_SCALED
+    setCpuFrequencyMhz(applied == POWER_FULL ? POWER_MAX_MHZ : POWER_MIN_MHZ);
+    if (err == ESP_OK) err = e;
+  }
+  current = applied;
+  if (backlightAttached) backlightSet(backlightOn);   // the dim level depends on the mode
+  //
+  if (applied != mode || (applied != POWER_FULL && !pmUsed)) {
+    out.printf("Power mode %s not supported (%s), using %s%s\r\n", powerModeName(mode), esp_err_to_name(err),
+               powerModeName(applied), pmUsed ? "" : " at a fixed clock");
+    return false;
+  }
+  out.printf("Power mode %s\r\n", powerModeName(applied));
+  return true;
+}
+
+//////////////
+
+int powerMode() {
+  return current;
+}
+
+//////////////
+
+const char *powerModeName(int mode) {
+  static const char *names[POWER_MODES] = {"full speed", "frequency scaling", "light sleep"};
+  return mode >= 0 && mode < POWER_MODES ? names[mode] : "?";
+}
+
+//////////////
+
+void backlightBegin(int pin) {
+  ledcSetup(BACKLIGHT_CHANNEL, 5000, 8);
+  ledcAttachPin(pin, BACKLIGHT_CHANNEL);
+  backlightAttached = true;
+  backlightSet(true);
+}
+
+//////////////
+
+void backlightSet(bool bright) {
+  if (!backlightAttached) return;   // no backlight pin: always on
+  backlightOn = bright;
+  ledcWrite(BACKLIGHT_CHANNEL, bright ? BACKLIGHT_ON : current == POWER_SLEEP ? 0 : BACKLIGHT_DIM);
+}
+
+//////////////
+
+bool backlightBright() {
+  return backlightOn;
+}
+
+//////////////
+
+void powerPrintStats(Print &out) {
+  out.printf("Power: %s, CPU %lu MHz%s, backlight %s\r\n", powerModeName(current),
+             (unsigned long)getCpuFrequencyMhz(), pmUsed && current != POWER_FULL ? " (scaled)" : "",
+             backlightOn ? "on" : "dimmed");
+}
@@ -0,0 +1,53 @@
+/**
+  power.h - CPU clock, light sleep and backlight
+
+  The samples arrive once a second and every task blocks until it has work,
+  so the CPU is idle nearly all the time. With POWER_SCALED the power manager
+  (esp_pm) lowers the clock to POWER_MIN_MHZ while no task holds it up; with
+  POWER_SLEEP it also enters light sleep in the idle task. The BLE controller
+  keeps the chip awake around its connection events (and altogether, if the
+  board has no 32 kHz crystal for the BLE sleep clock), so the link is kept
+  either way. The APB clock stays at 80 MHz down to POWER_MIN_MHZ, so the
+  display and SD card SPI timings do not change.
+
+  esp_pm needs CONFIG_PM_ENABLE, and light sleep CONFIG_FREERTOS_USE_TICKLESS_IDLE,
+  in the core's sdkconfig. Without them powerApply() falls back to a fixed
+  POWER_MIN_MHZ clock, or full speed, and says so.
+
+  The TFT backlight is dimmed after BACKLIGHT_DIM_MS without a button press.
+  The LEDC timer stops in light sleep, so with POWER_SLEEP "dim" means off.
+
+  The mode can be changed at run time (Serial 'w'), so the supply current
+  can be compared on a USB power meter without rebuilding.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+//
+#define POWER_FULL    0    // POWER_MAX_MHZ all the time
+#define POWER_SCALED  1    // dynamic frequency scaling between POWER_MIN_MHZ and POWER_MAX_MHZ
+#define POWER_SLEEP   2    // ... and automatic light sleep when every task is idle
+#define POWER_MODES   3
+#ifndef POWER_MODE
+#define POWER_MODE    POWER_FULL
+#endif
+#define POWER_MAX_MHZ 240
+#define POWER_MIN_MHZ 80   // the lowest clock with an 80 MHz APB (SPI, UART, BLE)
+//
+#define BACKLIGHT_CHANNEL  7       // LEDC channel
+#define BACKLIGHT_ON       256     // duty (8 bits; 256 is always on, no PWM)
+#define BACKLIGHT_DIM      24      // ... after BACKLIGHT_DIM_MS without a button press
+#ifndef BACKLIGHT_DIM_MS
+#define BACKLIGHT_DIM_MS   120000  // 0: never dim [ms]
+#endif
+
+bool powerApply(int mode, Print &out);   // false if the mode is not supported (a fallback was applied)
+int powerMode();                         // the mode in effect
+const char *powerModeName(int mode);
+//
+void backlightBegin(int pin);
+void backlightSet(bool bright);
+bool backlightBright();
+//
+void powerPrintStats(Print &out);
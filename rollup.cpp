@@ -0,0 +1,63 @@
+/**
+  rollup.cpp - minute and hour summaries of the sample stream (see rollup.h)
+*/
+//
+#include "rollup.h"
+
+//////////////
+
+void Rollup::set(const Record &record) {
+  const Sample &s = record.sample;
+  uint32_t v[ROLL_CHANNELS] = { s.volts10, s.milliamps, s.watts10, s.pf1000, s.hz10 };
+  startUs = s.us;
+  count = 1;
+  for (int c = 0; c < ROLL_CHANNELS; c++) sum[c] = min[c] = max[c] = v[c];
+  startMWs = endMWs = record.mWs;
+}
+
+//////////////
+
+void Rollup::merge(const Rollup &other) {
+  count += other.count;
+  for (int c = 0; c < ROLL_CHANNELS; c++) {
+    sum[c] += other.sum[c];
+    if (other.min[c] < min[c]) min[c] = other.min[c];
+    if (other.max[c] > max[c]) max[c] = other.max[c];
+  }
+  endMWs = other.endMWs;
+}
+
+//////////////
+
+bool RollupTier::add(const Rollup &rollup) {
+  int64_t start = rollup.startUs - rollup.startUs % periodUs;
+  bool closing = open.count && start != open.startUs;
+  if (closing) close();
+  if (!open.count) {
+    open = rollup;
+    open.startUs = start;
+    // The energy of the interval before the first sample of this period belongs to it
+    if (started) open.startMWs = endMWs;
+    started = true;
+  } else {
+    open.merge(rollup);
+  }
+  return closing;
+}
+
+//////////////
+
+bool RollupTier::poll(int64_t nowUs) {
+  if (!open.count || nowUs < open.startUs + periodUs + ROLLUP_GRACE_US) return false;
+  close();
+  return true;
+}
+
+//////////////
+
+void RollupTier::close() {
+  last = open;
+  endMWs = open.endMWs;
+  open.count = 0;
+  nClosed++;
+}
@@ -0,0 +1,66 @@
+/**
+  rollup.h - minute and hour summaries of the sample stream
+
+  Each tier accumulates, for every channel, the sample count, sum, minimum and
+  maximum, and the energy integrated over its period. The work per sample is
+  constant: a sample becomes a one-sample Rollup that is merged into the minute
+  tier, and each closed minute is merged into the hour tier in the same way.
+
+  Periods are aligned to the time since boot (Sample::us), like the log. A
+  period is closed by the first sample of the next one, or by poll() when no
+  samples arrive (the link is down).
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include "sample.h"
+//
+#define ROLLUP_MINUTE_S   60
+#define ROLLUP_HOUR_S     3600
+#define ROLLUP_GRACE_US   5000000   // poll() closes a period this long after its end, so queued samples still count [us]
+
+enum RollupChannel {
+  ROLL_VOLTS10,     // [V*10]
+  ROLL_MILLIAMPS,   // [mA]
+  ROLL_WATTS10,     // [W*10]
+  ROLL_PF1000,
+  ROLL_HZ10,        // [Hz*10]
+  ROLL_CHANNELS
+};
+
+struct Rollup {
+  int64_t startUs;                  // start of the period [us since boot]
+  uint32_t count;                   // samples
+  uint64_t sum[ROLL_CHANNELS];
+  uint32_t min[ROLL_CHANNELS], max[ROLL_CHANNELS];
+  uint64_t startMWs, endMWs;        // energy total at the start and the end of the period [mWs]
+  //
+  void set(const Record &record);   // a rollup of one sample
+  void merge(const Rollup &other);  // add a later rollup
+  uint32_t mean(int channel) const { return count ? (uint32_t)(sum[channel] / count) : 0; }
+  uint64_t energyMWs() const { return endMWs - startMWs; }
+};
+
+class RollupTier {
+public:
+  explicit RollupTier(uint32_t seconds) : periodUs((int64_t)seconds * 1000000) {}
+  //
+  // Add a sample (or a rollup of a shorter tier). Returns true when this closed
+  // the previous period, which is then available from closed().
+  bool add(const Rollup &rollup);
+  bool poll(int64_t nowUs);         // close the current period if it ended ROLLUP_GRACE_US ago
+  //
+  const Rollup &closed() const { return last; }
+  const Rollup &current() const { return open; }
+  uint32_t periods() const { return nClosed; }
+
+private:
+  void close();
+  //
+  int64_t periodUs;
+  Rollup open = Rollup(), last = Rollup();
+  bool started = false;             // a sample was ever added
+  uint64_t endMWs = 0;              // energy total at the end of the last period
+  uint32_t nClosed = 0;
+};
@@ -0,0 +1,30 @@
+/**
+  sample.h - one energy report from the S1B socket
+
+  The values are kept exactly as the socket sends them (scaled integers),
+  so a sample can be copied between tasks without any float conversion.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+
+struct Sample {
+  int64_t us;          // esp_timer_get_time() when the frame was complete [us since boot]
+  uint32_t seq;        // frame number since boot (a gap means frames were lost)
+  uint32_t volts10;    // voltage [V*10]
+  uint32_t milliamps;  // current [mA]
+  uint32_t watts10;    // power [W*10]
+  uint32_t kwh100;     // energy counted by the socket since its reset [kWh*100]
+  uint16_t hz10;       // frequency [Hz*10]
+  uint16_t pf1000;     // power factor*1000
+  uint8_t device;      // index of the socket in the device table
+};
+
+// A sample after the ingest stage: the frame plus the energy total up to and including it
+struct Record {
+  Sample sample;
+  uint64_t mWs;        // energy integrated since the program started [mWs]
+  //
+  uint64_t kwh1e5() const { return mWs / 36000; }   // the same [kWh*100000]
+};
@@ -0,0 +1,293 @@
+/**
+  sd_logger.cpp - buffered SD card logger (see sd_logger.h)
+*/
+//
+#include "sd_logger.h"
+#include "perf.h"
+#include <unistd.h>
+//
+static const uint8_t zeros[LOG_BLOCK_SIZE] = {};
+
+//////////////
+
+bool SdLogger::begin(fs::FS &fs, const char *path) {
+  return begin(fs, path, 0);
+}
+
+//////////////
+
+bool SdLogger::begin(fs::FS &fs, const char *path, uint32_t extentBytes) {
+  // Open the log file once; it stays open until end()
+  //
+  file = fs.open(path, extentBytes ? FILE_WRITE : FILE_APPEND);
+  if (!file) {
+    Serial.printf("Failed to open %s for logging\r\n", path);
+    opened = false;
+    return false;
+  }
+  strncpy(this->path, path, LOG_PATH_LEN - 1);
+  this->path[LOG_PATH_LEN - 1] = '\0';
+  fileSize = extentBytes ? 0 : file.size();
+  extent = extentBytes;
+  allocated = fileSize;
+  fill = 0;
+  recordsPending = 0;
+  blocksPending = 0;
+  openedMs = millis();
+  opened = true;
+  writeFailed = false;
+  return true;
+}
+
+//////////////
+
+void SdLogger::suspend() {
+  if (!opened) return;
+  file.close();
+  opened = false;
+}
+
+//////////////
+
+bool SdLogger::resume(fs::FS &fs, const char *path) {
+  // Like begin(), but the pending data is kept. A preallocated file is written on where its data ended.
+  //
+  file = fs.open(path, extent ? "r+" : FILE_APPEND);
+  if (!file) return false;
+  if (extent) {
+    file.seek(fileSize);
+  } else {
+    fileSize = file.size();
+  }
+  if (binary && fileSize % LOG_BLOCK_SIZE) {
+    // A block was torn when the card went away: pad it, so the next blocks are aligned again
+    // (the reader skips the torn one, as its CRC fails), and drop the rest of it from the buffer
+    size_t pad = LOG_BLOCK_SIZE - fileSize % LOG_BLOCK_SIZE;
+    if (file.write(zeros, pad) != pad) {
+      file.close();
+      return false;
+    }
+    fileSize += pad;
+    size_t rest = fill % LOG_BLOCK_SIZE;
+    if (rest && blocksPending > 0) {
+      fill -= rest;
+      memmove(buf, buf + rest, fill);
+      recordsPending -= blockRecords[0];
+      totalDropped += blockRecords[0];
+      blocksPending--;
+      memmove(blockRecords, blockRecords + 1, blocksPending * sizeof(blockRecords[0]));
+    }
+  }
+  opened = true;
+  writeFailed = false;
+  return true;
+}
+
+//////////////
+
+void SdLogger::end() {
+  if (!opened) return;
+  flush();
+  file.close();
+  opened = false;
+  if (extent) {
+    // Give the preallocated space back
+    char vfsPath[sizeof(LOG_MOUNT) + LOG_PATH_LEN];
+    snprintf(vfsPath, sizeof(vfsPath), "%s%s", LOG_MOUNT, path);
+    if (truncate(vfsPath, fileSize) != 0) Serial.printf("Failed to truncate %s\r\n", path);
+  }
+}
+
+//////////////
+
+uint32_t SdLogger::recover(fs::FS &fs, const char *path, bool binary) {
+  // Find the end marker written by writeOut(), reading the file from the start
+  //
+  static uint8_t block[LOG_BLOCK_SIZE];
+  File file = fs.open(path, FILE_READ);
+  if (!file) return 0;
+  uint32_t total = file.size(), size = 0;
+  for (;;) {
+    int n = file.read(block, LOG_BLOCK_SIZE);
+    if (n <= 0) break;
+    if (binary) {
+      if (block[0] == 0 && block[1] == 0) break;   // no block magic is 0
+      size += n;
+    } else {
+      const uint8_t *zero = (const uint8_t *)memchr(block, 0, n);
+      if (zero) {
+        size += zero - block;
+        break;
+      }
+      size += n;
+    }
+  }
+  file.close();
+  if (size < total) {
+    char vfsPath[sizeof(LOG_MOUNT) + LOG_PATH_LEN];
+    snprintf(vfsPath, sizeof(vfsPath), "%s%s", LOG_MOUNT, path);
+    if (truncate(vfsPath, size) != 0) Serial.printf("Failed to truncate %s\r\n", path);
+  }
+  return size;
+}
+
+//////////////
+
+bool SdLogger::log(const char *record) {
+  // Append one record to the RAM buffer. Nothing is written to the card here,
+  // unless the buffer is full (which only happens if poll() is not called often enough).
+  //
+  size_t len = strlen(record);
+  if (!opened) {
+    totalDropped++;
+    return false;
+  }
+  if (fill + len > LOG_BUFFER_SIZE) {
+    flush();
+    if (fill + len > LOG_BUFFER_SIZE) {
+      totalDropped++;
+      return false;
+    }
+  }
+  if (fill == 0) oldestMs = millis();
+  memcpy(buf + fill, record, len);
+  fill += len;
+  recordsPending++;
+  return true;
+}
+
+//////////////
+
+bool SdLogger::logBlock(const uint8_t *block, uint16_t records) {
+  // Queue one binary block. All the data is then in whole blocks, so (as long as
+  // the file started empty) every write below is sector-aligned.
+  //
+  binary = true;
+  if (!opened) {
+    totalDropped += records;
+    return false;
+  }
+  if (fill + LOG_BLOCK_SIZE > LOG_BUFFER_SIZE) {
+    flush();
+    if (fill + LOG_BLOCK_SIZE > LOG_BUFFER_SIZE) {
+      totalDropped += records;
+      return false;
+    }
+  }
+  if (fill == 0) oldestMs = millis();
+  memcpy(buf + fill, block, LOG_BLOCK_SIZE);
+  fill += LOG_BLOCK_SIZE;
+  blockRecords[blocksPending++] = records;
+  recordsPending += records;
+  return true;
+}
+
+//////////////
+
+void SdLogger::setFlush(uint32_t bytes, uint32_t ms) {
+  flushBytes = bytes < LOG_BLOCK_SIZE ? LOG_BLOCK_SIZE : bytes > LOG_FLUSH_BYTES ? LOG_FLUSH_BYTES : bytes;
+  flushMs = ms;
+}
+
+//////////////
+
+void SdLogger::poll() {
+  if (!opened || fill == 0) return;
+  //
+  if (fill >= flushBytes) {
+    // Write whole sectors only. The first chunk tops up the partially filled
+    // last sector of the file, so that every later write starts on a sector boundary.
+    size_t head = LOG_BLOCK_SIZE - (fileSize % LOG_BLOCK_SIZE);
+    size_t len = head + ((fill - head) / LOG_BLOCK_SIZE) * LOG_BLOCK_SIZE;
+    writeOut(len);
+  } else if (millis() - oldestMs >= flushMs) {
+    flush();
+  }
+}
+
+//////////////
+
+bool SdLogger::flush() {
+  if (!opened || fill == 0) return true;
+  return writeOut(fill);
+}
+
+//////////////
+
+bool SdLogger::preallocate(size_t len) {
+  // Grow the file by whole extents, so that the data and its end marker fit
+  //
+  uint32_t end = fileSize + len + LOG_BLOCK_SIZE;
+  if (end <= allocated) return true;
+  allocated = (end / extent + 1) * extent;
+  return file.seek(allocated) && file.seek(fileSize);   // FatFs allocates the clusters on a seek past the end
+}
+
+//////////////
+
+bool SdLogger::writeOut(size_t len) {
+  PERF_SCOPE(PERF_SD_WRITE);
+  if (extent) preallocate(len);
+  size_t written = file.write((const uint8_t *)buf, len);
+  if (extent && written == len) {
+    // Mark the end of the data with zeros, up to the next sector boundary (a whole sector if
+    // the data ends on one). The next write starts on the marker.
+    uint32_t end = fileSize + written;
+    file.write(zeros, LOG_BLOCK_SIZE - end % LOG_BLOCK_SIZE);
+    file.seek(end);
+  }
+  file.flush();   // commit the data and the directory entry to the card
+  totalFlushes++;
+  if (written != len) {
+    totalErrors++;
+    writeFailed = true;
+  }
+  if (written == 0) return false;
+  //
+  // Keep whatever was not written (the tail of the buffer) for the next write
+  fill -= written;
+  memmove(buf, buf + written, fill);
+  fileSize += written;
+  totalBytes += written;
+  //
+  if (binary) {
+    // Drop the counts of the blocks that were written
+    size_t done = blocksPending - (fill + LOG_BLOCK_SIZE - 1) / LOG_BLOCK_SIZE;
+    for (size_t i = 0; i < done; i++) recordsPending -= blockRecords[i];
+    blocksPending -= done;
+    memmove(blockRecords, blockRecords + done, blocksPending * sizeof(blockRecords[0]));
+  } else {
+    recordsPending = 0;
+    for (size_t i = 0; i < fill; i++) {
+      if (buf[i] == '\n') recordsPending++;
+    }
+  }
+  if (fill > 0) oldestMs = millis();  // the remainder restarts the flush timer
+  return written == len;
+}
+
+//////////////
+
+uint32_t SdLogger::bytesPerHour() const {
+  uint32_t elapsed = millis() - openedMs;
+  if (elapsed == 0) return 0;
+  return (uint32_t)(totalBytes * 3600000ULL / elapsed);
+}
+
+//////////////
+
+uint32_t SdLogger::flushesPerHour() const {
+  uint32_t elapsed = millis() - openedMs;
+  if (elapsed == 0) return 0;
+  return (uint32_t)((uint64_t)totalFlushes * 3600000ULL / elapsed);
+}
+
+//////////////
+
+void SdLogger::printStats(Print &out) const {
+  out.printf("SD log: %lu B in %lu flushes (%lu B/h, %lu flushes/h), pending %lu records/%lu B, dropped %lu, errors %lu\r\n",
+             (unsigned long)totalBytes, (unsigned long)totalFlushes,
+             (unsigned long)bytesPerHour(), (unsigned long)flushesPerHour(),
+             (unsigned long)recordsPending, (unsigned long)fill,
+             (unsigned long)totalDropped, (unsigned long)totalErrors);
+}
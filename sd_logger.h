@@ -0,0 +1,91 @@
+/**
+  sd_logger.h - buffered SD card logger
+
+  Log records are collected in a preallocated RAM buffer and written to a file
+  that stays open for the whole session. Data reaches the card in 512-byte
+  sector-aligned blocks once LOG_FLUSH_BYTES are pending, or all at once when
+  the oldest record has waited LOG_FLUSH_MS (or the limits of setFlush()). Every write is followed by
+  File::flush(), so a power cut loses at most one flush interval of data.
+
+  A logger holds either text records (log(), one line each) or binary blocks
+  (logBlock(), exactly LOG_BLOCK_SIZE bytes each), never both.
+
+  When the card goes away, suspend() closes the file but keeps whatever could
+  not be written; resume() reopens the file on the remounted card and carries on.
+
+  A file opened with a preallocation is grown in extents of that size ahead of
+  the data, so the cluster chain is not extended by the appends, and the data
+  is written in place. Every write is followed by zeros up to the next sector
+  boundary, so the end of the data stays marked on the card: end() cuts the
+  file to its data, and after a power cut recover() finds the end again.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "FS.h"
+//
+#define LOG_BLOCK_SIZE    512     // SD card sector size [bytes]
+#define LOG_FLUSH_BYTES   4096    // write to the card when this much data is pending [bytes]
+#define LOG_FLUSH_MS      30000   // ... or when the oldest pending record is this old [ms]
+#define LOG_BUFFER_SIZE   (LOG_FLUSH_BYTES + LOG_BLOCK_SIZE)  // RAM buffer, with room for the record that crosses LOG_FLUSH_BYTES
+#define LOG_MOUNT         "/sd"   // mount point of the card (the files are truncated through the VFS)
+#define LOG_PATH_LEN      64      // longest file path
+
+class SdLogger {
+public:
+  bool begin(fs::FS &fs, const char *path);  // open the log file for appending
+  bool begin(fs::FS &fs, const char *path, uint32_t extent);  // create it, preallocated extent bytes at a time
+  void end();                                // flush and close the log file (cut to its data if preallocated)
+  void suspend();                            // close the log file, keeping the pending data (card lost)
+  bool resume(fs::FS &fs, const char *path); // reopen it for appending, after suspend()
+  //
+  bool log(const char *record);  // queue one record; false if it had to be dropped
+  bool logBlock(const uint8_t *block, uint16_t records);  // queue one LOG_BLOCK_SIZE block holding records records
+  void poll();                   // call regularly: writes full blocks, or everything on timeout
+  bool flush();                  // write all pending data now (shutdown, low power, link lost)
+  // Write when bytes are pending (LOG_BLOCK_SIZE to LOG_FLUSH_BYTES), or the oldest record is ms old
+  void setFlush(uint32_t bytes, uint32_t ms);
+  //
+  // After a power cut: cut a preallocated file to its data, which ends at the first zero
+  // byte (text) or zero block (binary). Returns the new size.
+  static uint32_t recover(fs::FS &fs, const char *path, bool binary);
+  //
+  bool isOpen() const { return opened; }
+  bool failed() const { return writeFailed; }   // a write did not complete since begin() or resume()
+  uint32_t pendingRecords() const { return recordsPending; }
+  uint32_t pendingBytes() const { return fill; }
+  uint32_t size() const { return fileSize + fill; }   // the file, once everything is written
+  uint64_t bytesWritten() const { return totalBytes; }
+  uint32_t flushCount() const { return totalFlushes; }
+  uint32_t droppedRecords() const { return totalDropped; }
+  uint32_t writeErrors() const { return totalErrors; }
+  uint32_t bytesPerHour() const;
+  uint32_t flushesPerHour() const;
+  void printStats(Print &out) const;
+
+private:
+  bool writeOut(size_t len);  // write the first len bytes of the buffer to the card
+  bool preallocate(size_t len);  // make sure the next len bytes are allocated, and mark the end of the data
+  //
+  File file;
+  char path[LOG_PATH_LEN];
+  bool opened = false;
+  bool writeFailed = false;
+  char buf[LOG_BUFFER_SIZE];
+  size_t fill = 0;              // bytes pending in buf
+  uint32_t recordsPending = 0;  // complete records (lines, or the records in the blocks) pending in buf
+  bool binary = false;          // logBlock() has been used
+  uint16_t blockRecords[LOG_BUFFER_SIZE / LOG_BLOCK_SIZE];   // records in each pending block (binary)
+  size_t blocksPending = 0;
+  uint32_t oldestMs = 0;        // millis() when the oldest pending byte was queued
+  uint32_t flushBytes = LOG_FLUSH_BYTES, flushMs = LOG_FLUSH_MS;
+  uint32_t fileSize = 0;        // size of the data in the file, used to keep the writes sector-aligned
+  uint32_t extent = 0;          // preallocation step; 0: the file is appended to
+  uint32_t allocated = 0;       // preallocated size of the file
+  uint32_t openedMs = 0;
+  uint64_t totalBytes = 0;
+  uint32_t totalFlushes = 0;
+  uint32_t totalDropped = 0;
+  uint32_t totalErrors = 0;
+};
@@ -0,0 +1,75 @@
+/**
+  sink.h - the outputs of the ingest task, composed at compile time
+
+  Every record the ingest task produces is handed to each sink of a
+  SinkPipeline<...>, in the order listed. A sink is a type with
+
+    static const char *name();
+    static bool consume(const Record &record);   // hand the record on; false if it was dropped
+    static void poll();                          // on every wake of the ingest task (batching timeouts)
+
+  The list is fixed when the firmware is built (main.cpp puts a sink in it
+  when its feature flag is set, and ends it with NoSink so that any sink can
+  be left out), so a sink left out is not compiled at all
+  and costs neither code nor time: the pipeline is a chain of inline calls,
+  with no table of function pointers. Each sink batches in its own way, and
+  most hand the record to a task of their own; the pipeline only times each
+  consume() call and counts what was dropped.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "sample.h"
+
+struct SinkStats {
+  uint32_t records = 0, dropped = 0;
+  uint32_t maxUs = 0;
+  uint64_t totalUs = 0;
+  //
+  void add(uint32_t us, bool consumed) {
+    records++;
+    if (!consumed) dropped++;
+    totalUs += us;
+    if (us > maxUs) maxUs = us;
+  }
+  void print(Print &out, const char *name) const {
+    out.printf("  %-8s %8lu records, %6lu dropped, consume avg %4lu us, max %5lu us\r\n", name,
+               (unsigned long)records, (unsigned long)dropped,
+               (unsigned long)(records ? totalUs / records : 0), (unsigned long)maxUs);
+  }
+};
+
+// The statistics of one sink type
+template <typename Sink> struct SinkTimer {
+  static SinkStats stats;
+};
+template <typename Sink> SinkStats SinkTimer<Sink>::stats;
+
+struct NoSink {};   // the end of the list
+
+template <typename... Sinks> struct SinkPipeline;
+
+template <> struct SinkPipeline<NoSink> {
+  static void consume(const Record &) {}
+  static void poll() {}
+  static void printStats(Print &) {}
+};
+
+template <typename Sink, typename... Rest> struct SinkPipeline<Sink, Rest...> {
+  static void consume(const Record &record) {
+    int64_t startUs = esp_timer_get_time();
+    bool consumed = Sink::consume(record);
+    SinkTimer<Sink>::stats.add((uint32_t)(esp_timer_get_time() - startUs), consumed);
+    SinkPipeline<Rest...>::consume(record);
+  }
+  static void poll() {
+    Sink::poll();
+    SinkPipeline<Rest...>::poll();
+  }
+  static void printStats(Print &out) {
+    SinkTimer<Sink>::stats.print(out, Sink::name());
+    SinkPipeline<Rest...>::printStats(out);
+  }
+};
@@ -0,0 +1,60 @@
+/**
+  spool.h - bounded RAM spool of records, for when the SD card is missing
+
+  A ring of Records in a caller-provided buffer (PSRAM if there is any). When
+  it is full the oldest record is overwritten and counted as lost, so the
+  spool always holds the most recent stretch of data.
+  Each spool is used by one task only.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include <stddef.h>
+#include "sample.h"
+
+class RecordSpool {
+public:
+  void begin(Record *buffer, uint32_t records) { ring = buffer; size = buffer ? records : 0; head = count = 0; }
+  //
+  void push(const Record &record) {
+    if (size == 0) {
+      nLost++;
+      return;
+    }
+    if (count == size) {
+      nLost++;            // drop the oldest
+      head = (head + 1) % size;
+      count--;
+    }
+    ring[(head + count) % size] = record;
+    count++;
+  }
+  bool peek(uint32_t i, Record &record) const {   // the i-th oldest, without removing it
+    if (i >= count) return false;
+    record = ring[(head + i) % size];
+    return true;
+  }
+  void drop(uint32_t n) {                          // remove the n oldest
+    if (n > count) n = count;
+    if (n) head = (head + n) % size;
+    count -= n;
+  }
+  bool pop(Record &record) {
+    if (count == 0) return false;
+    record = ring[head];
+    head = (head + 1) % size;
+    count--;
+    return true;
+  }
+  //
+  uint32_t capacity() const { return size; }
+  uint32_t used() const { return count; }
+  uint32_t lost() const { return nLost; }
+  uint32_t percentFull() const { return size ? (uint32_t)((uint64_t)count * 100 / size) : 100; }
+
+private:
+  Record *ring = nullptr;
+  uint32_t size = 0, head = 0, count = 0;
+  uint32_t nLost = 0;
+};
@@ -0,0 +1,61 @@
+/**
+  spsc_queue.h - lock-free single-producer/single-consumer ring buffer
+
+  One task (here the BLE callback) calls push(), one other task (loop()) calls pop().
+  Neither side ever blocks or allocates: push() on a full queue drops the new item
+  and counts an overrun. N must be a power of two.
+*/
+//
+#pragma once
+//
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+  bool push(const T &item) {
+    // Producer side
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t t = tail.load(std::memory_order_acquire);
+    if (h - t >= N) {
+      nOverruns.store(nOverruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+    items[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    //
+    nPushed.store(nPushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (h + 1 - t > maxDepth.load(std::memory_order_relaxed)) {
+      maxDepth.store(h + 1 - t, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  bool pop(T &item) {
+    // Consumer side
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    item = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Statistics (safe to read from any task)
+  size_t capacity() const { return N; }
+  uint32_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+  uint32_t pushed() const { return nPushed.load(std::memory_order_relaxed); }
+  uint32_t overruns() const { return nOverruns.load(std::memory_order_relaxed); }
+  uint32_t highWater() const { return maxDepth.load(std::memory_order_relaxed); }
+
+private:
+  T items[N];
+  std::atomic<uint32_t> head{0};       // next slot to write (producer)
+  std::atomic<uint32_t> tail{0};       // next slot to read (consumer)
+  std::atomic<uint32_t> nPushed{0};    // items accepted
+  std::atomic<uint32_t> nOverruns{0};  // items dropped because the queue was full
+  std::atomic<uint32_t> maxDepth{0};   // highest number of items ever waiting
+};
@@ -0,0 +1,20 @@
+/**
+  tasks.cpp - task statistics (see tasks.h)
+*/
+//
+#include "tasks.h"
+
+//////////////
+
+void printTaskStats(Print &out, TaskStats *stats, size_t count) {
+  uint64_t now = esp_timer_get_time();
+  for (size_t i = 0; i < count; i++) {
+    const TaskStats &t = stats[i];
+    uint32_t permille = now ? (uint32_t)(t.busyUs * 1000 / now) : 0;
+    // On the ESP32 the stack high-water mark is reported in bytes
+    uint32_t free = uxTaskGetStackHighWaterMark(t.handle);
+    out.printf("Task %-8s CPU %2lu.%lu%%, stack %5lu/%5lu B used\r\n", t.name,
+               (unsigned long)(permille / 10), (unsigned long)(permille % 10),
+               (unsigned long)(t.stackSize - free), (unsigned long)t.stackSize);
+  }
+}
@@ -0,0 +1,56 @@
+/**
+  tasks.h - FreeRTOS task layout of the recorder
+
+  BLE callback (Bluedroid, core 0) -> sampleQueue -> ingest task (core 0)
+      ingest: sequence check, energy integration -> the sinks (sink.h): storageQueue, uiQueue, ...
+      storage (core 1): CSV formatting and the buffered SD logger
+      ui (core 1, SINK_DISPLAY): the dashboard, once a second, and the history view at once for a touch
+  loop() (Arduino loopTask, core 1) keeps the BLE connection and prints the statistics;
+      it sleeps until a BLE event, Serial input or its next timer (see power.h).
+  replay (core 1, on demand): feeds captured or synthetic frames into replaySampleQueue and replayEventQueue,
+      like the BLE callback into its own; the ingest and storage tasks clear its slots when it is over.
+  net (core 1, NET_EXPORT): gets the records from the ingest task too, and sends them in batches over Wi-Fi.
+  http (core 1, HTTP_SERVER): sends the log files from the card to a browser, below the storage task.
+
+  Each task measures the time it spends working, so its CPU share can be
+  reported without FreeRTOS run-time statistics (disabled in the Arduino core).
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include "esp_timer.h"
+//
+// Core, priority and stack [bytes] of every task
+#define INGEST_CORE      0     // next to the BLE stack
+#define INGEST_PRIORITY  3
+#define INGEST_STACK     3072
+#define STORAGE_CORE     1
+#define STORAGE_PRIORITY 2
+#define STORAGE_STACK    4096  // FatFs needs room
+#define UI_CORE          1
+#define UI_PRIORITY      1     // same as loop()
+#define UI_STACK         4096
+#define REPLAY_CORE      1
+#define REPLAY_PRIORITY  1
+#define REPLAY_STACK     4096  // FatFs
+#define NET_CORE         1
+#define NET_PRIORITY     1
+#define NET_STACK        4096
+#define HTTP_CORE        1
+#define HTTP_PRIORITY    1     // below storage: a download only gets the time the logging leaves
+#define HTTP_STACK       6144  // FatFs, the web server and lineTime()
+
+struct TaskStats {
+  const char *name;
+  TaskHandle_t handle;   // NULL for the task calling printTaskStats()
+  uint32_t stackSize;    // [bytes]
+  uint64_t busyUs;       // time spent working since boot
+  int64_t wokeUs;        // when the current burst of work started
+  //
+  void wake() { wokeUs = esp_timer_get_time(); }
+  void sleep() { busyUs += esp_timer_get_time() - wokeUs; }
+};
+
+// Print the CPU share and stack high-water mark of every task
+void printTaskStats(Print &out, TaskStats *stats, size_t count);
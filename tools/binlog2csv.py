@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+binlog2csv.py - convert a binary log (PowerMeterLog_S<session>-<segment>_<tag>.bin,
+see binlog.h) to the CSV columns of the .txt log of the same name
+
+usage: python3 binlog2csv.py PowerMeterLog_S0001-000_<tag>.bin [out.csv]
+
+Blocks with a bad CRC (torn by a power cut, card errors) are skipped and
+reported on stderr.
+"""
+import struct
+import sys
+import zlib
+
+BLOCK_SIZE = 512
+BLOCK_MAGIC = 0xB10C
+DELTA_MAGIC = 0xB10D
+KEYFRAME = 12
+HEADER = "Time [s], Voltage [V], Current [A], Power [W], Power Factor, Energy [kWh], Frequency [Hz]"
+
+
+def crc_ok(block):
+    return zlib.crc32(block[:-4]) == struct.unpack_from("<I", block, len(block) - 4)[0]
+
+
+def varint(block, pos):
+    """Zig-zag varint at pos: returns (value, next pos)"""
+    u = shift = 0
+    while True:
+        b = block[pos]
+        pos += 1
+        u |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            return (u >> 1) ^ -(u & 1), pos
+
+
+def fixed_records(block, count, block_header, record_size):
+    """(ms since the first record, V*10, mA, W*10, Hz*10, PF*1000, mWs since the first record) of a fixed block"""
+    for i in range(count):
+        r = block_header + i * record_size
+        t_ms, volts10 = struct.unpack_from("<HH", block, r)
+        milliamps = int.from_bytes(block[r + 4:r + 7], "little")
+        watts10 = int.from_bytes(block[r + 7:r + 10], "little")
+        hz10, pf1000, d_mws = struct.unpack_from("<HHI", block, r + 10)
+        yield t_ms, volts10, milliamps, watts10, hz10, pf1000, d_mws
+
+
+def delta_records(block, count, block_header):
+    """The same for a delta block: a keyframe, then the deltas (see binlog.h)"""
+    k = block_header
+    v = [struct.unpack_from("<H", block, k)[0],
+         int.from_bytes(block[k + 2:k + 5], "little"),
+         int.from_bytes(block[k + 5:k + 8], "little"),
+         struct.unpack_from("<H", block, k + 8)[0],
+         struct.unpack_from("<H", block, k + 10)[0]]
+    t_ms, dt, mws, dmws = 0, 1000, 0, 0
+    yield (t_ms, *v, mws)
+    pos = k + KEYFRAME
+    for _ in range(count - 1):
+        ddt, pos = varint(block, pos)
+        dt += ddt
+        t_ms += dt
+        for c in range(5):
+            d, pos = varint(block, pos)
+            v[c] += d
+        ddmws, pos = varint(block, pos)
+        dmws += ddmws
+        mws += dmws
+        yield (t_ms, *v, mws)
+
+
+def hms(secs):
+    return "%02d:%02d:%02d" % (secs // 3600, secs // 60 % 60, secs % 60)
+
+
+def convert(data, out):
+    header = data[:BLOCK_SIZE]
+    if len(header) < BLOCK_SIZE or header[:4] != b"CYDL" or not crc_ok(header):
+        raise ValueError("not a binary log (bad file header)")
+    version, block_size, block_header, record_size = struct.unpack_from("<4H", header, 4)
+    if version != 1 or block_size != BLOCK_SIZE:
+        raise ValueError("unsupported binary log version %d" % version)
+    address = ":".join("%02X" % b for b in header[12:18])
+    print("socket %s" % address, file=sys.stderr)
+
+    out.write(HEADER + "\r\n")
+    bad = 0
+    for pos in range(block_size, len(data) - block_size + 1, block_size):
+        block = data[pos:pos + block_size]
+        magic, count, seq, base_us, base_mws, kwh100 = struct.unpack_from("<HHIQQI", block, 0)
+        if magic == 0:
+            break  # the end marker: the rest of a file still preallocated (copied before the logger closed it)
+        if magic not in (BLOCK_MAGIC, DELTA_MAGIC) or not crc_ok(block):
+            bad += 1
+            continue
+        if magic == DELTA_MAGIC:
+            records = delta_records(block, count, block_header)
+        else:
+            records = fixed_records(block, count, block_header, record_size)
+        for t_ms, volts10, milliamps, watts10, hz10, pf1000, d_mws in records:
+            secs = (base_us + t_ms * 1000) // 1000000
+            kwh1e5 = (base_mws + d_mws) // 36000
+            out.write("%s,%d.%d,%d.%03d,%d.%d,%d.%02d,%d.%05d,%d.%d\r\n" % (
+                hms(secs), volts10 // 10, volts10 % 10, milliamps // 1000, milliamps % 1000,
+                watts10 // 10, watts10 % 10, (pf1000 + 5) // 1000, (pf1000 + 5) // 10 % 100,  # PF rounded to 2 decimals
+                kwh1e5 // 100000, kwh1e5 % 100000, hz10 // 10, hz10 % 10))
+    if bad:
+        print("%d bad blocks skipped" % bad, file=sys.stderr)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "w", newline="") as out:
+            convert(data, out)
+    else:
+        sys.stdout.reconfigure(newline="")
+        convert(data, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
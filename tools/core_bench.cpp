@@ -0,0 +1,217 @@
+/**
+  core_bench.cpp - host benchmark of the hardware-independent modules
+
+  The frame decoder and assembler, the energy integrator, the CSV and rollup
+  formatting, the binary log encoders and the rollups include nothing from
+  the Arduino core or ESP-IDF, so they build and run on a PC as they are.
+  This program feeds recorded Atorch frames through all of them in the order
+  the firmware does, and reports the cost of every stage per sample and the
+  heap allocations made (there should be none).
+
+  Build and run from the repository root:
+
+    g++ -std=gnu++11 -O2 -I. tools/core_bench.cpp atorch.cpp energy.cpp format.cpp \
+        binlog.cpp rollup.cpp -o core_bench
+    ./core_bench [frames.txt] [max ns/sample]
+
+  frames.txt holds one frame per line in hex (72 digits), as printed by the
+  firmware with LOG_LEVEL LOG_DEBUG; without it the sample frame from the top
+  of main.cpp is used, with the power and current varied from frame to frame
+  and each frame signed with atorchChecksum(). (The sample frame as printed
+  does not carry a valid checksum; frames like it are counted as bad and
+  still decoded, unless built with -DATORCH_REJECT_BAD_CHECKSUM=1.)
+  The exit status is 1 if a stage allocated memory, a frame did not decode,
+  or the total cost exceeds the given limit, so the run can guard a build.
+  The unit tests of the same modules are in tools/core_test.cpp.
+*/
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <vector>
+#include "atorch.h"
+#include "energy.h"
+#include "format.h"
+#include "binlog.h"
+#include "rollup.h"
+//
+#define BENCH_SAMPLES  200000
+#define BENCH_MTU      20      // notification payload of the default BLE MTU (23 - 3) [bytes]
+
+// Count every allocation made through new
+static unsigned long allocations = 0;
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+
+enum Stage { ST_ASSEMBLE, ST_INTEGRATE, ST_CSV, ST_FIXED, ST_DELTA, ST_ROLLUP, ST_STAGES };
+static const char *stageNames[ST_STAGES] = {
+  "assemble+decode", "integrate", "format CSV", "binlog fixed", "binlog delta", "rollup 1m/1h"
+};
+static double stageNs[ST_STAGES];
+static unsigned long stageAllocs[ST_STAGES];
+
+typedef std::chrono::steady_clock Clock;
+
+// The sample frame from the top of main.cpp
+static const char *readmeFrame = "FF5501010009BC0000990001240000001100006401F402FD002300000A0D3C00000000C1";
+
+//////////////
+
+static bool parseHex(const char *hex, uint8_t *frame) {
+  for (int i = 0; i < ATORCH_FRAME_LEN; i++) {
+    unsigned v;
+    if (sscanf(hex + 2 * i, "%2x", &v) != 1) return false;
+    frame[i] = (uint8_t)v;
+  }
+  return true;
+}
+
+//////////////
+
+static void onFrame(const uint8_t *frame, void *context) {
+  Sample &sample = *(Sample *)context;
+  atorchDecode(frame, ATORCH_FRAME_LEN, sample);
+  sample.seq++;
+}
+
+//////////////
+
+int main(int argc, char **argv) {
+  std::vector<std::vector<uint8_t> > frames;
+  uint8_t frame[ATORCH_FRAME_LEN];
+  //
+  if (argc > 1) {
+    FILE *f = fopen(argv[1], "r");
+    if (!f) {
+      perror(argv[1]);
+      return 1;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+      if (parseHex(line, frame)) frames.push_back(std::vector<uint8_t>(frame, frame + ATORCH_FRAME_LEN));
+    }
+    fclose(f);
+  } else {
+    // Vary power and current, and sign each frame the way the socket does
+    parseHex(readmeFrame, frame);
+    for (int i = 0; i < 64; i++) {
+      frame[9] = (uint8_t)(0x99 + i);
+      frame[12] = (uint8_t)(0x24 + 3 * i);
+      frame[35] = atorchChecksum(frame);
+      frames.push_back(std::vector<uint8_t>(frame, frame + ATORCH_FRAME_LEN));
+    }
+  }
+  if (frames.empty()) {
+    fprintf(stderr, "no frames\n");
+    return 1;
+  }
+  //
+  // The sample frame decodes to the values documented in main.cpp
+  Sample check;
+  parseHex(readmeFrame, frame);
+  if (!atorchDecode(frame, ATORCH_FRAME_LEN, check) || check.volts10 != 2492 || check.milliamps != 153 ||
+      check.watts10 != 292 || check.kwh100 != 17 || check.hz10 != 500 || check.pf1000 != 765) {
+    fprintf(stderr, "the sample frame does not decode as documented\n");
+    return 1;
+  }
+  //
+  AtorchAssembler assembler;
+  EnergyIntegrator integrator;
+  BinlogEncoder fixed, delta;
+  delta.setEncoding(BINLOG_DELTA);
+  RollupTier minutes(ROLLUP_MINUTE_S), hours(ROLLUP_HOUR_S);
+  Sample sample = Sample();
+  Record record;
+  char line[CSV_LINE_LEN], rollLine[ROLLUP_LINE_LEN];
+  size_t csvBytes = 0;
+  uint32_t decoded = 0;
+  unsigned long rollLines = 0;
+  Clock::time_point t[ST_STAGES + 1];
+  //
+  for (int n = 0; n < BENCH_SAMPLES; n++) {
+    const std::vector<uint8_t> &f = frames[n % frames.size()];
+    unsigned long a[ST_STAGES + 1];
+    //
+    a[ST_ASSEMBLE] = allocations;
+    t[ST_ASSEMBLE] = Clock::now();
+    uint32_t before = sample.seq;
+    for (size_t off = 0; off < f.size(); off += BENCH_MTU) {
+      size_t len = f.size() - off < BENCH_MTU ? f.size() - off : BENCH_MTU;
+      assembler.feed(&f[off], len, (uint32_t)n * 1000, onFrame, &sample);
+    }
+    if (sample.seq != before) decoded++;
+    sample.us = (int64_t)n * 1000000;
+    //
+    a[ST_INTEGRATE] = allocations;
+    t[ST_INTEGRATE] = Clock::now();
+    integrator.add(sample);
+    record.sample = sample;
+    record.mWs = integrator.milliwattSeconds();
+    //
+    a[ST_CSV] = allocations;
+    t[ST_CSV] = Clock::now();
+    csvBytes += formatCsv(line, (uint32_t)(sample.us / 1000000), sample, record.kwh1e5());
+    //
+    a[ST_FIXED] = allocations;
+    t[ST_FIXED] = Clock::now();
+    if (!fixed.add(record)) {
+      fixed.seal();
+      fixed.add(record);
+    }
+    //
+    a[ST_DELTA] = allocations;
+    t[ST_DELTA] = Clock::now();
+    if (!delta.add(record)) {
+      delta.seal();
+      delta.add(record);
+    }
+    //
+    a[ST_ROLLUP] = allocations;
+    t[ST_ROLLUP] = Clock::now();
+    Rollup one;
+    one.set(record);
+    if (minutes.add(one)) {
+      formatRollup(rollLine, minutes.closed());
+      rollLines++;
+      if (hours.add(minutes.closed())) {
+        formatRollup(rollLine, hours.closed());
+        rollLines++;
+      }
+    }
+    a[ST_STAGES] = allocations;
+    t[ST_STAGES] = Clock::now();
+    //
+    for (int s = 0; s < ST_STAGES; s++) {
+      stageNs[s] += std::chrono::duration<double, std::nano>(t[s + 1] - t[s]).count();
+      stageAllocs[s] += a[s + 1] - a[s];
+    }
+  }
+  //
+  double total = 0;
+  unsigned long allocs = 0;
+  printf("%d samples, %u frames decoded, %lu bad checksum, %lu rollup lines\n",
+         BENCH_SAMPLES, decoded, (unsigned long)assembler.badChecksumFrames(), rollLines);
+  printf("%-16s %10s %8s\n", "stage", "ns/sample", "allocs");
+  for (int s = 0; s < ST_STAGES; s++) {
+    printf("%-16s %10.1f %8lu\n", stageNames[s], stageNs[s] / BENCH_SAMPLES, stageAllocs[s]);
+    total += stageNs[s] / BENCH_SAMPLES;
+    allocs += stageAllocs[s];
+  }
+  printf("%-16s %10.1f %8lu\n", "total", total, allocs);
+  printf("bytes/sample: CSV %.1f, binlog fixed %.1f, delta %.1f\n", (double)csvBytes / BENCH_SAMPLES,
+         fixed.bytesPerKiloRecord() / 1000.0, delta.bytesPerKiloRecord() / 1000.0);
+  //
+  bool ok = allocs == 0 && decoded == BENCH_SAMPLES;
+  if (argc > 2 && total > atof(argv[2])) {
+    printf("over the limit of %s ns/sample\n", argv[2]);
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,658 @@
+/**
+  core_test.cpp - host unit tests of the hardware-independent modules
+
+  The same modules as tools/core_bench.cpp, plus the capture format, the
+  record spool and the event detector, checked case by case: the frame
+  assembler (fragments, resync, checksums), the formatting and parsing of the
+  text files and the line protocol, the gap policies and the counter reset of
+  the energy integrator, the rollup period boundaries, the spool's wrap and
+  loss count, the detector's warm-up and triggers, and both binary log
+  encodings, written to a file and read back with tools/binlog2csv.py.
+
+  Build and run from the repository root:
+
+    g++ -std=gnu++11 -O2 -Wall -I. tools/core_test.cpp atorch.cpp energy.cpp format.cpp \
+        binlog.cpp rollup.cpp capture.cpp event_detector.cpp -o core_test
+    ./core_test [python3]
+
+  The argument is the Python interpreter that runs binlog2csv.py (default
+  python3). Every failed check is printed; the exit status is 1 if any did.
+  Build with -DATORCH_REJECT_BAD_CHECKSUM=1 or -DENERGY_GAP_POLICY=GAP_CAP to
+  test the other variants.
+*/
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "atorch.h"
+#include "energy.h"
+#include "format.h"
+#include "binlog.h"
+#include "rollup.h"
+#include "spool.h"
+#include "capture.h"
+#include "event_detector.h"
+//
+#define TEST_DIR  "/tmp"   // where the binary logs are written for binlog2csv.py
+
+static unsigned checks = 0, failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_STR(got, want) checkStr((got), (want), __FILE__, __LINE__)
+
+static void check(bool ok, const char *what, const char *file, int line) {
+  checks++;
+  if (ok) return;
+  failures++;
+  printf("FAIL %s:%d: %s\n", file, line, what);
+}
+
+static void checkStr(const char *got, const char *want, const char *file, int line) {
+  checks++;
+  if (strcmp(got, want) == 0) return;
+  failures++;
+  printf("FAIL %s:%d: \"%s\", expected \"%s\"\n", file, line, got, want);
+}
+
+// The sample frame from the top of main.cpp
+static const char *readmeFrame = "FF5501010009BC0000990001240000001100006401F402FD002300000A0D3C00000000C1";
+
+//////////////
+
+static void parseHex(const char *hex, uint8_t *frame) {
+  for (int i = 0; i < ATORCH_FRAME_LEN; i++) {
+    unsigned v = 0;
+    sscanf(hex + 2 * i, "%2x", &v);
+    frame[i] = (uint8_t)v;
+  }
+}
+
+//////////////
+
+static Sample sampleAt(int64_t us, uint32_t watts10) {
+  Sample s = Sample();
+  s.us = us;
+  s.volts10 = 2300;
+  s.milliamps = watts10 * 100 / 230;
+  s.watts10 = watts10;
+  s.hz10 = 500;
+  s.pf1000 = 900;
+  return s;
+}
+
+//////////////
+// AtorchAssembler
+
+struct Frames {
+  int count;
+  Sample last;
+};
+
+static void onFrame(const uint8_t *frame, void *context) {
+  Frames &frames = *(Frames *)context;
+  atorchDecode(frame, ATORCH_FRAME_LEN, frames.last);
+  frames.count++;
+}
+
+static void testAtorch() {
+  uint8_t frame[ATORCH_FRAME_LEN];
+  parseHex(readmeFrame, frame);
+  Sample s;
+  CHECK(atorchDecode(frame, ATORCH_FRAME_LEN, s));
+  CHECK(s.volts10 == 2492 && s.milliamps == 153 && s.watts10 == 292);
+  CHECK(s.kwh100 == 17 && s.hz10 == 500 && s.pf1000 == 765);
+  CHECK(!atorchDecode(frame, ATORCH_FRAME_LEN - 1, s));
+  frame[35] = atorchChecksum(frame);
+  //
+  {
+    // A whole frame, then the same frame in 20-byte and in 1-byte notifications
+    AtorchAssembler a;
+    Frames f = Frames();
+    a.feed(frame, ATORCH_FRAME_LEN, 0, onFrame, &f);
+    for (size_t off = 0; off < ATORCH_FRAME_LEN; off += 20) {
+      a.feed(frame + off, ATORCH_FRAME_LEN - off < 20 ? ATORCH_FRAME_LEN - off : 20, 10, onFrame, &f);
+    }
+    for (size_t off = 0; off < ATORCH_FRAME_LEN; off++) a.feed(frame + off, 1, 20, onFrame, &f);
+    CHECK(f.count == 3 && a.goodFrames() == 3);
+    CHECK(a.resyncs() == 0 && a.skippedBytes() == 0 && a.badChecksumFrames() == 0);
+    CHECK(f.last.watts10 == 292);
+  }
+  {
+    // Garbage (with a lone FF) before a frame is skipped
+    AtorchAssembler a;
+    Frames f = Frames();
+    const uint8_t junk[] = { 0x00, 0x12, 0xFF, 0x00 };
+    a.feed(junk, sizeof(junk), 0, onFrame, &f);
+    a.feed(frame, ATORCH_FRAME_LEN, 0, onFrame, &f);
+    CHECK(f.count == 1 && a.goodFrames() == 1);
+    CHECK(a.skippedBytes() == 4);
+    CHECK(a.resyncs() >= 1);
+  }
+  {
+    // A torn header (FF 55 01) right before a frame: the 36 bytes starting there are
+    // not a report, and the real header inside them is found again
+    AtorchAssembler a;
+    Frames f = Frames();
+    uint8_t stream[3 + ATORCH_FRAME_LEN] = { 0xFF, 0x55, 0x01 };
+    memcpy(stream + 3, frame, ATORCH_FRAME_LEN);
+    a.feed(stream, sizeof(stream), 0, onFrame, &f);
+    CHECK(f.count == 1 && a.goodFrames() == 1);
+    CHECK(a.unsupportedFrames() == 1);
+    CHECK(f.last.volts10 == 2492);
+  }
+  {
+    // Two frames back to back in one notification
+    AtorchAssembler a;
+    Frames f = Frames();
+    uint8_t two[2 * ATORCH_FRAME_LEN];
+    memcpy(two, frame, ATORCH_FRAME_LEN);
+    memcpy(two + ATORCH_FRAME_LEN, frame, ATORCH_FRAME_LEN);
+    a.feed(two, sizeof(two), 0, onFrame, &f);
+    CHECK(f.count == 2);
+  }
+  {
+    // A fragment whose tail never comes is dropped, and the next frame still decodes
+    AtorchAssembler a;
+    Frames f = Frames();
+    a.feed(frame, 20, 0, onFrame, &f);
+    a.feed(frame, ATORCH_FRAME_LEN, ATORCH_FRAGMENT_MS + 1, onFrame, &f);
+    CHECK(f.count == 1 && a.shortFrames() == 1);
+  }
+  {
+    // A wrong checksum is counted, and the frame rejected or passed on
+    AtorchAssembler a;
+    Frames f = Frames();
+    uint8_t bad[ATORCH_FRAME_LEN];
+    memcpy(bad, frame, ATORCH_FRAME_LEN);
+    bad[35] ^= 0x01;
+    a.feed(bad, ATORCH_FRAME_LEN, 0, onFrame, &f);
+    CHECK(a.badChecksumFrames() == 1 && a.goodFrames() == 0);
+    CHECK(f.count == (ATORCH_REJECT_BAD_CHECKSUM ? 0 : 1));
+    a.feed(frame, ATORCH_FRAME_LEN, 0, onFrame, &f);
+    CHECK(a.goodFrames() == 1);
+  }
+  {
+    // Other message or device types
+    AtorchAssembler a;
+    Frames f = Frames();
+    uint8_t other[ATORCH_FRAME_LEN];
+    memcpy(other, frame, ATORCH_FRAME_LEN);
+    other[3] = 0x02;   // DC meter
+    other[35] = atorchChecksum(other);
+    a.feed(other, ATORCH_FRAME_LEN, 0, onFrame, &f);
+    CHECK(f.count == 0 && a.unsupportedFrames() == 1);
+  }
+  {
+    // A command frame: header, type, device, command, big-endian value, checksum
+    uint8_t cmd[ATORCH_COMMAND_LEN];
+    atorchCommand(cmd, ATORCH_DEV_AC_METER, ATORCH_CMD_BACKLIGHT, 0x0102033C);
+    CHECK(cmd[0] == 0xFF && cmd[1] == 0x55 && cmd[2] == ATORCH_MSG_COMMAND && cmd[3] == ATORCH_DEV_AC_METER);
+    CHECK(cmd[4] == ATORCH_CMD_BACKLIGHT && cmd[5] == 0x01 && cmd[6] == 0x02 && cmd[7] == 0x03 && cmd[8] == 0x3C);
+    uint8_t sum = 0;
+    for (int i = 2; i < ATORCH_COMMAND_LEN - 1; i++) sum += cmd[i];
+    CHECK(cmd[ATORCH_COMMAND_LEN - 1] == (uint8_t)(sum ^ 0x44));
+  }
+}
+
+//////////////
+// format.h
+
+static void testFormat() {
+  char text[CSV_LINE_LEN];
+  fmtFixed(text, 0, 0);            CHECK_STR(text, "0");
+  fmtFixed(text, 0, 3);            CHECK_STR(text, "0.000");
+  fmtFixed(text, 7, 2);            CHECK_STR(text, "0.07");
+  fmtFixed(text, 12345, 2);        CHECK_STR(text, "123.45");
+  fmtFixed(text, 5, 1, 6);         CHECK_STR(text, "   0.5");
+  fmtFixed(text, 4294967295U, 0);  CHECK_STR(text, "4294967295");
+  fmtFixed64(text, 123456789012345ULL, 5);  CHECK_STR(text, "1234567890.12345");
+  fmtFixed64(text, 42, 5);         CHECK_STR(text, "0.00042");
+  //
+  fmtHms(text, 0);                 CHECK_STR(text, "00:00:00");
+  fmtHms(text, 3661);              CHECK_STR(text, "01:01:01");
+  fmtHms(text, 86399);             CHECK_STR(text, "23:59:59");
+  fmtHms(text, 360000);            CHECK_STR(text, "100:00:00");
+  CHECK(fmtStr(fmtHms(text, 59), "|") == text + 9);
+  CHECK_STR(text, "00:00:59|");
+  //
+  uint8_t frame[ATORCH_FRAME_LEN];
+  Sample s;
+  parseHex(readmeFrame, frame);
+  atorchDecode(frame, ATORCH_FRAME_LEN, s);
+  size_t len = formatCsv(text, 100, s, 17);
+  CHECK_STR(text, "00:01:40,249.2,0.153,29.2,0.77,0.00017,50.0\r\n");
+  CHECK(len == strlen(text));
+  formatCsv(text, 100, s, 17, CSV_VOLTS | CSV_KWH);
+  CHECK_STR(text, "00:01:40,249.2,,,,0.00017,\r\n");
+  formatCsv(text, 100, s, 17, 0);
+  CHECK_STR(text, "00:01:40,,,,,,\r\n");
+  s.pf1000 = 994;   // rounded up to 2 decimals
+  formatCsv(text, 100, s, 17, CSV_PF);
+  CHECK_STR(text, "00:01:40,,,,0.99,,\r\n");
+  s.pf1000 = 995;
+  formatCsv(text, 100, s, 17, CSV_PF);
+  CHECK_STR(text, "00:01:40,,,,1.00,,\r\n");
+  //
+  // Reading back
+  uint32_t secs = 0, value = 0;
+  const char *line = "01:02:03,249.25,x";
+  const char *end = line + strlen(line);
+  const char *p = parseHms(line, end, secs);
+  CHECK(p == line + 8 && secs == 3723);
+  CHECK(parseFixed(p + 1, end, 1, value) == line + 15 && value == 2492);   // further decimals cut off
+  CHECK(parseFixed(p + 1, end, 3, value) && value == 249250);
+  CHECK(parseHms("75,", "75," + 3, secs) && secs == 75);
+  CHECK(parseHms("100:00:00", "100:00:00" + 9, secs) && secs == 360000);
+  CHECK(parseHms("x", "x" + 1, secs) == nullptr);
+  CHECK(parseHms("", "", secs) == nullptr);
+  line = "1:2:3:4";
+  CHECK(parseHms(line, line + 7, secs) == line + 5 && secs == 3723);   // two colons at most
+  line = "12:";
+  CHECK(parseHms(line, line + 3, secs) == nullptr);
+  line = "5,";
+  CHECK(parseFixed(line, line + 2, 2, value) == line + 1 && value == 500);
+  CHECK(parseFixed(",", "," + 1, 1, value) == nullptr);
+  //
+  // What formatCsv() writes, parseHms() and parseFixed() read back
+  s = sampleAt(0, 12345);
+  formatCsv(text, 45296, s, 0);
+  end = text + strlen(text);
+  p = parseHms(text, end, secs);
+  CHECK(p && secs == 45296);
+  p = strchr(p + 1, ',');
+  p = strchr(p + 1, ',');
+  CHECK(p && parseFixed(p + 1, end, 1, value) && value == 12345);
+  //
+  // The line protocol of the network export: no timestamp, then one in ns
+  char net[NET_LINE_LEN];
+  atorchDecode(frame, ATORCH_FRAME_LEN, s);
+  len = formatLine(net, "cyd", "A1B2", s, 17, 0);
+  CHECK_STR(net, "energy,board=cyd,socket=A1B2 V=249.2,I=0.153,P=29.2,PF=0.765,E=0.00017,F=50.0,s=0i\n");
+  CHECK(len == strlen(net));
+  s.us = 3723000000LL;
+  len = formatLine(net, "cyd", "A1B2", s, 123456, 1700000000123ULL);
+  CHECK_STR(net, "energy,board=cyd,socket=A1B2 V=249.2,I=0.153,P=29.2,PF=0.765,E=1.23456,F=50.0,s=3723i "
+                 "1700000000123000000\n");
+  CHECK(len == strlen(net));
+  s = sampleAt(0, 4294967295U);
+  s.volts10 = s.milliamps = 4294967295U;
+  s.pf1000 = s.hz10 = 65535;
+  len = formatLine(net, "ABCDEFGHIJKL", "ABCDEFGHIJKL", s, 18446744073709551615ULL, 18446744073709ULL);
+  CHECK(len == strlen(net) && len < NET_LINE_LEN);   // the longest line fits
+}
+
+//////////////
+// EnergyIntegrator
+
+static void testEnergy() {
+  {
+    // 100 W for 9 intervals of 1 s: 900 Ws
+    EnergyIntegrator e;
+    for (int i = 0; i < 10; i++) e.add(sampleAt((int64_t)i * 1000000, 1000));
+    CHECK(e.milliwattSeconds() == 900000);
+    CHECK(e.gaps() == 0 && e.gapUs() == 0);
+    CHECK(e.kwh1e5() == 900000 / 36000);
+  }
+  {
+    // The power of a frame holds until the next one, whatever the interval
+    EnergyIntegrator e;
+    e.add(sampleAt(0, 1000));
+    e.add(sampleAt(500000, 2000));    // 100 W for 0.5 s
+    e.add(sampleAt(2500000, 0));      // 200 W for 2 s: still not a gap
+    CHECK(e.milliwattSeconds() == 50000 + 400000);
+    CHECK(e.gaps() == 0);
+  }
+  {
+    // The remainders of the divisions add up: 0.1 W for 10 ms in 10 steps is 1 mWs
+    EnergyIntegrator e;
+    for (int i = 0; i <= 10; i++) e.add(sampleAt((int64_t)i * 1000, 1));
+    CHECK(e.milliwattSeconds() == 1);
+  }
+  {
+    // A 10 s gap between 100 W and 200 W
+    EnergyIntegrator e;
+    e.add(sampleAt(0, 1000));
+    e.add(sampleAt(1000000, 1000));
+    e.add(sampleAt(11000000, 2000));
+    CHECK(e.gaps() == 1 && e.gapUs() == 10000000);
+#if ENERGY_GAP_POLICY == GAP_INTERPOLATE
+    CHECK(e.milliwattSeconds() == 100000 + 1500000);   // the trapezoid: 150 W for 10 s
+    CHECK(e.missingUs() == 0);
+#else
+    CHECK(e.milliwattSeconds() == 100000 + 100000);    // one nominal interval at 100 W
+    CHECK(e.missingUs() == 9000000);
+#endif
+  }
+  {
+    // A sample older than the last adds nothing
+    EnergyIntegrator e;
+    e.add(sampleAt(5000000, 1000));
+    e.add(sampleAt(4000000, 1000));
+    CHECK(e.milliwattSeconds() == 0);
+  }
+  {
+    // The socket's counter: 10, 12, reset to 0, 3 is 5 counted since the first sample
+    const uint32_t counter[] = { 10, 12, 0, 3 };
+    EnergyIntegrator e;
+    for (int i = 0; i < 4; i++) {
+      Sample s = sampleAt((int64_t)i * 1000000, 0);
+      s.kwh100 = counter[i];
+      e.add(s);
+    }
+    CHECK(e.socketKwh100() == 5);
+    CHECK(e.driftWh() == -50);
+  }
+  {
+    // restore() continues a total; reset() starts again
+    EnergyIntegrator e;
+    e.restore(123456);
+    e.add(sampleAt(0, 1000));
+    e.add(sampleAt(1000000, 1000));
+    CHECK(e.milliwattSeconds() == 123456 + 100000);
+    e.reset();
+    CHECK(e.milliwattSeconds() == 0 && e.gaps() == 0);
+  }
+}
+
+//////////////
+// RollupTier
+
+static Rollup rollupAt(int64_t us, uint32_t watts10, uint64_t mWs) {
+  Record r;
+  r.sample = sampleAt(us, watts10);
+  r.mWs = mWs;
+  Rollup one;
+  one.set(r);
+  return one;
+}
+
+static void testRollup() {
+  RollupTier minutes(ROLLUP_MINUTE_S), hours(ROLLUP_HOUR_S);
+  int closedMinutes = 0, closedHours = 0;
+  // A sample a second from 0 s to 7199 s, 100 W up to 59 s and 200 W after; energy 1 mWs a sample
+  for (int i = 0; i < 7200; i++) {
+    bool closed = minutes.add(rollupAt((int64_t)i * 1000000, i < 60 ? 1000 : 2000, i));
+    // A period is closed by the first sample of the next one
+    CHECK(closed == (i > 0 && i % 60 == 0));
+    if (!closed) continue;
+    closedMinutes++;
+    const Rollup &m = minutes.closed();
+    CHECK(m.startUs == (int64_t)(i - 60) * 1000000 && m.count == 60);
+    if (i == 60) {
+      CHECK(m.min[ROLL_WATTS10] == 1000 && m.max[ROLL_WATTS10] == 1000 && m.mean(ROLL_WATTS10) == 1000);
+      CHECK(m.energyMWs() == 59);    // the energy between its first and its last sample
+    } else {
+      CHECK(m.mean(ROLL_WATTS10) == 2000);
+      CHECK(m.energyMWs() == 60);    // ... and from the end of the period before
+    }
+    if (hours.add(m)) closedHours++;
+  }
+  CHECK(closedMinutes == 119 && minutes.periods() == 119);
+  CHECK(closedHours == 1);
+  CHECK(hours.closed().startUs == 0 && hours.closed().count == 3600);
+  CHECK(hours.closed().energyMWs() == 3599);
+  CHECK(hours.closed().min[ROLL_WATTS10] == 1000 && hours.closed().max[ROLL_WATTS10] == 2000);
+  //
+  // The current minute is 7140-7199 s; poll() closes it ROLLUP_GRACE_US after its end
+  CHECK(!minutes.poll(7200000000LL + ROLLUP_GRACE_US - 1));
+  CHECK(minutes.poll(7200000000LL + ROLLUP_GRACE_US));
+  CHECK(minutes.closed().startUs == 7140000000LL && minutes.closed().count == 60);
+  CHECK(!minutes.poll(7300000000LL));   // nothing open
+  //
+  // Samples just either side of a boundary
+  RollupTier tier(ROLLUP_MINUTE_S);
+  CHECK(!tier.add(rollupAt(59999999, 1000, 0)));
+  CHECK(tier.add(rollupAt(60000000, 1000, 0)));
+  CHECK(tier.closed().startUs == 0 && tier.closed().count == 1);
+  CHECK(tier.current().startUs == 60000000);
+  // A silence of several periods closes only the one open
+  CHECK(tier.add(rollupAt(600000000, 1000, 0)));
+  CHECK(tier.closed().startUs == 60000000 && tier.periods() == 2);
+  //
+  char line[ROLLUP_LINE_LEN];
+  formatRollup(line, hours.closed());
+  CHECK(strncmp(line, "00:00:00,3600,230.0,230.0,230.0,", 32) == 0);
+}
+
+//////////////
+// RecordSpool
+
+static Record recordNo(uint32_t n) {
+  Record r;
+  r.sample = sampleAt((int64_t)n * 1000000, n);
+  r.mWs = n;
+  return r;
+}
+
+static void testSpool() {
+  Record ring[4], r;
+  RecordSpool spool;
+  spool.begin(ring, 4);
+  CHECK(spool.capacity() == 4 && spool.used() == 0 && !spool.pop(r));
+  for (uint32_t n = 0; n < 6; n++) spool.push(recordNo(n));
+  // Full: the two oldest were overwritten
+  CHECK(spool.used() == 4 && spool.lost() == 2 && spool.percentFull() == 100);
+  CHECK(spool.peek(0, r) && r.mWs == 2);
+  CHECK(spool.peek(3, r) && r.mWs == 5);
+  CHECK(!spool.peek(4, r));
+  spool.drop(1);
+  CHECK(spool.used() == 3 && spool.peek(0, r) && r.mWs == 3);
+  // Across the end of the ring
+  for (uint32_t n = 6; n < 9; n++) spool.push(recordNo(n));
+  CHECK(spool.used() == 4 && spool.lost() == 4);
+  for (uint32_t n = 5; n < 9; n++) CHECK(spool.pop(r) && r.mWs == n);
+  CHECK(!spool.pop(r) && spool.percentFull() == 0);
+  spool.drop(10);
+  CHECK(spool.used() == 0);
+  //
+  // No buffer: every record is lost
+  RecordSpool none;
+  none.begin(nullptr, 4);
+  none.push(recordNo(1));
+  CHECK(none.capacity() == 0 && none.used() == 0 && none.lost() == 1);
+}
+
+//////////////
+// capture.h
+
+static void testCapture() {
+  uint8_t frame[ATORCH_FRAME_LEN], back[ATORCH_FRAME_LEN];
+  char line[CAPTURE_LINE_LEN];
+  int64_t us;
+  uint8_t device;
+  parseHex(readmeFrame, frame);
+  size_t len = formatCapture(line, frame, 1234567890123LL, 3);
+  CHECK(len == strlen(line));
+  CHECK(strncmp(line, readmeFrame, 2 * ATORCH_FRAME_LEN) == 0);
+  CHECK_STR(line + 2 * ATORCH_FRAME_LEN, ",1234567890123,3\r\n");
+  CHECK(parseCapture(line, back, us, device));
+  CHECK(memcmp(back, frame, ATORCH_FRAME_LEN) == 0 && us == 1234567890123LL && device == 3);
+  // Lower-case hex reads too
+  std::string lower(line);
+  for (size_t i = 0; i < lower.size(); i++) lower[i] = (char)tolower(lower[i]);
+  CHECK(parseCapture(lower.c_str(), back, us, device) && memcmp(back, frame, ATORCH_FRAME_LEN) == 0);
+  // Not capture lines
+  std::string bad(line);
+  bad[10] = 'G';
+  CHECK(!parseCapture(bad.c_str(), back, us, device));
+  CHECK(!parseCapture(readmeFrame, back, us, device));    // no time
+  bad = std::string(readmeFrame) + ",12";
+  CHECK(!parseCapture(bad.c_str(), back, us, device));    // no device
+  bad = std::string(readmeFrame) + ",,1";
+  CHECK(!parseCapture(bad.c_str(), back, us, device));
+  CHECK(!parseCapture("FF55", back, us, device));
+  //
+  // The synthetic load is signed correctly and decodes to its duty cycle
+  AtorchAssembler a;
+  Frames f = Frames();
+  for (uint32_t n = 0; n < 120; n++) {
+    syntheticFrame(n, frame);
+    CHECK(frame[35] == atorchChecksum(frame));
+    a.feed(frame, ATORCH_FRAME_LEN, n, onFrame, &f);
+    if (n % 60 == 0) CHECK(f.last.watts10 == 24000);   // inrush
+    if (n % 60 >= 20) CHECK(f.last.watts10 < 300);    // standby
+  }
+  CHECK(f.count == 120 && a.goodFrames() == 120);
+}
+
+//////////////
+// EventDetector
+
+static uint8_t feed(EventDetector &detector, uint32_t watts10, int n) {
+  // n samples of the same power; the last trigger
+  uint8_t trigger = EVENT_NONE;
+  for (int i = 0; i < n; i++) trigger = detector.add(sampleAt(i * 1000000LL, watts10));
+  return trigger;
+}
+
+static void testEventDetector() {
+  // A steady load: the mean is exact, and nothing fires
+  EventDetector steady;
+  CHECK(feed(steady, 1000, 100) == EVENT_NONE);
+  CHECK(steady.meanW10() == 1000);
+  //
+  // Not during the warm-up, however large the jump
+  EventDetector warming;
+  CHECK(feed(warming, 1000, EVENT_WARMUP - 1) == EVENT_NONE);
+  CHECK(warming.add(sampleAt(0, 20000)) == EVENT_NONE);
+  //
+  // A power deviation, up or down (a negative difference from the mean)
+  EventDetector up = steady, down = steady;
+  CHECK(up.add(sampleAt(0, 2000)) == EVENT_DEVIATION);
+  CHECK(down.add(sampleAt(0, 0)) == EVENT_DEVIATION);
+  CHECK(down.meanW10() == 1000 - 1000 / 32 - 1);   // 968.75, cut off: the mean moved by 1/2^EVENT_WEIGHT_SHIFT
+  CHECK(feed(down, 0, 400) == EVENT_NONE);         // the new load becomes the mean, from above
+  CHECK(down.meanW10() == 0);
+  //
+  // Less than EVENT_MIN_W10 does not fire, even many deviations away from a steady mean
+  EventDetector small = steady;
+  CHECK(small.add(sampleAt(0, 1000 + EVENT_MIN_W10 - 1)) == EVENT_NONE);
+  //
+  // A current step at about the same power (the power factor changed)
+  EventDetector step = steady;
+  Sample s = sampleAt(0, 1000);
+  s.milliamps += EVENT_STEP_MA;
+  CHECK(step.add(s) == EVENT_STEP);
+  s.milliamps -= EVENT_STEP_MA - 1;
+  CHECK(step.add(s) == EVENT_NONE);   // one mA short of a step back
+  //
+  // A noisy load widens the variance, so a deviation that fired on the steady one does not
+  EventDetector noisy;
+  for (int i = 0; i < 200; i++) noisy.add(sampleAt(i * 1000000LL, i % 2 ? 1500 : 500));
+  CHECK(noisy.add(sampleAt(0, 1250)) == EVENT_NONE);
+  CHECK(noisy.add(sampleAt(0, 5000)) == EVENT_DEVIATION);
+}
+
+//////////////
+// BinlogEncoder and tools/binlog2csv.py
+
+static std::string roundTrip(const char *python, uint8_t encoding, const std::vector<Record> &records,
+                             int tear, std::string &expected) {
+  // Write a binary log of the records, convert it with binlog2csv.py, and return its output.
+  // expected gets the CSV log of the same records, without those of block tear (0: none).
+  //
+  static const uint8_t address[6] = { 0xA4, 0xC1, 0x38, 0x1F, 0x2B, 0x3C };
+  char path[64];
+  snprintf(path, sizeof(path), TEST_DIR "/core_test_%u.bin", (unsigned)encoding);
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return "";
+  }
+  uint8_t header[BINLOG_BLOCK_SIZE];
+  BinlogEncoder::header(header, address);
+  fwrite(header, 1, sizeof(header), f);
+  BinlogEncoder encoder;
+  encoder.setEncoding(encoding);
+  expected = "Time [s], Voltage [V], Current [A], Power [W], Power Factor, Energy [kWh], Frequency [Hz]\r\n";
+  std::string block;
+  char line[CSV_LINE_LEN];
+  for (size_t i = 0; i <= records.size(); i++) {
+    if (i == records.size() || !encoder.add(records[i])) {
+      uint8_t sealed[BINLOG_BLOCK_SIZE];
+      memcpy(sealed, encoder.seal(), BINLOG_BLOCK_SIZE);
+      if ((int)encoder.blocks() == tear) sealed[100] ^= 0xFF;   // the CRC no longer matches
+      else expected += block;
+      fwrite(sealed, 1, sizeof(sealed), f);
+      block.clear();
+      if (i == records.size()) break;
+      encoder.add(records[i]);
+    }
+    const Record &r = records[i];
+    formatCsv(line, (uint32_t)(r.sample.us / 1000000), r.sample, r.kwh1e5());
+    block += line;
+  }
+  fclose(f);
+  //
+  std::string command = std::string(python) + " tools/binlog2csv.py " + path + " 2>/dev/null";
+  FILE *p = popen(command.c_str(), "r");
+  if (!p) return "";
+  std::string out;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), p)) > 0) out.append(buf, n);
+  pclose(p);
+  remove(path);
+  return out;
+}
+
+static void testBinlog(const char *python) {
+  // A load that changes often, with calls at odd milliseconds, a gap, and values up to their field widths
+  std::vector<Record> records;
+  Record r;
+  r.mWs = 0;
+  int64_t us = 3600000000LL;
+  for (uint32_t n = 0; n < 400; n++) {
+    us += n == 200 ? 70000000 : 1000000 + (n % 5) * 37000 - 74000;   // a 70 s gap: a fixed block can span 65 s
+    uint32_t watts10 = n % 60 < 20 ? 12000 + 37 * (n % 11) : 292 + n % 7;
+    r.sample = sampleAt(us, watts10);
+    r.sample.volts10 = 2300 + n % 13 - 6;
+    r.sample.pf1000 = 500 + n;
+    r.sample.hz10 = 499 + n % 3;
+    r.sample.kwh100 = n / 10;
+    if (n == 300) {
+      r.sample.milliamps = 0xFFFFFF;
+      r.sample.watts10 = 0xFFFFFF;
+    }
+    r.mWs += (uint64_t)watts10 * 100 + n;
+    r.sample.us = us - us % 1000;   // the log keeps whole ms
+    records.push_back(r);
+  }
+  for (uint8_t encoding = BINLOG_FIXED; encoding <= BINLOG_DELTA; encoding++) {
+    std::string expected, got = roundTrip(python, encoding, records, 0, expected);
+    CHECK(!got.empty());
+    CHECK(got == expected);
+    if (got != expected) {
+      // Show the first line that differs
+      size_t i = 0;
+      while (i < got.size() && i < expected.size() && got[i] == expected[i]) i++;
+      size_t start = expected.rfind('\n', i);
+      start = start == std::string::npos ? 0 : start + 1;
+      printf("  encoding %u: got \"%s\"\n  expected \"%s\"\n", (unsigned)encoding,
+             got.substr(start, got.find('\r', start) - start).c_str(),
+             expected.substr(start, expected.find('\r', start) - start).c_str());
+    }
+    // A torn block is skipped; the blocks after it still decode
+    got = roundTrip(python, encoding, records, 3, expected);
+    CHECK(!got.empty() && got == expected);
+  }
+}
+
+//////////////
+
+int main(int argc, char **argv) {
+  const char *python = argc > 1 ? argv[1] : "python3";
+  testAtorch();
+  testFormat();
+  testEnergy();
+  testRollup();
+  testSpool();
+  testCapture();
+  testEventDetector();
+  testBinlog(python);
+  //
+  printf("%u checks, %u failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+/**
+  touch.cpp - the CYD's resistive touch panel (see touch.h)
+*/
+//
+#include "touch.h"
+//
+#define XPT_Z1    0xB1   // start, channel, 12 bits, differential, reference on
+#define XPT_Z2    0xC1
+#define XPT_X     0x91
+#define XPT_Y     0xD1
+#define XPT_OFF   0xD0   // ... power down between conversions, pen interrupt on
+
+//////////////
+
+void TouchPanel::begin(void (*onPress)()) {
+  pinMode(TOUCH_CLK, OUTPUT);
+  pinMode(TOUCH_MOSI, OUTPUT);
+  pinMode(TOUCH_CS, OUTPUT);
+  pinMode(TOUCH_MISO, INPUT);
+  pinMode(TOUCH_IRQ, INPUT);   // pulled up on the board
+  digitalWrite(TOUCH_CS, HIGH);
+  digitalWrite(TOUCH_CLK, LOW);
+  digitalWrite(TOUCH_CS, LOW);
+  convert(XPT_OFF);            // arm the pen interrupt
+  digitalWrite(TOUCH_CS, HIGH);
+  if (onPress) attachInterrupt(digitalPinToInterrupt(TOUCH_IRQ), onPress, FALLING);
+}
+
+//////////////
+
+uint16_t TouchPanel::convert(uint8_t command) {
+  // 8 clocks for the command, then 12 for the result, MSB first (the controller allows 2.5 MHz)
+  uint16_t value = 0;
+  for (int i = 7; i >= 0; i--) {
+    digitalWrite(TOUCH_MOSI, (command >> i) & 1);
+    digitalWrite(TOUCH_CLK, HIGH);
+    delayMicroseconds(1);
+    digitalWrite(TOUCH_CLK, LOW);
+    delayMicroseconds(1);
+  }
+  for (int i = 11; i >= 0; i--) {
+    digitalWrite(TOUCH_CLK, HIGH);
+    delayMicroseconds(1);
+    digitalWrite(TOUCH_CLK, LOW);
+    delayMicroseconds(1);
+    value |= digitalRead(TOUCH_MISO) << i;
+  }
+  return value;
+}
+
+//////////////
+
+static int16_t scale(int32_t raw, int32_t raw0, int32_t raw1, int16_t size) {
+  int32_t v = (raw - raw0) * size / (raw1 - raw0);
+  return (int16_t)(v < 0 ? 0 : v >= size ? size - 1 : v);
+}
+
+//////////////
+
+bool TouchPanel::read(int16_t &x, int16_t &y) {
+  if (!pressed()) return false;
+  digitalWrite(TOUCH_CS, LOW);
+  int32_t z = convert(XPT_Z1) + 4095 - convert(XPT_Z2);
+  uint16_t rawX = convert(XPT_X), rawY = convert(XPT_Y);
+  convert(XPT_OFF);
+  digitalWrite(TOUCH_CS, HIGH);
+  if (z < TOUCH_Z_MIN) return false;
+  x = scale(rawX, TOUCH_RAW_X0, TOUCH_RAW_X1, 320);
+  y = scale(rawY, TOUCH_RAW_Y0, TOUCH_RAW_Y1, 240);
+  nTouches++;
+  return true;
+}
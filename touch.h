@@ -0,0 +1,44 @@
+/**
+  touch.h - the CYD's resistive touch panel (XPT2046)
+
+  The controller sits on pins of its own, while both hardware SPI buses are
+  taken (HSPI by the display, VSPI by the SD card), so it is read by
+  bit-banging: 3 conversions of 24 clocks each, about 100 us. The pen
+  interrupt pin goes low while the panel is pressed, so nothing is read
+  while it is not.
+
+  The raw readings are mapped to the landscape screen (rotation 1) with the
+  TOUCH_RAW_* limits, which can be given as build flags for a panel that is
+  off by more than a few pixels.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+//
+#define TOUCH_CLK    25
+#define TOUCH_MOSI   32
+#define TOUCH_MISO   39
+#define TOUCH_CS     33
+#define TOUCH_IRQ    36     // low while pressed
+#ifndef TOUCH_RAW_X0
+#define TOUCH_RAW_X0 200    // raw readings at the screen's edges
+#define TOUCH_RAW_X1 3700
+#define TOUCH_RAW_Y0 240
+#define TOUCH_RAW_Y1 3800
+#endif
+#define TOUCH_Z_MIN  400    // smallest pressure taken as a touch
+
+class TouchPanel {
+public:
+  void begin(void (*onPress)() = nullptr);   // onPress: called from the pen interrupt
+  bool pressed() const { return digitalRead(TOUCH_IRQ) == LOW; }
+  bool read(int16_t &x, int16_t &y);         // screen coordinates; false if not pressed
+  //
+  uint32_t touches() const { return nTouches; }
+
+private:
+  uint16_t convert(uint8_t command);         // one 12-bit conversion
+  //
+  uint32_t nTouches = 0;
+};
@@ -0,0 +1,161 @@
+/**
+  trend.cpp - scrolling power trend chart on the CYD's TFT (see trend.h)
+*/
+//
+#include "trend.h"
+#include "format.h"
+//
+#define TREND_BG       TFT_BLACK
+#define TREND_GRID     TFT_DARKGREY
+#define TREND_POWER    TFT_GREENYELLOW
+#define TREND_AMPS     TFT_ORANGE
+
+//////////////
+
+void TrendRing::clear() {
+  for (int i = 0; i < TREND_W; i++) watts10[i] = milliamps[i] = TREND_GAP;
+  head = 0;
+}
+
+//////////////
+
+void TrendRing::add(uint32_t w10, uint32_t mA) {
+  watts10[head] = w10;
+  milliamps[head] = mA;
+  head = (head + 1) % TREND_W;
+}
+
+//////////////
+
+bool TrendChart::begin() {
+  sprite.setColorDepth(8);   // 32 KB; 16 bits would not leave enough RAM for BLE
+  ready = sprite.createSprite(TREND_W, TREND_H) != nullptr;
+  if (!ready) Serial.println("Not enough RAM for the trend chart");
+  return ready;
+}
+
+//////////////
+
+uint32_t TrendChart::niceScale(uint32_t value) {
+  uint32_t decade = 1;
+  for (;;) {
+    if (value <= decade) return decade;
+    if (value <= 2 * decade) return 2 * decade;
+    if (value <= 5 * decade) return 5 * decade;
+    if (decade > 0xFFFFFFFF / 100) return 0xFFFFFFFF;
+    decade *= 10;
+  }
+}
+
+//////////////
+
+bool TrendChart::rescale(const TrendRing &ring) {
+  // The scale only steps when the largest sample shown changes decade step, so the plot is rarely redrawn
+  uint32_t maxW = 0, maxA = 0;
+  for (int i = 0; i < TREND_W; i++) {
+    if (ring.watts10[i] != TREND_GAP && ring.watts10[i] > maxW) maxW = ring.watts10[i];
+    if (ring.milliamps[i] != TREND_GAP && ring.milliamps[i] > maxA) maxA = ring.milliamps[i];
+  }
+  uint32_t w = niceScale(maxW < 100 ? 100 : maxW);   // at least 10 W
+  uint32_t a = niceScale(maxA < 100 ? 100 : maxA);   // ... and 0.1 A
+  if (w == wattsScale && a == ampsScale) return false;
+  wattsScale = w;
+  ampsScale = a;
+  return true;
+}
+
+//////////////
+
+static int16_t plotY(uint32_t value, uint32_t scale) {
+  return TREND_H - 1 - (int16_t)((uint64_t)value * (TREND_H - 1) / scale);
+}
+
+void TrendChart::drawColumn(int x, const TrendRing &ring, int i) {
+  // Blank the column, then join the sample to the one before it with a vertical line
+  //
+  uint16_t now = ring.slot(i), before = ring.slot(i > 0 ? i - 1 : i);
+  sprite.drawFastVLine(x, 0, TREND_H, TREND_BG);
+  if (now % 32 == 0) {
+    for (int y = 0; y < TREND_H; y += 4) sprite.drawPixel(x, y, TREND_GRID);   // a grid line every 32 s, moving with the samples
+  }
+  for (int y = TREND_H / 4; y < TREND_H; y += TREND_H / 4) sprite.drawPixel(x, y, TREND_GRID);
+  //
+#if TREND_CURRENT
+  if (ring.milliamps[now] != TREND_GAP) {
+    int16_t y = plotY(ring.milliamps[now], ampsScale);
+    int16_t y0 = ring.milliamps[before] != TREND_GAP ? plotY(ring.milliamps[before], ampsScale) : y;
+    sprite.drawFastVLine(x, y < y0 ? y : y0, abs(y - y0) + 1, TREND_AMPS);
+  }
+#endif
+  if (ring.watts10[now] != TREND_GAP) {
+    int16_t y = plotY(ring.watts10[now], wattsScale);
+    int16_t y0 = ring.watts10[before] != TREND_GAP ? plotY(ring.watts10[before], wattsScale) : y;
+    sprite.drawFastVLine(x, y < y0 ? y : y0, abs(y - y0) + 1, TREND_POWER);
+  }
+}
+
+//////////////
+
+void TrendChart::drawLabels() {
+  // Full height of the plot, in the colour of each trace
+  //
+  char text[32], *p;
+  tft.setTextPadding(TREND_W / 2);
+  tft.setTextColor(TREND_POWER, TREND_BG);
+  p = fmtStr(text, "Power 0-");
+  fmtStr(fmtFixed(p, wattsScale / 10, 0), " W");
+  tft.drawString(text, TREND_X, TREND_LABEL_Y, 2);
+#if TREND_CURRENT
+  tft.setTextColor(TREND_AMPS, TREND_BG);
+  p = fmtStr(text, "Current 0-");
+  fmtStr(fmtFixed(p, ampsScale, 3), " A");
+  tft.drawString(text, TREND_X + TREND_W / 2, TREND_LABEL_Y, 2);
+#endif
+  tft.setTextPadding(0);
+}
+
+//////////////
+
+void TrendChart::show(const TrendRing &ring) {
+  if (!ready) return;
+  uint32_t start = micros();
+  rescale(ring);
+  drawLabels();
+  for (int i = 0; i < TREND_W; i++) drawColumn(i, ring, i);
+  redraws++;
+  push(start);
+}
+
+//////////////
+
+void TrendChart::update(const TrendRing &ring) {
+  if (!ready) return;
+  uint32_t start = micros();
+  if (rescale(ring)) {
+    drawLabels();
+    for (int i = 0; i < TREND_W; i++) drawColumn(i, ring, i);
+    redraws++;
+  } else {
+    sprite.scroll(-1, 0);
+    drawColumn(TREND_W - 1, ring, TREND_W - 1);
+    scrolls++;
+  }
+  push(start);
+}
+
+//////////////
+
+void TrendChart::push(uint32_t start) {
+  sprite.pushSprite(TREND_X, TREND_Y);
+  lastUs = micros() - start;
+  if (lastUs > maxUs) maxUs = lastUs;
+  if (lastUs > TREND_BUDGET_US) over++;
+}
+
+//////////////
+
+void TrendChart::printStats(Print &out) const {
+  out.printf("Trend: %lu scrolls, %lu redraws, update last %lu us, max %lu us, %lu over the %lu us budget\r\n",
+             (unsigned long)scrolls, (unsigned long)redraws, (unsigned long)lastUs, (unsigned long)maxUs,
+             (unsigned long)over, (unsigned long)TREND_BUDGET_US);
+}
@@ -0,0 +1,70 @@
+/**
+  trend.h - scrolling power trend chart on the CYD's TFT
+
+  The last TREND_W seconds of power (and optionally current) are kept in a ring
+  and plotted into an 8-bit sprite. Every second the sprite is scrolled one
+  column to the left and only the new column is drawn, then the sprite is
+  pushed to the screen in one SPI transfer. The whole plot is redrawn only when
+  a value no longer fits the scale, or all of them fit a smaller one.
+
+  Budget: one push of the 256x128 sprite moves 32768 pixels, about 14 ms at
+  the CYD's 40 MHz SPI clock. Frames that take longer than TREND_BUDGET_US are
+  counted.
+*/
+//
+#pragma once
+//
+#include <Arduino.h>
+#include <TFT_eSPI.h>
+//
+#define TREND_W          256     // plot size [pixels] = seconds shown
+#define TREND_H          128
+#define TREND_X          ((320 - TREND_W) / 2)
+#define TREND_Y          76
+#define TREND_LABEL_Y    52      // row of the scale labels (font 2)
+#define TREND_BUDGET_US  20000   // longest expected update() [us]
+#ifndef TREND_CURRENT
+#define TREND_CURRENT    1       // plot the current too
+#endif
+#define TREND_GAP        0xFFFFFFFF   // no sample for this second
+
+// The samples shown, oldest first
+struct TrendRing {
+  uint32_t watts10[TREND_W];
+  uint32_t milliamps[TREND_W];
+  uint16_t head = 0;             // next slot to write (= the oldest sample)
+  //
+  void clear();
+  void add(uint32_t w10, uint32_t mA);
+  uint16_t slot(int i) const { return (head + i) % TREND_W; }   // slot of the i-th oldest sample
+};
+
+class TrendChart {
+public:
+  explicit TrendChart(TFT_eSPI &display) : tft(display), sprite(&display) {}
+  //
+  bool begin();                      // allocate the sprite; false if there is not enough RAM
+  bool isReady() const { return ready; }
+  void show(const TrendRing &ring);  // draw the chart from scratch (view or socket changed)
+  void update(const TrendRing &ring);  // the ring got one new sample: scroll it in
+  //
+  uint32_t lastPushUs() const { return lastUs; }
+  uint32_t maxPushUs() const { return maxUs; }
+  uint32_t overBudget() const { return over; }
+  void printStats(Print &out) const;
+  //
+  static uint32_t niceScale(uint32_t value);   // the smallest 1, 2 or 5 * 10^n not below value
+
+private:
+  bool rescale(const TrendRing &ring);         // pick the scales for the ring; true if they changed
+  void drawColumn(int x, const TrendRing &ring, int i);
+  void drawLabels();
+  void push(uint32_t start);
+  //
+  TFT_eSPI &tft;
+  TFT_eSprite sprite;
+  bool ready = false;
+  uint32_t wattsScale = 0, ampsScale = 0;      // full height of the plot [W*10], [mA]
+  uint32_t lastUs = 0, maxUs = 0, over = 0;
+  uint32_t scrolls = 0, redraws = 0;
+};